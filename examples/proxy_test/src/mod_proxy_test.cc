@@ -198,15 +198,16 @@ void ProxyTestModule::requestHandler(ErrCode ec,
     }
 
     map<string, string> res;
-    if (ec != downstream::OK || response->body().empty()) 
+    InvokeResult iresult;
+    if (ec != downstream::OK || 0 == response->body_size()) 
     {
         res["result"] = "downstream error";
         ctx->res_.assign("downstream error");
     } 
     else 
     {
-        res["result"] = response->body();
-        if (ctx->body_sz_ > 0 && ctx->body_sz_ != response->body().size()) 
+        iresult.set_body(response->body_buffer(), response->body_size());
+        if (ctx->body_sz_ > 0 && ctx->body_sz_ != response->body_size()) 
         {
             ctx->res_.assign("response error");
         }
@@ -217,7 +218,6 @@ void ProxyTestModule::requestHandler(ErrCode ec,
     //    ctx->res_ = response->body();
     //}
 
-    InvokeResult iresult;
     iresult.set_results(res);
     ctx->complete_handler_(iresult);
 
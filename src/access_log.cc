@@ -0,0 +1,535 @@
+#include "access_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <gflags/gflags.h>
+
+#include "config.h"
+#include "trace.h"
+#include "types.h"
+#include "log/logging.h"
+
+namespace shs
+{
+
+DEFINE_string(accesslog_dir, "",
+    "Directory of the binary access log segments, empty to disable");
+DEFINE_int32(accesslog_segment_mb, 64, "Size of an access log segment");
+DEFINE_int32(accesslog_rotate_secs, 3600,
+    "Start a new access log segment after this many seconds");
+
+namespace
+{
+
+const uint32_t kSegmentMagic = 0x5348414c;    // "SHAL"
+const uint32_t kSegmentVersion = 1;
+
+struct SegmentHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    int32_t  pid;
+    int64_t  created_us;
+    volatile uint64_t count;    // records written, names included
+    char     reserved[32];
+};
+
+struct NameRecord
+{
+    uint16_t type;
+    uint16_t len;
+    uint32_t name_id;
+    char     name[56];
+};
+
+struct Segment
+{
+    int fd;
+    SegmentHeader* header;
+    AccessRecord* records;
+    uint64_t capacity;
+    size_t size;
+    int64_t created_us;
+    std::map<std::string, uint32_t> names;
+};
+
+bool g_enabled = false;
+Segment g_segment;
+uint32_t g_segment_seq = 0;
+
+int64_t NowUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool CreateSegment(int64_t now_us)
+{
+    char stamp[32];
+    time_t sec = now_us / 1000000;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+    char name[128];
+    snprintf(name, sizeof(name), "/access.%d.%s.%u.bin", (int)getpid(),
+        stamp, g_segment_seq++);
+    std::string path = FLAGS_accesslog_dir + name;
+
+    uint64_t capacity = (uint64_t)FLAGS_accesslog_segment_mb * 1024 * 1024
+        / sizeof(AccessRecord);
+    if (capacity < 1024)
+    {
+        capacity = 1024;
+    }
+
+    size_t size = sizeof(SegmentHeader) + capacity * sizeof(AccessRecord);
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) != 0)
+    {
+        SLOG(ERROR) << "AccessLog create " << path << " failed! err="
+            << strerror(errno);
+
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        return false;
+    }
+
+    void* mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED)
+    {
+        SLOG(ERROR) << "AccessLog mmap " << path << " failed! err="
+            << strerror(errno);
+        close(fd);
+
+        return false;
+    }
+
+    g_segment.fd = fd;
+    g_segment.header = (SegmentHeader *)mem;
+    g_segment.records = (AccessRecord *)(g_segment.header + 1);
+    g_segment.capacity = capacity;
+    g_segment.size = size;
+    g_segment.created_us = now_us;
+    g_segment.names.clear();
+
+    g_segment.header->record_size = sizeof(AccessRecord);
+    g_segment.header->pid = getpid();
+    g_segment.header->created_us = now_us;
+    g_segment.header->version = kSegmentVersion;
+    g_segment.header->magic = kSegmentMagic;
+
+    return true;
+}
+
+// Cuts the preallocated tail off, readers go by the count anyway.
+void CloseSegment()
+{
+    if (NULL == g_segment.header)
+    {
+        return;
+    }
+
+    size_t used = sizeof(SegmentHeader)
+        + g_segment.header->count * sizeof(AccessRecord);
+
+    munmap(g_segment.header, g_segment.size);
+    if (ftruncate(g_segment.fd, used) != 0)
+    {
+        SLOG(WARN) << "AccessLog trim segment failed! err="
+            << strerror(errno);
+    }
+    close(g_segment.fd);
+
+    g_segment.header = NULL;
+    g_segment.records = NULL;
+}
+
+uint32_t NameId(const char* name)
+{
+    std::map<std::string, uint32_t>::iterator it = g_segment.names.find(name);
+    if (it != g_segment.names.end())
+    {
+        return it->second;
+    }
+
+    uint32_t id = g_segment.names.size();
+    g_segment.names[name] = id;
+
+    NameRecord* record = (NameRecord *)
+        &g_segment.records[g_segment.header->count];
+    memset(record, 0, sizeof(NameRecord));
+    record->type = AccessRecord::kName;
+    record->name_id = id;
+    record->len = strnlen(name, sizeof(record->name) - 1);
+    memcpy(record->name, name, record->len);
+    g_segment.header->count++;
+
+    return id;
+}
+
+uint32_t Clamp(int64_t us)
+{
+    if (us < 0)
+    {
+        return 0;
+    }
+
+    return us > 0xffffffffLL ? 0xffffffff : us;
+}
+
+void AppendJsonString(const std::string& s, std::string* out)
+{
+    out->push_back('"');
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\')
+        {
+            out->push_back('\\');
+            out->push_back(c);
+        }
+        else if (c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out->append(buf);
+        }
+        else
+        {
+            out->push_back(c);
+        }
+    }
+    out->push_back('"');
+}
+
+const char* MethodName(int method)
+{
+    switch (method)
+    {
+    case SHS_HTTP_REQ_TYPE_GET:
+        return "GET";
+
+    case SHS_HTTP_REQ_TYPE_POST:
+        return "POST";
+
+    case SHS_HTTP_REQ_TYPE_HEAD:
+        return "HEAD";
+
+    default:
+        return "-";
+    }
+}
+
+} // namespace
+
+bool AccessLog::Open()
+{
+    static_assert(sizeof(AccessRecord) == 64, "AccessRecord is 64 bytes");
+    static_assert(sizeof(NameRecord) == sizeof(AccessRecord),
+        "NameRecord is the size of an AccessRecord");
+    static_assert(sizeof(SegmentHeader) == sizeof(AccessRecord),
+        "SegmentHeader is the size of an AccessRecord");
+
+    if (!FLAGS_accesslog || FLAGS_accesslog_dir.empty())
+    {
+        return true;
+    }
+
+    if (!CreateSegment(NowUs()))
+    {
+        return false;
+    }
+
+    g_enabled = true;
+    atexit(Close);
+
+    // the phase timings are taken from the request's trace
+    Trace::RecordAll();
+
+    return true;
+}
+
+void AccessLog::Close()
+{
+    CloseSegment();
+    g_enabled = false;
+}
+
+bool AccessLog::enabled()
+{
+    return g_enabled;
+}
+
+void AccessLog::Append(const Trace* trace, int status, int method,
+    const char* client_ip, int client_port, size_t request_bytes,
+    size_t response_bytes)
+{
+    const TraceRecord& tr = trace->record_;
+
+    // room for a name record as well
+    if (g_segment.header->count + 2 > g_segment.capacity
+        || tr.start_us - g_segment.created_us
+            >= (int64_t)FLAGS_accesslog_rotate_secs * 1000000)
+    {
+        CloseSegment();
+        if (!CreateSegment(NowUs()))
+        {
+            g_enabled = false;
+
+            return;
+        }
+    }
+
+    int n = trace->num_spans_;
+    if (n > TraceRecord::kMaxSpans)
+    {
+        n = TraceRecord::kMaxSpans;
+    }
+
+    int64_t first[kTracePhaseMax];
+    int64_t last_downstream_done = -1;
+    int attempts = 0;
+
+    for (int i = 0; i < kTracePhaseMax; i++)
+    {
+        first[i] = -1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        const TraceRecord::Span& span = tr.spans[i];
+        if (span.phase >= kTracePhaseMax)
+        {
+            continue;
+        }
+
+        if (first[span.phase] < 0 || span.offset_us < first[span.phase])
+        {
+            first[span.phase] = span.offset_us;
+        }
+
+        if (span.phase == kTraceDownstream)
+        {
+            attempts++;
+        }
+        else if (span.phase == kTraceDownstreamDone
+            && (int64_t)span.offset_us > last_downstream_done)
+        {
+            last_downstream_done = span.offset_us;
+        }
+    }
+
+    uint32_t name_id = NameId(tr.name);
+    AccessRecord* record = &g_segment.records[g_segment.header->count];
+
+    record->type = AccessRecord::kRequest;
+    record->status = status;
+    record->name_id = name_id;
+    record->start_us = tr.start_us;
+    record->trace_id = tr.id;
+    record->total_us = Clamp((Trace::Now() - trace->start_ns_) / 1000);
+    record->queue_us = first[kTraceDequeue] >= 0 && first[kTraceEnqueue] >= 0
+        ? Clamp(first[kTraceDequeue] - first[kTraceEnqueue]) : 0;
+    record->invoke_us = first[kTraceInvoked] >= 0 && first[kTraceDequeue] >= 0
+        ? Clamp(first[kTraceInvoked] - first[kTraceDequeue]) : 0;
+    record->downstream_us = last_downstream_done >= 0
+        && first[kTraceDownstream] >= 0
+        ? Clamp(last_downstream_done - first[kTraceDownstream]) : 0;
+    record->request_bytes = Clamp(request_bytes);
+    record->response_bytes = Clamp(response_bytes);
+
+    in_addr_t ip = inet_addr(client_ip);
+    record->client_ip = ip == INADDR_NONE ? 0 : ip;
+    record->client_port = client_port;
+    record->downstream_attempts = attempts > 255 ? 255 : attempts;
+    record->method = method;
+    record->reserved = 0;
+
+    g_segment.header->count++;
+}
+
+AccessSegment::AccessSegment()
+    : data_(NULL)
+    , size_(0)
+    , pos_(0)
+{
+}
+
+AccessSegment::~AccessSegment()
+{
+    if (data_)
+    {
+        munmap((void *)data_, size_);
+    }
+}
+
+bool AccessSegment::Open(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    void* mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SegmentHeader))
+    {
+        mem = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (mem == MAP_FAILED)
+    {
+        return false;
+    }
+
+    const SegmentHeader* header = (const SegmentHeader *)mem;
+    if (header->magic != kSegmentMagic || header->version != kSegmentVersion
+        || header->record_size != sizeof(AccessRecord))
+    {
+        munmap(mem, st.st_size);
+
+        return false;
+    }
+
+    data_ = (const char *)mem;
+    size_ = st.st_size;
+
+    return true;
+}
+
+int32_t AccessSegment::pid() const
+{
+    return ((const SegmentHeader *)data_)->pid;
+}
+
+bool AccessSegment::Next(AccessRecord* record, std::string* name)
+{
+    const SegmentHeader* header = (const SegmentHeader *)data_;
+    const AccessRecord* records = (const AccessRecord *)(header + 1);
+    uint64_t count = header->count;
+    uint64_t capacity = (size_ - sizeof(SegmentHeader)) / sizeof(AccessRecord);
+
+    if (count > capacity)
+    {
+        count = capacity;
+    }
+
+    while (pos_ < count)
+    {
+        const AccessRecord* r = &records[pos_++];
+
+        if (r->type == AccessRecord::kName)
+        {
+            const NameRecord* nr = (const NameRecord *)r;
+            if (nr->name_id >= names_.size())
+            {
+                names_.resize(nr->name_id + 1);
+            }
+
+            names_[nr->name_id].assign(nr->name,
+                strnlen(nr->name, sizeof(nr->name)));
+
+            continue;
+        }
+
+        if (r->type != AccessRecord::kRequest)
+        {
+            continue;
+        }
+
+        *record = *r;
+        if (r->name_id < names_.size())
+        {
+            *name = names_[r->name_id];
+        }
+        else
+        {
+            name->clear();
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+void AccessSegment::FormatText(const AccessRecord& record,
+    const std::string& name, std::string* out)
+{
+    char buf[256];
+    time_t sec = record.start_us / 1000000;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+
+    size_t len = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    len += snprintf(buf + len, sizeof(buf) - len, ".%06d ",
+        (int)(record.start_us % 1000000));
+    out->append(buf, len);
+
+    struct in_addr addr;
+    addr.s_addr = record.client_ip;
+    inet_ntop(AF_INET, &addr, buf, sizeof(buf));
+    out->append(buf);
+
+    len = snprintf(buf, sizeof(buf), ":%u %s ", record.client_port,
+        MethodName(record.method));
+    out->append(buf, len);
+    out->append(name.empty() ? "-" : name);
+
+    len = snprintf(buf, sizeof(buf),
+        " %u total=%uus queue=%uus invoke=%uus downstream=%u/%uus"
+        " in=%u out=%u trace=%016llx\n",
+        record.status, record.total_us, record.queue_us, record.invoke_us,
+        record.downstream_attempts, record.downstream_us,
+        record.request_bytes, record.response_bytes,
+        (unsigned long long)record.trace_id);
+    out->append(buf, len);
+}
+
+void AccessSegment::FormatJson(const AccessRecord& record,
+    const std::string& name, std::string* out)
+{
+    char buf[256];
+    struct in_addr addr;
+    addr.s_addr = record.client_ip;
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+
+    size_t len = snprintf(buf, sizeof(buf),
+        "{\"start_us\":%lld,\"client\":\"%s:%u\",\"method\":\"%s\","
+        "\"name\":", (long long)record.start_us, ip, record.client_port,
+        MethodName(record.method));
+    out->append(buf, len);
+    AppendJsonString(name, out);
+
+    len = snprintf(buf, sizeof(buf),
+        ",\"status\":%u,\"total_us\":%u,\"queue_us\":%u,\"invoke_us\":%u,"
+        "\"downstream_attempts\":%u,\"downstream_us\":%u,"
+        "\"request_bytes\":%u,\"response_bytes\":%u,"
+        "\"trace_id\":\"%016llx\"}\n",
+        record.status, record.total_us, record.queue_us, record.invoke_us,
+        record.downstream_attempts, record.downstream_us,
+        record.request_bytes, record.response_bytes,
+        (unsigned long long)record.trace_id);
+    out->append(buf, len);
+}
+
+} // namespace shs
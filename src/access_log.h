@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace shs
+{
+
+class Trace;
+
+// One served request, 64 bytes. Times are microseconds; the phase
+// durations come from the request's Trace and are 0 for phases the
+// request never went through.
+struct AccessRecord
+{
+    static const uint16_t kRequest = 1;
+    static const uint16_t kName = 2;    // interns a name, see access_log.cc
+
+    uint16_t type;
+    uint16_t status;
+    uint32_t name_id;           // "module/method"
+    int64_t  start_us;          // wall clock of the accept or the headers
+    uint64_t trace_id;
+    uint32_t total_us;          // until the reply was written
+    uint32_t queue_us;          // enqueue to dequeue
+    uint32_t invoke_us;         // dequeue to the module's result
+    uint32_t downstream_us;     // first downstream send to last answer
+    uint32_t request_bytes;     // bodies only
+    uint32_t response_bytes;
+    uint32_t client_ip;         // IPv4, network order
+    uint16_t client_port;
+    uint8_t  downstream_attempts;
+    uint8_t  method;            // http_cmd_type
+    uint32_t reserved;
+};
+
+// Binary access log. Each worker appends AccessRecords to its own
+// segment file, <accesslog_dir>/access.<pid>.<time>.<seq>.bin, which is
+// preallocated and mmap'd so that a request costs a memcpy and no
+// syscall. A segment is closed, trimmed and replaced once it is full or
+// older than FLAGS_accesslog_rotate_secs. Names are interned per
+// segment with kName records, so every segment decodes on its own with
+// shs_access_dump.
+//
+// Written from the worker's event loop only.
+class AccessLog
+{
+public:
+    // In the worker; a no-op unless FLAGS_accesslog and
+    // FLAGS_accesslog_dir are set.
+    static bool Open();
+    static void Close();
+    static bool enabled();
+
+    static void Append(const Trace* trace, int status, int method,
+        const char* client_ip, int client_port, size_t request_bytes,
+        size_t response_bytes);
+};
+
+// Reads a segment, also one that is still being written.
+class AccessSegment
+{
+public:
+    AccessSegment();
+    ~AccessSegment();
+
+    bool Open(const std::string& path);
+
+    int32_t pid() const;
+
+    // The next request record and its name, false at the end.
+    bool Next(AccessRecord* record, std::string* name);
+
+    static void FormatText(const AccessRecord& record,
+        const std::string& name, std::string* out);
+    static void FormatJson(const AccessRecord& record,
+        const std::string& name, std::string* out);
+
+private:
+    const char* data_;
+    size_t size_;
+    uint64_t pos_;
+    std::vector<std::string> names_;
+};
+
+} // namespace shs
@@ -39,6 +39,17 @@ DEFINE_string(status_file, "", "Check service status");
 DEFINE_bool(rewrite_path_to_default, false, "rewrite http path to default module name");
 DEFINE_bool(t, false, "Test Configure");
 DEFINE_bool(accesslog, true, "Print accesslog or not");
+DEFINE_bool(memory_tcache, false, 
+    "Serve pool blocks, large pool allocations and buffers from the "
+    "thread-caching allocator instead of malloc");
+DEFINE_int32(memory_tcache_reserve, 8192,
+    "Address space, in MB, reserved for the thread-caching allocator; "
+    "only spans in use are committed, allocations beyond it use malloc");
+DEFINE_bool(shm_hugepages, false,
+    "Back shared regions of 2M and more with huge pages, from the hugetlb "
+    "pool or else transparent ones");
+DEFINE_bool(shm_populate, false,
+    "Fault shared regions in when the master maps them, not on first use");
 DEFINE_string(dlopen_flag, "RTLD_LAZY", "default RTLD_LAZY");
 DEFINE_int32(connection_n, 65535, "number of connections per thread, default 65535");
 
@@ -8,6 +8,10 @@ namespace shs
 {
 
 DECLARE_bool(accesslog);
+DECLARE_bool(memory_tcache);
+DECLARE_int32(memory_tcache_reserve);
+DECLARE_bool(shm_hugepages);
+DECLARE_bool(shm_populate);
 DECLARE_string(dlopen_flag);
 DECLARE_bool(t);
 
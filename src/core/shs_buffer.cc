@@ -56,6 +56,7 @@ buffer_t * buffer_create(pool_t *pool, size_t size)
     b->end = b->last + size;
     b->memory = SHS_TRUE;
     b->in_file = SHS_FALSE;
+    b->cached = SHS_FALSE;
 
     return b;
 }
@@ -98,3 +99,107 @@ void buffer_free(buffer_t *buf)
     memory_free(buf, sizeof(buffer_t));
 }
 
+
+#define BUFFER_CACHE_MIN_SHIFT 12
+#define BUFFER_CACHE_CLASSES   9
+#define BUFFER_CACHE_DEPTH     32
+
+typedef struct buffer_cache_block_s buffer_cache_block_t;
+
+struct buffer_cache_block_s
+{
+    buffer_cache_block_t *next;
+};
+
+static __thread buffer_cache_block_t *t_buffer_cache[BUFFER_CACHE_CLASSES];
+static __thread uint32_t t_buffer_cache_cnt[BUFFER_CACHE_CLASSES];
+
+static int buffer_cache_class(size_t size)
+{
+    int    cls = 0;
+    size_t csize = (size_t)1 << BUFFER_CACHE_MIN_SHIFT;
+
+    while (csize < size) 
+    {
+        csize <<= 1;
+        cls++;
+    }
+
+    return cls < BUFFER_CACHE_CLASSES ? cls : -1;
+}
+
+buffer_t * buffer_cache_create(pool_t *pool, size_t size)
+{
+    buffer_t             *b = NULL;
+    buffer_cache_block_t *blk = NULL;
+    int                   cls = 0;
+
+    cls = buffer_cache_class(size);
+    if (cls < 0 || !pool) 
+    {
+        return buffer_create(pool, size);
+    }
+
+    b = (buffer_t *)pool_calloc(pool, sizeof(buffer_t));
+    if (!b) 
+    {
+        return NULL;
+    }
+
+    size = (size_t)1 << (cls + BUFFER_CACHE_MIN_SHIFT);
+
+    blk = t_buffer_cache[cls];
+    if (blk) 
+    {
+        t_buffer_cache[cls] = blk->next;
+        t_buffer_cache_cnt[cls]--;
+        b->start = (uchar_t *)blk;
+    } 
+    else 
+    {
+        b->start = (uchar_t *)memory_alloc(size);
+        if (!b->start) 
+        {
+            return NULL;
+        }
+    }
+
+    b->pos = b->start;
+    b->last = b->start;
+    b->end = b->start + size;
+    b->memory = SHS_TRUE;
+    b->in_file = SHS_FALSE;
+    b->cached = SHS_TRUE;
+
+    return b;
+}
+
+void buffer_cache_free(buffer_t *buf)
+{
+    buffer_cache_block_t *blk = NULL;
+    int                   cls = 0;
+    size_t                size = 0;
+
+    if (!buf || !buf->cached || !buf->start) 
+    {
+        return;
+    }
+
+    size = buf->end - buf->start;
+    cls = buffer_cache_class(size);
+
+    if (cls >= 0 && t_buffer_cache_cnt[cls] < BUFFER_CACHE_DEPTH) 
+    {
+        blk = (buffer_cache_block_t *)buf->start;
+        blk->next = t_buffer_cache[cls];
+        t_buffer_cache[cls] = blk;
+        t_buffer_cache_cnt[cls]++;
+    } 
+    else 
+    {
+        memory_free(buf->start, size);
+    }
+
+    buf->start = buf->pos = buf->last = buf->end = NULL;
+    buf->cached = SHS_FALSE;
+}
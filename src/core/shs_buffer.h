@@ -14,6 +14,7 @@ struct buffer_s
     uint32_t  temporary:1; // alloc in pool, need not free
     uint32_t  memory:1;    // memory, not file
     uint32_t  in_file:1;   // file flag
+    uint32_t  cached:1;    // data from the buffer cache, see buffer_cache_free
 };
 
 typedef struct chunk_s chunk_t;
@@ -41,5 +42,14 @@ buffer_t *buffer_alloc(pool_t *p);
 void      buffer_free(buffer_t *buf);
 void      buffer_shrink(buffer_t* buf);
 
+/*
+ * Buffers whose data comes from a per-thread, size-classed cache
+ * (4K..1M, powers of two) instead of the pool, so that large receive
+ * buffers are recycled rather than malloc'ed and freed per request.
+ * The buffer_t itself is still allocated from the pool.
+ */
+buffer_t *buffer_cache_create(pool_t *pool, size_t size);
+void      buffer_cache_free(buffer_t *buf);
+
 #endif
 
@@ -34,21 +34,32 @@ enum
     CONN_ERROR_EOF
 };
 
+/*
+ * What the event loop and a read handler touch on every readiness event
+ * comes first, 40 bytes, which leaves room in its line for the read
+ * event's hot fields (see conn_slot_t). The rest is needed to write or
+ * to re-arm, or when the connection is taken or given back.
+ */
 struct conn_s 
 {
     int                    fd;
-    void                  *next;
-    void                  *conn_data;
+    uint32_t               tcp_nodelay:2;
+    uint32_t               tcp_nopush:2;
     event_t               *read;
     event_t               *write;
+    void                  *conn_data;
     sysio_recv_pt          recv;
+
     sysio_send_pt          send;
+    event_base_t          *ev_base;  
+    event_timer_t         *ev_timer;
+    pool_t                *pool;
+    void                  *next;
     //sysio_recv_chain_pt    recv_chain;
     //sysio_send_chain_pt    send_chain;
     //sysio_sendfile_pt      sendfile_chain;
     //listening_t           *listening;
     //size_t                 sent;
-    pool_t                *pool;
     //struct sockaddr       *sockaddr;
     //socklen_t              socklen;
     //string_t               addr_text;
@@ -56,10 +67,6 @@ struct conn_s
     //uint32_t               error:1;
     //uint32_t               sendfile:1;
     //uint32_t               sndlowat:1;
-    uint32_t               tcp_nodelay:2;
-    uint32_t               tcp_nopush:2;
-    event_timer_t         *ev_timer;
-    event_base_t          *ev_base;  
 };
 
 struct conn_peer_s 
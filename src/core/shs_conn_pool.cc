@@ -3,19 +3,23 @@
 #include "shs_event_timer.h"
 #include "shs_lock.h"
 #include "shs_conn.h"
+#include "shs_math.h"
 
 conn_pool_t       comm_conn_pool;
 shs_atomic_lock_t comm_conn_lock;
 
+static_assert(offsetof(conn_slot_t, read) + offsetof(event_t, data)
+    == DEFAULT_CACHELINE_SIZE, "read event's hot fields start a line");
+static_assert(offsetof(conn_slot_t, conn) + offsetof(conn_t, send)
+    <= 2 * DEFAULT_CACHELINE_SIZE, "connection's hot fields share it");
+
 static void put_comm_conn(conn_t *c);
 static conn_t* get_comm_conn(uint32_t n, int *num);
 
 int conn_pool_init(conn_pool_t *pool, uint32_t connection_n)
 {
-    conn_t   *conn = NULL;
-    event_t  *revs = NULL;
-    event_t  *wevs = NULL;
-    uint32_t  i = 0;
+    conn_slot_t *slot = NULL;
+    uint32_t     i = 0;
 
     if (0 == connection_n) 
     {
@@ -23,53 +27,39 @@ int conn_pool_init(conn_pool_t *pool, uint32_t connection_n)
     }
 
     pool->connection_n = connection_n;
-    pool->connections = (conn_t *)memory_calloc(sizeof(conn_t) * pool->connection_n);
-    if (!pool->connections) 
-    {
-        return SHS_ERROR;
-    }
-
-    pool->read_events = (event_t *)memory_calloc(sizeof(event_t) * pool->connection_n);
-    if (!pool->read_events) 
-    {
-        conn_pool_free(pool);
-		
-        return SHS_ERROR;
-    }
-
-    pool->write_events = (event_t *)memory_calloc(sizeof(event_t) * pool->connection_n);
-    if (!pool->write_events) 
+    pool->slots_mem = memory_calloc(sizeof(conn_slot_t) * pool->connection_n
+        + DEFAULT_CACHELINE_SIZE);
+    if (!pool->slots_mem) 
     {
-        conn_pool_free(pool);
-
         return SHS_ERROR;
     }
 
-    conn = pool->connections;
-    revs = pool->read_events;
-    wevs = pool->write_events;
+    pool->slots = (conn_slot_t *)SHS_MATH_ALIGNMENT(
+        (uintptr_t)pool->slots_mem, DEFAULT_CACHELINE_SIZE);
 
     for (i = 0; i < pool->connection_n; i++) 
     {
-        revs[i].instance = 1;
+        slot = &pool->slots[i];
+
+        slot->read.instance = 1;
 
         if (i == pool->connection_n - 1) 
         {
-            conn[i].next = NULL;
+            slot->conn.next = NULL;
         } 
         else 
         {
-            conn[i].next = &conn[i + 1];
+            slot->conn.next = &pool->slots[i + 1].conn;
         }
 
-        conn[i].fd = SHS_INVALID_FILE;
-        conn[i].read = &revs[i];
-        conn[i].read->timer_event = SHS_FALSE;
-        conn[i].write = &wevs[i];
-        conn[i].write->timer_event = SHS_FALSE;
+        slot->conn.fd = SHS_INVALID_FILE;
+        slot->conn.read = &slot->read;
+        slot->conn.read->timer_event = SHS_FALSE;
+        slot->conn.write = &slot->write;
+        slot->conn.write->timer_event = SHS_FALSE;
     }
 
-    pool->free_connections = conn;
+    pool->free_connections = &pool->slots[0].conn;
     pool->free_connection_n = pool->connection_n;
 
     return SHS_OK;
@@ -82,23 +72,12 @@ void conn_pool_free(conn_pool_t *pool)
         return;
     }
 
-    if (pool->connections) 
-    {
-        memory_free(pool->connections,
-            sizeof(conn_t) * pool->connection_n);
-        pool->connections = NULL;
-    }
-
-    if (pool->read_events) 
-    {
-        memory_free(pool->read_events, sizeof(event_t) * pool->connection_n);
-        pool->read_events = NULL;
-    }
-
-    if (pool->write_events) 
+    if (pool->slots_mem) 
     {
-        memory_free(pool->write_events, sizeof(event_t) * pool->connection_n);
-        pool->write_events = NULL;
+        memory_free(pool->slots_mem,
+            sizeof(conn_slot_t) * pool->connection_n + DEFAULT_CACHELINE_SIZE);
+        pool->slots_mem = NULL;
+        pool->slots = NULL;
     }
 
     pool->connection_n = 0;
@@ -1,20 +1,37 @@
 #ifndef SHS_CONN_POOL_H
 #define SHS_CONN_POOL_H
 
+#include <stddef.h>
+
 #include "shs_types.h"
+#include "shs_conn.h"
 
 typedef struct conn_pool_s conn_pool_t;
 
+/*
+ * Each connection comes with its read and write event in one cache line
+ * aligned slot, laid out so the read event's hot fields (its last 24
+ * bytes) and the connection's (its first 40) make up the slot's second
+ * line: a read readiness event touches that line only, a write one adds
+ * the write event's hot fields in the last line.
+ */
+typedef struct conn_slot_s 
+{
+    uchar_t  pad[DEFAULT_CACHELINE_SIZE - offsetof(event_t, data)];
+    event_t  read;
+    conn_t   conn;
+    event_t  write;
+} __attribute__((aligned(DEFAULT_CACHELINE_SIZE))) conn_slot_t;
+
 struct conn_pool_s 
 {
-    conn_t   *connections;
-    uint32_t  connection_n;      // all connections
-    int       change_n;          
-    conn_t   *free_connections;
-    uint32_t  free_connection_n; // free connections that can be used
-    event_t  *read_events;
-    event_t  *write_events;
-    uint32_t  used_n;
+    conn_slot_t *slots;
+    void        *slots_mem;         // slots is aligned within it
+    uint32_t     connection_n;      // all connections
+    int          change_n;          
+    conn_t      *free_connections;
+    uint32_t     free_connection_n; // free connections that can be used
+    uint32_t     used_n;
 };
 
 int conn_pool_common_init();
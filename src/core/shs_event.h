@@ -13,9 +13,17 @@
 
 typedef void (*event_handler_pt)(event_t *ev);
 
+/*
+ * The fields the event loop tests on every readiness event come last,
+ * the 24 bytes from offset 56, so a conn_slot_t can put the read event's
+ * share in the line of its connection's hot fields.
+ */
 struct event_s 
 {
+    queue_t          post_queue;
+    rbtree_node_t    timer;
     void            *data;
+    event_handler_pt handler;
     uint32_t         write:1;
     uint32_t         accepted:1; 
     uint32_t         instance:1;
@@ -26,9 +34,6 @@ struct event_s
     uint32_t         timer_set:1;
     uint32_t         timer_event:1;
     uint32_t         delayed:1;
-    event_handler_pt handler;
-    rbtree_node_t    timer;
-    queue_t          post_queue;
     int              available; 
 };
 
@@ -1,6 +1,8 @@
 #include <stdlib.h>
+#include <pthread.h>
 
 #include "shs_half_life_mempool.h"
+#include "shs_magazine.h"
 #include "shs_queue.h"
 
 struct hl_mempool_s
@@ -10,6 +12,9 @@ struct hl_mempool_s
     int      element_size;
     int      free_size;
     queue_t  free_q;   
+
+    pthread_mutex_t   mutex;    // free_q and free_size
+    magazine_depot_t  depot;
 };
 
 typedef struct hl_mem_node_s
@@ -21,6 +26,8 @@ typedef struct hl_mem_node_s
 static void do_clean(hl_mempool_t* pool);
 static int do_expand(hl_mempool_t* pool);
 static void do_shrink(hl_mempool_t* pool);
+static int do_fill(void *data, void **blocks, int n);
+static void do_drain(void *data, void **blocks, int n);
 
 hl_mempool_t* hl_mempool_create(int max_reserv_size, int min_reserv_size, int elememt_size)
 {
@@ -63,51 +70,43 @@ hl_mempool_t* hl_mempool_create(int max_reserv_size, int min_reserv_size, int el
         queue_insert_head(&t->free_q, &node->q);
         t->free_size++;
     }
+
+    pthread_mutex_init(&t->mutex, NULL);
+    magazine_depot_init(&t->depot, t, do_fill, do_drain);
     
     return t;
 }
 
 void * hl_mempool_get(hl_mempool_t* pool)
 {
-    int            ret = 0;
-    queue_t       *queue = NULL;
     hl_mem_node_t *node = NULL;
-	
-    ret = do_expand(pool);
-    if (ret != 0 && pool->free_size <= 0) 
-    {
-        return NULL;
-    }
-    
-    queue = queue_head(&pool->free_q);
-    if (!queue) 
+
+    node = (hl_mem_node_t *)magazine_get(&pool->depot);
+    if (!node) 
     {
         return NULL;
     }
 
-    queue_remove(queue);
-
-    pool->free_size--;
-    node = queue_data(queue, hl_mem_node_t, q);
-
     return node->ptr;
 }
 
 void hl_mempool_free(hl_mempool_t* pool, void* ptr)
 {
-    queue_t       *queue = NULL;
     hl_mem_node_t *node = NULL;
 
     node = queue_data(ptr, hl_mem_node_t, ptr);
-    queue = &node->q;
-    queue_insert_tail(&pool->free_q, queue);
-    pool->free_size ++;
-    do_shrink(pool);
+    magazine_put(&pool->depot, node);
 }
 
 int hl_mempool_get_free_size(hl_mempool_t* pool)
 {
-    return pool->free_size;
+    int free_size = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    free_size = pool->free_size;
+    pthread_mutex_unlock(&pool->mutex);
+
+    return free_size + magazine_cached(&pool->depot);
 }
 
 void hl_mempool_destroy(hl_mempool_t* pool)
@@ -117,10 +116,54 @@ void hl_mempool_destroy(hl_mempool_t* pool)
         return;
     }
 
+    magazine_depot_destroy(&pool->depot);
     do_clean(pool);
+    pthread_mutex_destroy(&pool->mutex);
     free(pool);
 }
 
+static int do_fill(void *data, void **blocks, int n)
+{
+    hl_mempool_t  *pool = (hl_mempool_t *)data;
+    queue_t       *queue = NULL;
+    int            got = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    do_expand(pool);
+
+    for (; got < n && !queue_empty(&pool->free_q); got++) 
+    {
+        queue = queue_head(&pool->free_q);
+        queue_remove(queue);
+        pool->free_size--;
+        blocks[got] = queue_data(queue, hl_mem_node_t, q);
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return got;
+}
+
+static void do_drain(void *data, void **blocks, int n)
+{
+    hl_mempool_t  *pool = (hl_mempool_t *)data;
+    hl_mem_node_t *node = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    for (int i = 0; i < n; i++) 
+    {
+        node = (hl_mem_node_t *)blocks[i];
+        queue_insert_tail(&pool->free_q, &node->q);
+        pool->free_size++;
+    }
+
+    do_shrink(pool);
+
+    pthread_mutex_unlock(&pool->mutex);
+}
+
 static void do_clean(hl_mempool_t* pool)
 {
     queue_t       *que = NULL;
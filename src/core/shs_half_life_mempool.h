@@ -2,7 +2,10 @@
 #define SHS_HALF_LIFE_MEM_POOL_H
 
 /*
- * not thread safe typedef struct hl_mempool_s hl_mempool_t;
+ * Thread safe: gets and frees go through per-thread magazines (see
+ * shs_magazine.h), the free list behind them is locked and grows and
+ * shrinks between min_reserv_size and max_reserv_size in batches.
+ * hl_mempool_get_free_size() counts the blocks cached by threads too.
  */
 typedef struct hl_mempool_s hl_mempool_t;
 
@@ -167,10 +167,134 @@ int shs_hashtable_init(shs_hashtable_t *ht, SHS_HASHTABLE_CMP *cmp_func,
     ht->cmp = cmp_func;
     ht->hash = hash_func;
     ht->count = 0;
+    ht->rehash_buckets = NULL;
+    ht->rehash_size = 0;
+    ht->rehash_index = 0;
+    ht->rehash_backoff = 0;
+    ht->rehash_wait = 0;
 
     return SHS_HASHTABLE_OK;
 }
 
+static shs_hashtable_link_t ** shs_hashtable_buckets_alloc(
+    shs_hashtable_t *ht, size_t size)
+{
+    unsigned int err_no = -1;
+
+    if (ht->allocator) 
+    {
+        return (shs_hashtable_link_t **)ht->allocator->calloc(ht->allocator,
+            size * sizeof(shs_hashtable_link_t *), &err_no);
+    }
+
+    return (shs_hashtable_link_t **)memory_calloc(size *
+        sizeof(shs_hashtable_link_t *));
+}
+
+static void shs_hashtable_buckets_free(shs_hashtable_t *ht, 
+    shs_hashtable_link_t **buckets, size_t size)
+{
+    unsigned int err_no = -1;
+
+    if (ht->allocator) 
+    {
+        ht->allocator->free(ht->allocator, buckets, &err_no);
+    } 
+    else 
+    {
+        memory_free(buckets, size * sizeof(shs_hashtable_link_t *));
+    }
+}
+
+/*
+ *  hash_bucket - the bucket the key is in, in the new array once its
+ *  old bucket has been moved.
+ */
+static shs_hashtable_link_t ** shs_hashtable_bucket(shs_hashtable_t *ht,
+    const void *key, size_t len)
+{
+    size_t i = ht->hash(key, len, ht->size);
+
+    if (ht->rehash_buckets && i < ht->rehash_index) 
+    {
+        return &ht->rehash_buckets[ht->hash(key, len, ht->rehash_size)];
+    }
+
+    return &ht->buckets[i];
+}
+
+/*
+ *  hash_rehash_step - starts a rehash once the table is loaded past
+ *  SHS_HASHTABLE_MAX_LOAD and moves the next SHS_HASHTABLE_REHASH_STEP
+ *  buckets of one under way.
+ */
+static void shs_hashtable_rehash_step(shs_hashtable_t *ht)
+{
+    shs_hashtable_link_t *walker = NULL;
+    shs_hashtable_link_t *next = NULL;
+    size_t                i = 0;
+    int                   n = 0;
+
+    if (!ht->rehash_buckets) 
+    {
+        if ((size_t)ht->count <= ht->size * SHS_HASHTABLE_MAX_LOAD) 
+        {
+            return;
+        }
+
+        if (ht->rehash_wait) 
+        {
+            ht->rehash_wait--;
+
+            return;
+        }
+
+        ht->rehash_size = shs_math_find_prime(ht->size * 2 + 1);
+        ht->rehash_buckets = shs_hashtable_buckets_alloc(ht, ht->rehash_size);
+        if (!ht->rehash_buckets) 
+        {
+            /* don't retry the allocator on every join and remove */
+            ht->rehash_size = 0;
+            ht->rehash_backoff = ht->rehash_backoff 
+                ? ht->rehash_backoff * 2 : SHS_HASHTABLE_REHASH_STEP;
+            if (ht->rehash_backoff > SHS_HASHTABLE_REHASH_BACKOFF) 
+            {
+                ht->rehash_backoff = SHS_HASHTABLE_REHASH_BACKOFF;
+            }
+            ht->rehash_wait = ht->rehash_backoff;
+
+            return;
+        }
+
+        ht->rehash_backoff = 0;
+
+        ht->rehash_index = 0;
+    }
+
+    for (; n < SHS_HASHTABLE_REHASH_STEP && ht->rehash_index < ht->size; n++) 
+    {
+        for (walker = ht->buckets[ht->rehash_index]; walker; walker = next) 
+        {
+            next = walker->next;
+            i = ht->hash(walker->key, walker->len, ht->rehash_size);
+            walker->next = ht->rehash_buckets[i];
+            ht->rehash_buckets[i] = walker;
+        }
+
+        ht->buckets[ht->rehash_index++] = NULL;
+    }
+
+    if (ht->rehash_index == ht->size) 
+    {
+        shs_hashtable_buckets_free(ht, ht->buckets, ht->size);
+        ht->buckets = ht->rehash_buckets;
+        ht->size = ht->rehash_size;
+        ht->rehash_buckets = NULL;
+        ht->rehash_size = 0;
+        ht->rehash_index = 0;
+    }
+}
+
 /*
  *  hash_join - joins a hash_link under its key lnk->key
  *  into the hash table 'ht'.  
@@ -180,16 +304,18 @@ int shs_hashtable_init(shs_hashtable_t *ht, SHS_HASHTABLE_CMP *cmp_func,
  */
 int shs_hashtable_join(shs_hashtable_t *ht, shs_hashtable_link_t *hl)
 {
-    size_t i = 0;
+    shs_hashtable_link_t **bucket = NULL;
     
     if (!ht || !hl) 
     {
         return SHS_HASHTABLE_ERROR;
     }
 
-    i = ht->hash(hl->key, hl->len, ht->size);
-    hl->next = ht->buckets[i];
-    ht->buckets[i] = hl;
+    shs_hashtable_rehash_step(ht);
+
+    bucket = shs_hashtable_bucket(ht, hl->key, hl->len);
+    hl->next = *bucket;
+    *bucket = hl;
     ht->count++;
     
     return SHS_HASHTABLE_OK;
@@ -203,7 +329,6 @@ int shs_hashtable_join(shs_hashtable_t *ht, shs_hashtable_link_t *hl)
 void * shs_hashtable_lookup(shs_hashtable_t *ht, const void *key, 
     size_t len)
 {
-    size_t                i = 0;
     shs_hashtable_link_t *walker = NULL;
     
     if (!key || !ht) 
@@ -211,9 +336,8 @@ void * shs_hashtable_lookup(shs_hashtable_t *ht, const void *key,
         return NULL;
     }
 
-    i = ht->hash(key, len, ht->size);
-
-    for (walker = ht->buckets[i]; walker; walker = walker->next) 
+    for (walker = *shs_hashtable_bucket(ht, key, len); walker; 
+        walker = walker->next) 
     {
         if (!walker->key) 
         {
@@ -242,17 +366,17 @@ void * shs_hashtable_lookup(shs_hashtable_t *ht, const void *key,
 int shs_hashtable_remove_link(shs_hashtable_t *ht, 
     shs_hashtable_link_t *hl)
 {
-    int                    i = 0;
     shs_hashtable_link_t **link;
 
     if (!ht || !hl) 
     {
         return SHS_HASHTABLE_ERROR;
     }
-    
-    i = ht->hash(hl->key, hl->len, ht->size);
+
+    shs_hashtable_rehash_step(ht);
 	
-    for (link = &ht->buckets[i]; *link; link = &(*link)->next) 
+    for (link = shs_hashtable_bucket(ht, hl->key, hl->len); *link; 
+        link = &(*link)->next) 
     {
         if (*link == hl) 
         {
@@ -269,6 +393,8 @@ int shs_hashtable_remove_link(shs_hashtable_t *ht,
 /*
  *  hash_get_bucket - returns the head item of the bucket 
  *  in the hash table 'hid'. Otherwise, returns NULL on error.
+ *  While a rehash is under way the buckets already moved are empty,
+ *  walk the table with shs_hashtable_iter_next() instead.
  */
 shs_hashtable_link_t * shs_hashtable_get_bucket(shs_hashtable_t *ht, 
     uint32_t bucket)
@@ -281,6 +407,36 @@ shs_hashtable_link_t * shs_hashtable_get_bucket(shs_hashtable_t *ht,
     return ht->buckets[bucket];
 }
 
+void shs_hashtable_iter_init(shs_hashtable_t *ht, shs_hashtable_iter_t *it)
+{
+    it->bucket = 0;
+    it->next = NULL;
+}
+
+shs_hashtable_link_t * shs_hashtable_iter_next(shs_hashtable_t *ht, 
+    shs_hashtable_iter_t *it)
+{
+    shs_hashtable_link_t *hl = NULL;
+    size_t                total = 0;
+
+    total = ht->size + (ht->rehash_buckets ? ht->rehash_size : 0);
+
+    while (!it->next && it->bucket < total) 
+    {
+        it->next = it->bucket < ht->size ? ht->buckets[it->bucket]
+            : ht->rehash_buckets[it->bucket - ht->size];
+        it->bucket++;
+    }
+
+    hl = it->next;
+    if (hl) 
+    {
+        it->next = hl->next;
+    }
+
+    return hl;
+}
+
 void shs_hashtable_free_memory(shs_hashtable_t *ht)
 {
     unsigned int err_no = -1;
@@ -290,6 +446,11 @@ void shs_hashtable_free_memory(shs_hashtable_t *ht)
         return;
     }
     
+    if (ht->rehash_buckets) 
+    {
+        shs_hashtable_buckets_free(ht, ht->rehash_buckets, ht->rehash_size);
+    }
+    
     if (ht->allocator) 
     {
         if (ht->buckets) 
@@ -333,6 +494,17 @@ void shs_hashtable_free_items(shs_hashtable_t *ht,
             ht->count--;
         }
     }
+
+    for (i = 0; ht->rehash_buckets && i < ht->rehash_size; i++) 
+    {
+        for (walker = ht->rehash_buckets[i]; walker;) 
+        {
+            next = walker->next;
+            free_object_func(walker);
+            walker = next;
+            ht->count--;
+        }
+    }
 }
 
 int shs_hashtable_empty(shs_hashtable_t *ht)
@@ -8,6 +8,23 @@
 #define  SHS_HASHTABLE_DEFAULT_SIZE       7951
 #define  SHS_HASHTABLE_STORE_DEFAULT_SIZE 16777217
 
+/*
+ * Once count passes SHS_HASHTABLE_MAX_LOAD links per bucket, a bucket
+ * array about twice as large is allocated and every later join or remove
+ * moves SHS_HASHTABLE_REHASH_STEP more buckets over, so no single call
+ * pays for the whole rehash. Lookups only read: they look in whichever
+ * array the key's bucket is in at the moment, so they may still run in
+ * parallel under a process rwlock held for reading. The new array comes
+ * from the table's allocator too; when it can't be had the table keeps
+ * its size, and each failure doubles the number of joins and removes it
+ * lets pass before trying again, up to SHS_HASHTABLE_REHASH_BACKOFF.
+ *
+ * To walk every link, rehash or not, use shs_hashtable_iter_next().
+ */
+#define  SHS_HASHTABLE_MAX_LOAD           2
+#define  SHS_HASHTABLE_REHASH_STEP        8
+#define  SHS_HASHTABLE_REHASH_BACKOFF     65536
+
 typedef void   SHS_HASHTABLE_FREE(void *);
 typedef int    SHS_HASHTABLE_CMP(const void *, const void *, size_t);
 typedef size_t SHS_HASHTABLE_HASH(const void *, size_t, size_t);
@@ -49,8 +66,19 @@ typedef struct shs_hashtable_s
     size_t                 size;        // bucket number
     int                    coll;        // collection algrithm
     int                    count;       // total element that inserted to hashtable
+    shs_hashtable_link_t **rehash_buckets; // the new array while rehashing
+    size_t                 rehash_size;
+    size_t                 rehash_index;   // buckets below it have moved
+    size_t                 rehash_backoff; // calls to wait after a failure
+    size_t                 rehash_wait;    // calls left before a retry
 } shs_hashtable_t;
 
+typedef struct shs_hashtable_iter_s
+{
+    size_t                bucket;   // over buckets, then rehash_buckets
+    shs_hashtable_link_t *next;
+} shs_hashtable_iter_t;
+
 #define shs_hashtable_link_make(str) {(void*)(str), sizeof((str)) - 1, NULL,NULL}
 #define shs_hashtable_link_null      {NULL, 0, NULL,NULL}
 
@@ -71,5 +99,14 @@ void shs_hashtable_free_items(shs_hashtable_t *ht,
     void (*free_object_func)(void*), void*);
 shs_hashtable_link_t *shs_hashtable_get_bucket(shs_hashtable_t *, uint32_t);
 
+/*
+ * Walks every link once, in both bucket arrays while a rehash is under
+ * way. The table must not be joined to or removed from during the walk,
+ * either would move buckets along.
+ */
+void shs_hashtable_iter_init(shs_hashtable_t *, shs_hashtable_iter_t *);
+shs_hashtable_link_t *shs_hashtable_iter_next(shs_hashtable_t *,
+    shs_hashtable_iter_t *);
+
 #endif
 
@@ -0,0 +1,489 @@
+#include "shs_magazine.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include "shs_lock.h"
+
+/*
+ * The rounds are the owner's alone and taken with plain loads and
+ * stores. Full rounds are swapped into the spare, which is what other
+ * threads steal from; the lock guards the spare, and depot and serial
+ * against a thief, and the owner only takes it to swap or to let go.
+ */
+typedef struct magazine_s
+{
+    magazine_depot_t *depot;
+    uint64_t          serial;
+    uint64_t          used;     // the cache's tick at the last get or put
+    int               n;
+    void             *rounds[MAGAZINE_ROUNDS];
+
+    volatile int      lock;
+    int               spare_n;
+    void             *spare[MAGAZINE_ROUNDS];
+} magazine_t;
+
+typedef struct magazine_cache_s magazine_cache_t;
+
+struct magazine_cache_s
+{
+    magazine_cache_t *prev;     // every cache of the process, under
+    magazine_cache_t *next;     // g_live_mutex, for stealing and counting
+    uint64_t          tick;
+    magazine_t        slots[MAGAZINE_SLOTS];
+};
+
+/*
+ * The live depots of this process, so that a thread only hands blocks
+ * back to a pool that still exists. Kept out of the depots themselves,
+ * which may be shared with other processes.
+ */
+typedef struct magazine_live_s
+{
+    magazine_depot_t *depot;
+    uint64_t          serial;
+} magazine_live_t;
+
+static pthread_mutex_t   g_live_mutex = PTHREAD_MUTEX_INITIALIZER;
+static magazine_live_t  *g_live = NULL;
+static int               g_live_cnt = 0;
+static int               g_live_cap = 0;
+static uint64_t          g_serial = 0;
+static magazine_cache_t *g_caches = NULL;
+static pthread_once_t    g_once = PTHREAD_ONCE_INIT;
+static pthread_key_t     g_cache_key;
+
+static __thread magazine_cache_t *t_magazines = NULL;
+
+static void magazine_thread_exit(void *data);
+static void magazine_atfork_child();
+
+static void magazine_once()
+{
+    pthread_key_create(&g_cache_key, magazine_thread_exit);
+    pthread_atfork(NULL, NULL, magazine_atfork_child);
+}
+
+/* with g_live_mutex held */
+static int magazine_live_find(magazine_depot_t *depot, uint64_t serial)
+{
+    for (int i = 0; i < g_live_cnt; i++) 
+    {
+        if (g_live[i].depot == depot && g_live[i].serial == serial) 
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void magazine_depot_init(magazine_depot_t *depot, void *pool,
+    magazine_fill_pt fill, magazine_drain_pt drain)
+{
+    magazine_live_t *live = NULL;
+
+    pthread_once(&g_once, magazine_once);
+
+    depot->pool = pool;
+    depot->fill = fill;
+    depot->drain = drain;
+    depot->remote = NULL;
+    depot->remote_n = 0;
+    depot->serial = __sync_add_and_fetch(&g_serial, 1);
+
+    pthread_mutex_lock(&g_live_mutex);
+
+    if (g_live_cnt == g_live_cap) 
+    {
+        live = (magazine_live_t *)realloc(g_live, 
+            (g_live_cap ? g_live_cap * 2 : 16) * sizeof(magazine_live_t));
+        if (live) 
+        {
+            g_live = live;
+            g_live_cap = g_live_cap ? g_live_cap * 2 : 16;
+        }
+    }
+
+    /* an unregistered depot still works, threads just never flush it */
+    if (g_live_cnt < g_live_cap) 
+    {
+        g_live[g_live_cnt].depot = depot;
+        g_live[g_live_cnt].serial = depot->serial;
+        g_live_cnt++;
+    }
+
+    pthread_mutex_unlock(&g_live_mutex);
+}
+
+static void magazine_lock(magazine_t *m)
+{
+    while (__sync_lock_test_and_set(&m->lock, 1)) 
+    {
+        sched_yield();
+    }
+}
+
+static void magazine_unlock(magazine_t *m)
+{
+    __sync_lock_release(&m->lock);
+}
+
+static magazine_t *magazine_find(magazine_depot_t *depot)
+{
+    magazine_t *m = NULL;
+
+    if (!t_magazines) 
+    {
+        return NULL;
+    }
+
+    for (int i = 0; i < MAGAZINE_SLOTS; i++) 
+    {
+        m = &t_magazines->slots[i];
+        if (m->depot == depot && m->serial == depot->serial) 
+        {
+            m->used = ++t_magazines->tick;
+
+            return m;
+        }
+    }
+
+    return NULL;
+}
+
+/* hands the blocks back, unless their pool is gone; with m->lock held */
+static void magazine_release(magazine_t *m)
+{
+    if (m->depot && m->n + m->spare_n > 0) 
+    {
+        pthread_mutex_lock(&g_live_mutex);
+        if (magazine_live_find(m->depot, m->serial) >= 0) 
+        {
+            m->depot->drain(m->depot->pool, m->rounds, m->n);
+            m->depot->drain(m->depot->pool, m->spare, m->spare_n);
+        }
+        pthread_mutex_unlock(&g_live_mutex);
+    }
+
+    m->depot = NULL;
+    m->serial = 0;
+    m->n = 0;
+    m->spare_n = 0;
+}
+
+static magazine_t *magazine_adopt(magazine_depot_t *depot)
+{
+    magazine_t *m = NULL;
+
+    if (!t_magazines) 
+    {
+        t_magazines = (magazine_cache_t *)calloc(1, sizeof(magazine_cache_t));
+        if (!t_magazines) 
+        {
+            return NULL;
+        }
+
+        pthread_setspecific(g_cache_key, t_magazines);
+
+        pthread_mutex_lock(&g_live_mutex);
+        t_magazines->next = g_caches;
+        if (g_caches) 
+        {
+            g_caches->prev = t_magazines;
+        }
+        g_caches = t_magazines;
+        pthread_mutex_unlock(&g_live_mutex);
+    }
+
+    /* a free slot, else the least recently used one */
+    m = &t_magazines->slots[0];
+    for (int i = 0; i < MAGAZINE_SLOTS && m->depot; i++) 
+    {
+        if (!t_magazines->slots[i].depot 
+            || t_magazines->slots[i].used < m->used) 
+        {
+            m = &t_magazines->slots[i];
+        }
+    }
+
+    magazine_lock(m);
+    magazine_release(m);
+    m->depot = depot;
+    m->serial = depot->serial;
+    m->used = ++t_magazines->tick;
+    magazine_unlock(m);
+
+    return m;
+}
+
+static void magazine_steal(magazine_depot_t *depot, magazine_t *m);
+
+/* the rounds are empty: the spare, else the remote list, the pool, thieving */
+static void magazine_refill(magazine_depot_t *depot, magazine_t *m)
+{
+    void *list = NULL;
+    void *rest[MAGAZINE_ROUNDS];
+    int   n = 0;
+
+    int   taken = 0;
+
+    magazine_lock(m);
+    if (m->spare_n > 0) 
+    {
+        memcpy(m->rounds, m->spare, m->spare_n * sizeof(void *));
+        m->n = m->spare_n;
+        m->spare_n = 0;
+    }
+    magazine_unlock(m);
+
+    if (m->n > 0) 
+    {
+        return;
+    }
+
+    list = __sync_lock_test_and_set(&depot->remote, NULL);
+
+    while (list && m->n < MAGAZINE_ROUNDS) 
+    {
+        m->rounds[m->n++] = list;
+        list = *(void **)list;
+        taken++;
+    }
+
+    while (list) 
+    {
+        rest[n++] = list;
+        list = *(void **)list;
+        taken++;
+
+        if (MAGAZINE_ROUNDS == n || !list) 
+        {
+            depot->drain(depot->pool, rest, n);
+            n = 0;
+        }
+    }
+
+    if (taken) 
+    {
+        __sync_fetch_and_sub(&depot->remote_n, taken);
+    }
+
+    if (0 == m->n) 
+    {
+        m->n = depot->fill(depot->pool, m->rounds, MAGAZINE_ROUNDS / 2);
+    }
+
+    if (0 == m->n) 
+    {
+        magazine_steal(depot, m);
+    }
+}
+
+/* the rounds are full: they become the spare, the old spare goes back */
+static void magazine_swap(magazine_depot_t *depot, magazine_t *m)
+{
+    void *old[MAGAZINE_ROUNDS];
+    int   old_n = 0;
+
+    magazine_lock(m);
+    old_n = m->spare_n;
+    memcpy(old, m->spare, old_n * sizeof(void *));
+    memcpy(m->spare, m->rounds, m->n * sizeof(void *));
+    m->spare_n = m->n;
+    m->n = 0;
+    magazine_unlock(m);
+
+    if (old_n > 0) 
+    {
+        depot->drain(depot->pool, old, old_n);
+    }
+}
+
+/*
+ * The pool is out of blocks: take half of the spares the other threads
+ * of the process hold of the depot. Spares being swapped by their owner
+ * are skipped, and the rounds an owner is working from are never taken.
+ */
+static void magazine_steal(magazine_depot_t *depot, magazine_t *m)
+{
+    magazine_cache_t *cache = NULL;
+    magazine_t       *victim = NULL;
+    int               take = 0;
+
+    pthread_mutex_lock(&g_live_mutex);
+
+    for (cache = g_caches; cache && 0 == m->n; cache = cache->next) 
+    {
+        for (int i = 0; i < MAGAZINE_SLOTS && 0 == m->n; i++) 
+        {
+            victim = &cache->slots[i];
+            if (victim == m || victim->depot != depot 
+                || 0 == victim->spare_n
+                || __sync_lock_test_and_set(&victim->lock, 1)) 
+            {
+                continue;
+            }
+
+            if (victim->depot == depot && victim->serial == depot->serial) 
+            {
+                take = (victim->spare_n + 1) / 2;
+                victim->spare_n -= take;
+                memcpy(m->rounds, victim->spare + victim->spare_n, 
+                    take * sizeof(void *));
+                m->n = take;
+            }
+
+            magazine_unlock(victim);
+        }
+    }
+
+    pthread_mutex_unlock(&g_live_mutex);
+}
+
+void *magazine_get(magazine_depot_t *depot)
+{
+    magazine_t *m = NULL;
+    void       *block = NULL;
+
+    m = magazine_find(depot);
+    if (!m && !(m = magazine_adopt(depot))) 
+    {
+        return depot->fill(depot->pool, &block, 1) ? block : NULL;
+    }
+
+    if (0 == m->n) 
+    {
+        magazine_refill(depot, m);
+    }
+
+    return m->n > 0 ? m->rounds[--m->n] : NULL;
+}
+
+void magazine_put(magazine_depot_t *depot, void *block)
+{
+    magazine_t *m = NULL;
+    void       *head = NULL;
+
+    m = magazine_find(depot);
+    if (!m) 
+    {
+        do 
+        {
+            head = depot->remote;
+            *(void **)block = head;
+        } 
+        while (!CAS(&depot->remote, head, block));
+
+        __sync_fetch_and_add(&depot->remote_n, 1);
+
+        return;
+    }
+
+    if (MAGAZINE_ROUNDS == m->n) 
+    {
+        magazine_swap(depot, m);
+    }
+
+    m->rounds[m->n++] = block;
+}
+
+void magazine_flush(magazine_depot_t *depot)
+{
+    magazine_t *m = magazine_find(depot);
+
+    if (m) 
+    {
+        magazine_lock(m);
+        magazine_release(m);
+        magazine_unlock(m);
+    }
+}
+
+/* a snapshot: owners move their rounds without telling anyone */
+int magazine_cached(magazine_depot_t *depot)
+{
+    magazine_cache_t *cache = NULL;
+    magazine_t       *m = NULL;
+    int               n = depot->remote_n;
+
+    pthread_mutex_lock(&g_live_mutex);
+
+    for (cache = g_caches; cache; cache = cache->next) 
+    {
+        for (int i = 0; i < MAGAZINE_SLOTS; i++) 
+        {
+            m = &cache->slots[i];
+            if (m->depot == depot && m->serial == depot->serial) 
+            {
+                n += m->n + m->spare_n;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&g_live_mutex);
+
+    return n;
+}
+
+void magazine_depot_destroy(magazine_depot_t *depot)
+{
+    int i = 0;
+
+    magazine_flush(depot);
+
+    pthread_mutex_lock(&g_live_mutex);
+    i = magazine_live_find(depot, depot->serial);
+    if (i >= 0) 
+    {
+        g_live[i] = g_live[--g_live_cnt];
+    }
+    pthread_mutex_unlock(&g_live_mutex);
+}
+
+static void magazine_thread_exit(void *data)
+{
+    magazine_cache_t *cache = (magazine_cache_t *)data;
+
+    pthread_mutex_lock(&g_live_mutex);
+    if (cache->prev) 
+    {
+        cache->prev->next = cache->next;
+    }
+    else 
+    {
+        g_caches = cache->next;
+    }
+    if (cache->next) 
+    {
+        cache->next->prev = cache->prev;
+    }
+    pthread_mutex_unlock(&g_live_mutex);
+
+    /* no thief can reach the cache any more */
+    for (int i = 0; i < MAGAZINE_SLOTS; i++) 
+    {
+        magazine_release(&cache->slots[i]);
+    }
+
+    free(cache);
+    t_magazines = NULL;
+}
+
+/*
+ * The other threads' caches are unreachable in the child and leak; the
+ * forking thread keeps its cache but not the blocks in it.
+ */
+static void magazine_atfork_child()
+{
+    pthread_mutex_init(&g_live_mutex, NULL);
+    g_caches = NULL;
+
+    if (t_magazines) 
+    {
+        memset(t_magazines, 0, sizeof(magazine_cache_t));
+        g_caches = t_magazines;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef SHS_MAGAZINE_H
+#define SHS_MAGAZINE_H
+
+#include "shs_types.h"
+
+/*
+ * Per-thread magazines of free blocks in front of a fixed-size pool.
+ *
+ * A thread that gets from a depot caches up to MAGAZINE_ROUNDS of its
+ * blocks, which it gets and puts without a lock or an atomic, and a
+ * spare of as many more. Only swapping the rounds with the spare takes
+ * the magazine's lock, and the pool's own lock is only taken by fill()
+ * and drain(), which move blocks in batches. Blocks put by a thread
+ * that doesn't cache the depot go onto the depot's lock-free remote
+ * list, which the next refill takes whole.
+ *
+ * When the spare, the remote list and fill() come up empty, a get
+ * steals half of another thread's spare before it gives up, so a
+ * fixed-size pool only runs dry once the blocks are in use, on their
+ * way back, in the rounds other threads are working from, or in the
+ * magazines of other processes sharing the pool.
+ *
+ * Blocks are linked through their first word while on the remote list.
+ * A thread caches up to MAGAZINE_SLOTS depots at a time, evicting the
+ * least recently used one, and gives its blocks back when it exits. The
+ * forked child drops the magazines of the forking thread, since the
+ * parent still owns them when the pool is in shared memory.
+ */
+#define MAGAZINE_ROUNDS 32
+#define MAGAZINE_SLOTS  8
+
+typedef int  (*magazine_fill_pt)(void *pool, void **blocks, int n);
+typedef void (*magazine_drain_pt)(void *pool, void **blocks, int n);
+
+typedef struct magazine_depot_s magazine_depot_t;
+
+struct magazine_depot_s
+{
+    void              *pool;
+    magazine_fill_pt   fill;    // up to n blocks, returns how many
+    magazine_drain_pt  drain;
+    uint64_t           serial;
+    void * volatile    remote;
+    volatile int       remote_n;
+};
+
+void  magazine_depot_init(magazine_depot_t *depot, void *pool,
+    magazine_fill_pt fill, magazine_drain_pt drain);
+void  magazine_depot_destroy(magazine_depot_t *depot);
+void *magazine_get(magazine_depot_t *depot);
+void  magazine_put(magazine_depot_t *depot, void *block);
+
+/* gives the calling thread's blocks of the depot back to the pool */
+void  magazine_flush(magazine_depot_t *depot);
+
+/* blocks in this process's magazines of the depot and on its remote list */
+int   magazine_cached(magazine_depot_t *depot);
+
+#endif
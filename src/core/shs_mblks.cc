@@ -2,6 +2,9 @@
 
 #include "shs_mblks.h"
 
+static int mem_mblks_fill(void *pool, void **blocks, int n);
+static void mem_mblks_drain(void *pool, void **blocks, int n);
+
 struct mem_mblks * mem_mblks_new_fn(size_t sizeof_type, int64_t count, 
     mem_mblks_param_t *param)
 {
@@ -41,6 +44,9 @@ struct mem_mblks * mem_mblks_new_fn(size_t sizeof_type, int64_t count,
         ptr = (struct mem_data *)ptr->next;
     }
 
+    magazine_depot_init(&mblks->depot, mblks, mem_mblks_fill, 
+        mem_mblks_drain);
+
     return mblks;
 }
 
@@ -53,27 +59,13 @@ void * mem_get(struct mem_mblks *mblks)
         return NULL;
     }
 
-    LOCK(&mblks->lock);
+    pdata = (struct mem_data *)magazine_get(&mblks->depot);
+    if (!pdata) 
     {
-        if (mblks->cold_count) 
-        {
-            pdata = mblks->free_blks;
-            mblks->free_blks = (struct mem_data *)pdata->next;
-
-            pdata->next = (void *)mblks;
-
-            mblks->hot_count++;
-            mblks->cold_count--;
-            
-        } 
-        else 
-        {
-            UNLOCK(&mblks->lock);
-			
-            return NULL;
-        }
+        return NULL;
     }
-    UNLOCK(&mblks->lock);
+
+    pdata->next = (void *)mblks;
 
     return (void *)pdata->data;
 }
@@ -120,15 +112,7 @@ void mem_put(void *ptr)
         return;
     }
 
-    LOCK(&mblks->lock);
-    {
-        mblks->hot_count--;
-        mblks->cold_count++;
-
-        pdata->next = mblks->free_blks;
-        mblks->free_blks = pdata;
-    }
-    UNLOCK(&mblks->lock);
+    magazine_put(&mblks->depot, pdata);
 
     return;
 }
@@ -143,6 +127,7 @@ void mem_mblks_destroy(struct mem_mblks *mblks)
         return;
     }
 
+    magazine_depot_destroy(&mblks->depot);
     LOCK_DESTROY(&mblks->lock);
 
     param->mem_free(param->priv, mblks);
@@ -150,3 +135,56 @@ void mem_mblks_destroy(struct mem_mblks *mblks)
     return;
 }
 
+int mem_mblks_free_count(struct mem_mblks *mblks)
+{
+    int cold = 0;
+
+    LOCK(&mblks->lock);
+    cold = mblks->cold_count;
+    UNLOCK(&mblks->lock);
+
+    return cold + magazine_cached(&mblks->depot);
+}
+
+static int mem_mblks_fill(void *pool, void **blocks, int n)
+{
+    struct mem_mblks *mblks = (struct mem_mblks *)pool;
+    struct mem_data  *pdata = NULL;
+    int               got = 0;
+
+    LOCK(&mblks->lock);
+    {
+        for (; got < n && mblks->cold_count; got++) 
+        {
+            pdata = mblks->free_blks;
+            mblks->free_blks = (struct mem_data *)pdata->next;
+            blocks[got] = pdata;
+
+            mblks->hot_count++;
+            mblks->cold_count--;
+        }
+    }
+    UNLOCK(&mblks->lock);
+
+    return got;
+}
+
+static void mem_mblks_drain(void *pool, void **blocks, int n)
+{
+    struct mem_mblks *mblks = (struct mem_mblks *)pool;
+    struct mem_data  *pdata = NULL;
+
+    LOCK(&mblks->lock);
+    {
+        for (int i = 0; i < n; i++) 
+        {
+            pdata = (struct mem_data *)blocks[i];
+            pdata->next = mblks->free_blks;
+            mblks->free_blks = pdata;
+        }
+
+        mblks->hot_count -= n;
+        mblks->cold_count += n;
+    }
+    UNLOCK(&mblks->lock);
+}
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 
 #include "shs_lock.h"
+#include "shs_magazine.h"
 
 #define MEM_BLOCK_HEAD          sizeof(struct mem_data)
 #define SIZEOF_PER_MEM_BLOCK(X) ((X) + MEM_BLOCK_HEAD)
@@ -43,6 +44,11 @@ typedef struct mem_mblks_param_s
     void *priv;
 } mem_mblks_param_t;
 
+/*
+ * Blocks are handed out through per-thread magazines, see shs_magazine.h.
+ * hot_count and cold_count are the pool's side only: blocks sitting in a
+ * magazine count as hot. mem_mblks_free_count() adds them back.
+ */
 struct mem_mblks 
 {
     int                hot_count;
@@ -54,6 +60,7 @@ struct mem_mblks
     mem_mblks_param_t  param;
     shs_atomic_lock_t  lock;
     struct mem_data   *free_blks;
+    magazine_depot_t   depot;
 };
 
 struct mem_mblks *mem_mblks_new_fn(size_t, int64_t, mem_mblks_param_t *);
@@ -65,5 +72,8 @@ void *mem_get0(struct mem_mblks*);
 void mem_put(void *);
 void mem_mblks_destroy(struct mem_mblks *);
 
+/* free blocks, counting those cached by the threads of this process */
+int  mem_mblks_free_count(struct mem_mblks *);
+
 #endif
 
@@ -1,4 +1,19 @@
 #include "shs_memory.h"
+#include "shs_tcache.h"
+
+static int g_memory_tcache = SHS_FALSE;
+
+int memory_use_tcache(int on, size_t reserve)
+{
+    if (on && tcache_init(reserve) != SHS_OK) 
+    {
+        return SHS_ERROR;
+    }
+
+    g_memory_tcache = on;
+
+    return SHS_OK;
+}
 
 void * memory_alloc(size_t size)
 {
@@ -9,7 +24,7 @@ void * memory_alloc(size_t size)
         return NULL;
     }
 	
-    p = malloc(size);   
+    p = g_memory_tcache ? tcache_alloc(size) : malloc(size);   
 	
     return p;
 }
@@ -26,11 +41,37 @@ void * memory_calloc(size_t size)
     return p;
 }
 
+void * memory_realloc(void *p, size_t size)
+{
+    void   *np = NULL;
+    size_t  old = 0;
+
+    if (!tcache_owns(p)) 
+    {
+        return realloc(p, size);
+    }
+
+    old = tcache_usable_size(p);
+    if (size <= old) 
+    {
+        return p;
+    }
+
+    np = memory_alloc(size);
+    if (np) 
+    {
+        memory_memcpy(np, p, old);
+        tcache_free(p);
+    }
+
+    return np;
+}
+
 void memory_free(void *p, size_t size)
 {
     if (p) 
     {
-        free(p);
+        tcache_free(p);
     }
 }
 
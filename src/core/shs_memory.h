@@ -9,7 +9,6 @@
  * icc7 may also inline several mov's of a zeroed register for small blocks.
  */
 #define memory_zero(buf, n)        (void) memset(buf, 0, n)
-#define memory_realloc(ptr, size)  realloc(ptr, size)
 
 /*
  * gcc3, msvc, and icc7 compile memcpy() to the inline "rep movs".
@@ -23,9 +22,19 @@
 
 void *memory_alloc(size_t size);
 void *memory_calloc(size_t size);
+void *memory_realloc(void *p, size_t size);
 void  memory_free(void *p, size_t size);
 void *memory_memalign(size_t alignment, size_t size);
 int   memory_n2cmp(uchar_t *s1, uchar_t *s2, size_t n1, size_t n2);
 
+/*
+ * Serve memory_alloc(), and with it pool blocks, pool large allocations
+ * and cached buffers, from the thread-caching allocator in shs_tcache.h
+ * instead of malloc(). Memory allocated before the switch is still
+ * freed correctly. reserve is the address range the allocator may use,
+ * 0 for TCACHE_RESERVE_DEFAULT.
+ */
+int   memory_use_tcache(int on, size_t reserve);
+
 #endif
 
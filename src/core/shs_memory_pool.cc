@@ -4,6 +4,12 @@
 static void *pool_alloc_block(pool_t *pool, size_t size);
 static void *pool_alloc_large(pool_t *pool, size_t size);
 
+static __thread pool_t *t_pool_cache[POOL_CACHE_DEPTH];
+static __thread int     t_pool_cache_cnt = 0;
+
+static pool_cache_stats_t  g_pool_cache_local;
+static pool_cache_stats_t *g_pool_cache_stats = &g_pool_cache_local;
+
 pool_t * pool_create(size_t size, size_t max_size)
 {
     pool_t *p = NULL;
@@ -54,6 +60,9 @@ void pool_reset(pool_t *pool)
             l->alloc = NULL;
         }
     }
+
+    /* the list nodes live in the blocks being reset below */
+    pool->large = NULL;
 	
     p = pool;
     p->current = p;
@@ -65,6 +74,38 @@ void pool_reset(pool_t *pool)
     }
 }
 
+/* frees the blocks past the first keep_blocks extra ones of a reset pool */
+size_t pool_trim(pool_t *pool, int keep_blocks)
+{
+    pool_t *p = NULL;
+    pool_t *n = NULL;
+    size_t  freed = 0;
+
+    if (!pool) 
+    {
+        return 0;
+    }
+
+    for (p = pool; p->data.next && keep_blocks > 0; keep_blocks--) 
+    {
+        p = p->data.next;
+    }
+
+    n = p->data.next;
+    p->data.next = NULL;
+    pool->current = pool;
+
+    while (n) 
+    {
+        p = n;
+        n = n->data.next;
+        freed += ((char *)p->data.end) - ((char *)p);
+        memory_free(p, ((char *)p->data.end) - ((char *)p));
+    }
+
+    return freed;
+}
+
 void pool_destroy(pool_t *pool)
 {
     pool_t       *p = NULL;
@@ -239,6 +280,53 @@ void * pool_memalign(pool_t *pool, size_t size, size_t alignment)
     return p;
 }
 
+pool_t * pool_cache_get()
+{
+    if (t_pool_cache_cnt > 0) 
+    {
+        __sync_fetch_and_add(&g_pool_cache_stats->hits, 1);
+
+        return t_pool_cache[--t_pool_cache_cnt];
+    }
+
+    __sync_fetch_and_add(&g_pool_cache_stats->misses, 1);
+
+    return pool_create(POOL_CACHE_POOL_SIZE, POOL_CACHE_POOL_SIZE);
+}
+
+void pool_cache_put(pool_t *pool)
+{
+    int grew = SHS_FALSE;
+
+    if (!pool) 
+    {
+        return;
+    }
+
+    if (t_pool_cache_cnt >= POOL_CACHE_DEPTH 
+        || (size_t)(pool->data.end - (uchar_t *)pool) != POOL_CACHE_POOL_SIZE) 
+    {
+        pool_destroy(pool);
+
+        return;
+    }
+
+    grew = (NULL != pool->large) ? SHS_TRUE : SHS_FALSE;
+    pool_reset(pool);
+
+    if (pool_trim(pool, POOL_CACHE_KEEP_BLOCKS) > 0 || grew) 
+    {
+        __sync_fetch_and_add(&g_pool_cache_stats->trims, 1);
+    }
+
+    t_pool_cache[t_pool_cache_cnt++] = pool;
+}
+
+void pool_cache_bind_stats(pool_cache_stats_t *stats)
+{
+    g_pool_cache_stats = stats ? stats : &g_pool_cache_local;
+}
+
 size_t shs_align(size_t d, uint32_t a)
 {
     if (d % a) 
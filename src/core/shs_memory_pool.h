@@ -33,7 +33,34 @@ void   *pool_alloc(pool_t *pool, size_t size);
 void   *pool_calloc(pool_t *pool, size_t size);
 void   *pool_memalign(pool_t *pool, size_t size, size_t alignment);
 void    pool_reset(pool_t *pool);
+size_t  pool_trim(pool_t *pool, int keep_blocks);
 size_t  shs_align(size_t d, uint32_t a);
 
+/*
+ * Per-thread cache of reset pools of POOL_CACHE_POOL_SIZE, so that pools
+ * living for one request are recycled rather than malloc'ed and freed.
+ * At most POOL_CACHE_DEPTH pools are kept per thread; a returned pool
+ * that needed large allocations or more than POOL_CACHE_KEEP_BLOCKS
+ * extra blocks is trimmed back first. Pools of another size are
+ * destroyed.
+ *
+ * The counters are process wide and may be pointed at shared memory
+ * with pool_cache_bind_stats().
+ */
+#define POOL_CACHE_POOL_SIZE   4096
+#define POOL_CACHE_DEPTH       64
+#define POOL_CACHE_KEEP_BLOCKS 2
+
+typedef struct pool_cache_stats_s
+{
+    volatile uint64_t hits;
+    volatile uint64_t misses;
+    volatile uint64_t trims;
+} pool_cache_stats_t;
+
+pool_t *pool_cache_get();
+void    pool_cache_put(pool_t *pool);
+void    pool_cache_bind_stats(pool_cache_stats_t *stats);
+
 #endif
 
@@ -0,0 +1,584 @@
+#include "shs_shm_slabs.h"
+#include "shs_math.h"
+#include "shs_lock.h"
+
+#define SHS_SHM_SLABS_SHIFT     4
+#define SHS_SHM_SLABS_MAX_AREA  ((size_t)UINT32_MAX << SHS_SHM_SLABS_SHIFT)
+
+#define SHS_SLAB_ERRNO_CLEAN(err)    \
+    (err)->slab_errno = SHS_SLAB_ERR_NONE;   \
+    (err)->allocator_errno = SHS_SLAB_ERR_NONE
+
+typedef struct shs_shm_chunk_s
+{
+    uint32_t next;      // index of the next free chunk, 0 ends the list
+    int32_t  id;
+    uint64_t req_size;
+} shs_shm_chunk_t;
+
+/* a chunk index is its offset from the start of the mapping in 16 bytes */
+#define SHM_CHUNK(slabs, idx)                                   \
+    ((shs_shm_chunk_t *)((uchar_t *)(slabs)                      \
+        + ((size_t)(idx) << SHS_SHM_SLABS_SHIFT)))
+#define SHM_INDEX(slabs, chunk)                                 \
+    ((uint32_t)(((uchar_t *)(chunk) - (uchar_t *)(slabs))       \
+        >> SHS_SHM_SLABS_SHIFT))
+
+typedef struct shm_slabs_cache_s
+{
+    shs_shm_slabs_t *owner;
+    uint64_t         serial;
+    int              n[SHS_SHM_SLABS_MAX_CLASSES];
+    uint32_t         chunks[SHS_SHM_SLABS_MAX_CLASSES][SHS_SHM_SLABS_CACHE];
+} shm_slabs_cache_t;
+
+typedef struct shm_slabs_live_s
+{
+    shs_shm_slabs_t *slabs;
+    uint64_t         serial;
+} shm_slabs_live_t;
+
+/* the instances in use by this process's thread caches */
+static pthread_mutex_t   g_live_mutex = PTHREAD_MUTEX_INITIALIZER;
+static shm_slabs_live_t  g_live[SHS_SHM_SLABS_LIVE];
+static uint32_t          g_serial = 0;
+static pthread_once_t    g_once = PTHREAD_ONCE_INIT;
+static pthread_key_t     g_cache_key;
+
+static __thread shm_slabs_cache_t *t_slabs_cache = NULL;
+
+static void shm_slabs_thread_exit(void *data);
+static void shm_slabs_atfork_child();
+
+static void shm_slabs_once()
+{
+    pthread_key_create(&g_cache_key, shm_slabs_thread_exit);
+    pthread_atfork(NULL, NULL, shm_slabs_atfork_child);
+}
+
+static uint32_t shm_slabs_pop(shs_shm_slabs_t *slabs, ssize_t id)
+{
+    shs_shm_slabclass_t *cls = &slabs->slabclass[id];
+    uint64_t             old = 0;
+    uint64_t             set = 0;
+    uint32_t             idx = 0;
+
+    do 
+    {
+        old = cls->head;
+        idx = (uint32_t)old;
+        if (!idx) 
+        {
+            return 0;
+        }
+
+        /* may read a chunk that was taken meanwhile, the tag catches it */
+        set = (((old >> 32) + 1) << 32) | SHM_CHUNK(slabs, idx)->next;
+    } 
+    while (!CAS(&cls->head, old, set));
+
+    return idx;
+}
+
+/* pushes the chunks first .. last, already linked */
+static void shm_slabs_push(shs_shm_slabs_t *slabs, ssize_t id,
+    uint32_t first, uint32_t last)
+{
+    shs_shm_slabclass_t *cls = &slabs->slabclass[id];
+    uint64_t             old = 0;
+
+    do 
+    {
+        old = cls->head;
+        SHM_CHUNK(slabs, last)->next = (uint32_t)old;
+    } 
+    while (!CAS(&cls->head, old, (((old >> 32) + 1) << 32) | first));
+}
+
+static void shm_slabs_push_cached(shs_shm_slabs_t *slabs, ssize_t id,
+    uint32_t *chunks, int n)
+{
+    for (int i = 0; i + 1 < n; i++) 
+    {
+        SHM_CHUNK(slabs, chunks[i])->next = chunks[i + 1];
+    }
+
+    shm_slabs_push(slabs, id, chunks[0], chunks[n - 1]);
+}
+
+/* takes up to n fresh chunks of class id from the arena */
+static int shm_slabs_carve(shs_shm_slabs_t *slabs, ssize_t id,
+    uint32_t *chunks, int n)
+{
+    size_t size = slabs->slabclass[id].size;
+    size_t off = 0;
+    int    got = 0;
+
+    if (slabs->arena_next + size > slabs->arena_end) 
+    {
+        return 0;
+    }
+
+    off = __sync_fetch_and_add(&slabs->arena_next, size * n);
+
+    for (; got < n && off + size <= slabs->arena_end; got++, off += size) 
+    {
+        chunks[got] = (uint32_t)(off >> SHS_SHM_SLABS_SHIFT);
+    }
+
+    if (got) 
+    {
+        __sync_fetch_and_add(&slabs->slab_stat.chunk_count, got);
+        __sync_fetch_and_add(&slabs->slab_stat.free_size,
+            got * (size - sizeof(shs_shm_chunk_t)));
+    }
+
+    return got;
+}
+
+static int shm_slabs_live_find(shs_shm_slabs_t *slabs, uint64_t serial)
+{
+    for (int i = 0; i < SHS_SHM_SLABS_LIVE; i++) 
+    {
+        if (g_live[i].slabs == slabs && g_live[i].serial == serial) 
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void shm_slabs_cache_release(shm_slabs_cache_t *cache)
+{
+    if (cache->owner) 
+    {
+        pthread_mutex_lock(&g_live_mutex);
+        if (shm_slabs_live_find(cache->owner, cache->serial) >= 0) 
+        {
+            for (ssize_t id = 0; id < cache->owner->free_len; id++) 
+            {
+                if (cache->n[id] > 0) 
+                {
+                    shm_slabs_push_cached(cache->owner, id, cache->chunks[id],
+                        cache->n[id]);
+                }
+            }
+        }
+        pthread_mutex_unlock(&g_live_mutex);
+    }
+
+    memset(cache, 0, sizeof(shm_slabs_cache_t));
+}
+
+static shm_slabs_cache_t *shm_slabs_cache(shs_shm_slabs_t *slabs)
+{
+    int i = 0;
+
+    pthread_once(&g_once, shm_slabs_once);
+
+    if (!t_slabs_cache) 
+    {
+        t_slabs_cache = (shm_slabs_cache_t *)calloc(1, 
+            sizeof(shm_slabs_cache_t));
+        if (!t_slabs_cache) 
+        {
+            return NULL;
+        }
+
+        pthread_setspecific(g_cache_key, t_slabs_cache);
+    }
+
+    if (t_slabs_cache->owner == slabs 
+        && t_slabs_cache->serial == slabs->serial) 
+    {
+        return t_slabs_cache;
+    }
+
+    shm_slabs_cache_release(t_slabs_cache);
+
+    /* chunks may only be cached from an instance that can take them back */
+    pthread_mutex_lock(&g_live_mutex);
+    i = shm_slabs_live_find(slabs, slabs->serial);
+    if (i < 0 && (i = shm_slabs_live_find(NULL, 0)) >= 0) 
+    {
+        g_live[i].slabs = slabs;
+        g_live[i].serial = slabs->serial;
+    }
+    pthread_mutex_unlock(&g_live_mutex);
+
+    if (i < 0) 
+    {
+        return NULL;
+    }
+
+    t_slabs_cache->owner = slabs;
+    t_slabs_cache->serial = slabs->serial;
+
+    return t_slabs_cache;
+}
+
+static ssize_t shm_slabs_clsid(shs_shm_slabs_t *slabs, size_t size)
+{
+    size_t  all_size = 0;
+    ssize_t low = 0;
+    ssize_t high = slabs->free_len - 1;
+    ssize_t mid = 0;
+
+    all_size = SHS_MATH_ALIGNMENT(size + sizeof(shs_shm_chunk_t), 
+        1 << SHS_SHM_SLABS_SHIFT);
+    if (all_size > slabs->slabclass[high].size) 
+    {
+        return SHS_SLAB_ERROR_INVALID_ID;
+    }
+
+    while (low < high) 
+    {
+        mid = (low + high) >> 1;
+        if (slabs->slabclass[mid].size < all_size) 
+        {
+            low = mid + 1;
+        } 
+        else 
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+shs_shm_slabs_t * shs_shm_slabs_create(void *addr, size_t size, int uptype,
+    size_t factor, const size_t item_size_min, const size_t item_size_max,
+    shs_slab_errno_t *err_no)
+{
+    shs_shm_slabs_t *slabs = (shs_shm_slabs_t *)addr;
+    ssize_t          free_len = 0;
+    size_t           item_size = item_size_min;
+    int              i = 0;
+
+    if (!err_no) 
+    {
+        return NULL;
+    }
+
+    SHS_SLAB_ERRNO_CLEAN(err_no);
+
+    if (!addr || (uintptr_t)addr % DEFAULT_CACHELINE_SIZE
+        || size > SHS_SHM_SLABS_MAX_AREA || !item_size_min 
+        || item_size_max / item_size_min < 2) 
+    {
+        err_no->slab_errno = SHS_SLAB_ERR_CREATE_PARAM;
+
+        return NULL;
+    }
+
+    if (uptype == SHS_SLAB_UPTYPE_POWER) 
+    {
+        if (factor != SHS_SLAB_POWER_FACTOR) 
+        {
+            err_no->slab_errno = SHS_SLAB_ERR_CREATE_POWER_FACTOR;
+
+            return NULL;
+        }
+
+        free_len = shs_math_dfslog2(item_size_max / item_size_min 
+            + (item_size_max % item_size_min ? 1 : 0), SHS_MATH_DFSLOG2_UP);
+    } 
+    else if (uptype == SHS_SLAB_UPTYPE_LINEAR) 
+    {
+        if (factor != SHS_SLAB_LINEAR_FACTOR) 
+        {
+            err_no->slab_errno = SHS_SLAB_ERR_CREATE_LINER_FACTOR;
+
+            return NULL;
+        }
+
+        free_len = (item_size_max - item_size_min) / factor
+            + ((item_size_max - item_size_min) % factor ? 1 : 0);
+    } 
+    else 
+    {
+        err_no->slab_errno = SHS_SLAB_ERR_CREATE_UPTYPE;
+
+        return NULL;
+    }
+
+    free_len++;
+
+    if (free_len > SHS_SHM_SLABS_MAX_CLASSES || size < sizeof(shs_shm_slabs_t)) 
+    {
+        err_no->slab_errno = SHS_SLAB_ERR_CREATE_PARAM;
+
+        return NULL;
+    }
+
+    memset(slabs, 0, sizeof(shs_shm_slabs_t));
+
+    for (i = 0; i < free_len; i++) 
+    {
+        slabs->slabclass[i].size = SHS_MATH_ALIGNMENT(
+            item_size + sizeof(shs_shm_chunk_t), 1 << SHS_SHM_SLABS_SHIFT);
+        item_size = uptype == SHS_SLAB_UPTYPE_POWER 
+            ? item_size * factor : item_size + factor;
+    }
+
+    slabs->serial = ((uint64_t)getpid() << 32) 
+        | __sync_add_and_fetch(&g_serial, 1);
+    slabs->uptype = uptype;
+    slabs->factor = factor;
+    slabs->min_size = item_size_min;
+    slabs->free_len = free_len;
+    slabs->arena_start = sizeof(shs_shm_slabs_t);
+    slabs->arena_next = slabs->arena_start;
+    slabs->arena_end = size;
+    slabs->slab_stat.system_size = sizeof(shs_shm_slabs_t);
+
+    return slabs;
+}
+
+void shs_shm_slabs_destroy(shs_shm_slabs_t *slabs)
+{
+    int i = 0;
+
+    if (!slabs) 
+    {
+        return;
+    }
+
+    shs_shm_slabs_flush(slabs);
+
+    pthread_mutex_lock(&g_live_mutex);
+    i = shm_slabs_live_find(slabs, slabs->serial);
+    if (i >= 0) 
+    {
+        g_live[i].slabs = NULL;
+        g_live[i].serial = 0;
+    }
+    pthread_mutex_unlock(&g_live_mutex);
+}
+
+void shs_shm_slabs_flush(shs_shm_slabs_t *slabs)
+{
+    if (t_slabs_cache && t_slabs_cache->owner == slabs
+        && t_slabs_cache->serial == slabs->serial) 
+    {
+        shm_slabs_cache_release(t_slabs_cache);
+    }
+}
+
+/* a free chunk of class id, or of a larger one once the arena is used up */
+static uint32_t shm_slabs_take(shs_shm_slabs_t *slabs, 
+    shm_slabs_cache_t *cache, ssize_t *id)
+{
+    uint32_t idx = 0;
+    int     *n = NULL;
+
+    if (cache) 
+    {
+        n = &cache->n[*id];
+
+        while (*n < SHS_SHM_SLABS_CACHE / 2 
+            && (idx = shm_slabs_pop(slabs, *id))) 
+        {
+            cache->chunks[*id][(*n)++] = idx;
+        }
+
+        if (0 == *n) 
+        {
+            *n = shm_slabs_carve(slabs, *id, cache->chunks[*id],
+                SHS_SHM_SLABS_CACHE / 2);
+        }
+
+        if (*n > 0) 
+        {
+            return cache->chunks[*id][--(*n)];
+        }
+    } 
+    else if ((idx = shm_slabs_pop(slabs, *id)) 
+        || shm_slabs_carve(slabs, *id, &idx, 1)) 
+    {
+        return idx;
+    }
+
+    __sync_fetch_and_add(&slabs->slab_stat.recover, 1);
+
+    for (ssize_t i = *id + 1; i < slabs->free_len; i++) 
+    {
+        if (cache && cache->n[i] > 0) 
+        {
+            idx = cache->chunks[i][--cache->n[i]];
+        } 
+        else 
+        {
+            idx = shm_slabs_pop(slabs, i);
+        }
+
+        if (idx) 
+        {
+            *id = i;
+
+            return idx;
+        }
+    }
+
+    __sync_fetch_and_add(&slabs->slab_stat.recover_failed, 1);
+
+    return 0;
+}
+
+void * shs_shm_slabs_alloc(shs_shm_slabs_t *slabs, int alloc_type,
+    size_t req_size, size_t *slab_size, shs_slab_errno_t *err_no)
+{
+    shm_slabs_cache_t *cache = NULL;
+    shs_shm_chunk_t   *chunk = NULL;
+    ssize_t            id = 0;
+    uint32_t           idx = 0;
+    size_t             size = 0;
+
+    if (!err_no) 
+    {
+        return NULL;
+    }
+
+    SHS_SLAB_ERRNO_CLEAN(err_no);
+
+    if (!slabs || !req_size || !slab_size) 
+    {
+        err_no->slab_errno = SHS_SLAB_ERR_ALLOC_PARAM;
+
+        return NULL;
+    }
+
+    if ((id = shm_slabs_clsid(slabs, req_size)) == SHS_SLAB_ERROR_INVALID_ID) 
+    {
+        err_no->slab_errno = SHS_SLAB_ERR_ALLOC_INVALID_ID;
+
+        return NULL;
+    }
+
+    cache = shm_slabs_cache(slabs);
+
+    if (cache && cache->n[id] > 0) 
+    {
+        idx = cache->chunks[id][--cache->n[id]];
+    } 
+    else 
+    {
+        idx = shm_slabs_take(slabs, cache, &id);
+    }
+
+    if (!idx) 
+    {
+        *slab_size = 0;
+        __sync_fetch_and_add(&slabs->slab_stat.failed, 1);
+        err_no->slab_errno = SHS_SLAB_ERR_ALLOC_FAILED;
+
+        return NULL;
+    }
+
+    chunk = SHM_CHUNK(slabs, idx);
+    size = slabs->slabclass[id].size - sizeof(shs_shm_chunk_t);
+
+    *slab_size = alloc_type == SHS_SLAB_ALLOC_TYPE_ACT ? size : req_size;
+    chunk->id = id;
+    chunk->req_size = *slab_size;
+
+    __sync_fetch_and_add(&slabs->slab_stat.reqs_size, *slab_size);
+    __sync_fetch_and_add(&slabs->slab_stat.used_size, size);
+    __sync_fetch_and_sub(&slabs->slab_stat.free_size, size);
+
+    return (void *)(chunk + 1);
+}
+
+int shs_shm_slabs_free(shs_shm_slabs_t *slabs, void *ptr,
+    shs_slab_errno_t *err_no)
+{
+    shm_slabs_cache_t *cache = NULL;
+    shs_shm_chunk_t   *chunk = NULL;
+    uint32_t           idx = 0;
+    ssize_t            id = 0;
+    size_t             size = 0;
+
+    if (!err_no) 
+    {
+        return SHS_SLAB_ERROR;
+    }
+
+    SHS_SLAB_ERRNO_CLEAN(err_no);
+
+    if (!slabs || !ptr) 
+    {
+        err_no->slab_errno = SHS_SLAB_ERR_FREE_PARAM;
+
+        return SHS_SLAB_ERROR;
+    }
+
+    chunk = (shs_shm_chunk_t *)ptr - 1;
+    id = chunk->id;
+    if (id < 0 || id >= slabs->free_len) 
+    {
+        err_no->slab_errno = SHS_SLAB_ERR_FREE_CHUNK_ID;
+
+        return SHS_SLAB_ERROR;
+    }
+
+    size = slabs->slabclass[id].size - sizeof(shs_shm_chunk_t);
+
+    __sync_fetch_and_sub(&slabs->slab_stat.reqs_size, chunk->req_size);
+    __sync_fetch_and_sub(&slabs->slab_stat.used_size, size);
+    __sync_fetch_and_add(&slabs->slab_stat.free_size, size);
+
+    idx = SHM_INDEX(slabs, chunk);
+
+    cache = shm_slabs_cache(slabs);
+    if (!cache) 
+    {
+        shm_slabs_push(slabs, id, idx, idx);
+
+        return SHS_SLAB_OK;
+    }
+
+    if (SHS_SHM_SLABS_CACHE == cache->n[id]) 
+    {
+        shm_slabs_push_cached(slabs, id, 
+            cache->chunks[id] + SHS_SHM_SLABS_CACHE / 2,
+            SHS_SHM_SLABS_CACHE / 2);
+        cache->n[id] = SHS_SHM_SLABS_CACHE / 2;
+    }
+
+    cache->chunks[id][cache->n[id]++] = idx;
+
+    return SHS_SLAB_OK;
+}
+
+int shs_shm_slabs_get_stat(shs_shm_slabs_t *slabs, shs_slab_stat_t *stat)
+{
+    if (!slabs || !stat) 
+    {
+        return SHS_SLAB_ERROR;
+    }
+
+    *stat = slabs->slab_stat;
+    stat->chunk_size = stat->chunk_count * sizeof(shs_shm_chunk_t);
+
+    return SHS_SLAB_OK;
+}
+
+static void shm_slabs_thread_exit(void *data)
+{
+    shm_slabs_cache_release((shm_slabs_cache_t *)data);
+    free(data);
+    t_slabs_cache = NULL;
+}
+
+/* the parent still owns the chunks cached by the forking thread */
+static void shm_slabs_atfork_child()
+{
+    pthread_mutex_init(&g_live_mutex, NULL);
+
+    if (t_slabs_cache) 
+    {
+        memset(t_slabs_cache, 0, sizeof(shm_slabs_cache_t));
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef SHS_SHM_SLABS_H
+#define SHS_SHM_SLABS_H
+
+#include "shs_types.h"
+#include "shs_slabs.h"
+
+/*
+ * Slab allocator for memory shared between processes, safe without an
+ * outside lock.
+ *
+ * It is laid out in place at the start of a caller's mapping and carves
+ * chunks from the rest of it. Every size class has its own lock-free
+ * free list, whose head is a chunk offset tagged with a generation so a
+ * compare-and-swap can't be fooled by a chunk that was popped and pushed
+ * back meanwhile. All links are offsets from the start of the mapping,
+ * so processes may map it at different addresses.
+ *
+ * Each thread keeps up to SHS_SHM_SLABS_CACHE free chunks per class of
+ * the last instance it used in process-private memory, and only touches
+ * the shared lists to move them in batches. A process registers an
+ * instance the first time one of its threads caches from it, so it can
+ * tell at thread exit whether the cached chunks still have somewhere to
+ * go; threads of a process that has SHS_SHM_SLABS_LIVE instances in use
+ * go to the shared lists for every chunk instead.
+ *
+ * Chunks are never given back to the arena; once it is used up an
+ * allocation takes a free chunk of a larger class instead. The
+ * statistics are kept with atomic adds, chunks in thread caches count
+ * as free.
+ */
+#define SHS_SHM_SLABS_MAX_CLASSES  64
+#define SHS_SHM_SLABS_CACHE        16
+#define SHS_SHM_SLABS_LIVE         64
+
+typedef struct shs_shm_slabclass_s
+{
+    volatile uint64_t head;     // generation << 32 | chunk index
+    size_t            size;     // with the chunk header
+} __attribute__((aligned(DEFAULT_CACHELINE_SIZE))) shs_shm_slabclass_t;
+
+typedef struct shs_shm_slabs_s
+{
+    uint64_t             serial;
+    int                  uptype;
+    size_t               factor;
+    size_t               min_size;
+    ssize_t              free_len;
+    size_t               arena_start;   // offset of the first chunk
+    size_t               arena_end;
+    volatile size_t      arena_next;
+    shs_slab_stat_t      slab_stat
+        __attribute__((aligned(DEFAULT_CACHELINE_SIZE)));
+    shs_shm_slabclass_t  slabclass[SHS_SHM_SLABS_MAX_CLASSES];
+} shs_shm_slabs_t;
+
+/* addr must be aligned to DEFAULT_CACHELINE_SIZE, size at most 64G */
+shs_shm_slabs_t * shs_shm_slabs_create(void *addr, size_t size, int uptype,
+    size_t factor, const size_t item_size_min, const size_t item_size_max,
+    shs_slab_errno_t *err_no);
+
+/* before the mapping goes away, in every process that used it */
+void shs_shm_slabs_destroy(shs_shm_slabs_t *slabs);
+
+void * shs_shm_slabs_alloc(shs_shm_slabs_t *slabs, int alloc_type,
+    size_t req_size, size_t *slab_size, shs_slab_errno_t *err_no);
+int shs_shm_slabs_free(shs_shm_slabs_t *slabs, void *ptr,
+    shs_slab_errno_t *err_no);
+
+/* gives the calling thread's cached chunks back to the shared lists */
+void shs_shm_slabs_flush(shs_shm_slabs_t *slabs);
+
+int shs_shm_slabs_get_stat(shs_shm_slabs_t *slabs, shs_slab_stat_t *stat);
+
+#endif
@@ -1,3 +1,5 @@
+#include <pthread.h>
+
 #include "shs_shmem.h"
 #include "shs_math.h"
 #include "shs_memory.h"
@@ -123,6 +125,196 @@ static size_t shs_shmem_get_insert_index(shs_shmem_t *shm, size_t size)
     return id;
 }
 
+#define SHS_SHM_HUGETLB    0x01
+#define SHS_SHM_ADVISED    0x02
+#define SHS_SHM_POPULATED  0x04
+
+/* how each region still mapped was made, for the stats on unmap */
+typedef struct shs_shm_region_s
+{
+    void   *addr;
+    size_t  size;
+    int     kinds;
+} shs_shm_region_t;
+
+static int                g_shm_pages = SHS_SHM_PAGES_DEFAULT;
+static int                g_shm_populate = 0;
+static shs_shm_map_stat_t g_shm_map_stat;
+static pthread_mutex_t    g_shm_map_mutex = PTHREAD_MUTEX_INITIALIZER;
+static shs_shm_region_t  *g_shm_regions = NULL;
+static size_t             g_shm_regions_cnt = 0;
+static size_t             g_shm_regions_cap = 0;
+
+/* with g_shm_map_mutex held */
+static void shs_shm_account(size_t size, int kinds, int sign)
+{
+    g_shm_map_stat.regions += sign;
+    g_shm_map_stat.mapped_size += sign * size;
+
+    if (kinds & SHS_SHM_HUGETLB) 
+    {
+        g_shm_map_stat.hugetlb_size += sign * size;
+    }
+
+    if (kinds & SHS_SHM_ADVISED) 
+    {
+        g_shm_map_stat.advised_size += sign * size;
+    }
+
+    if (kinds & SHS_SHM_POPULATED) 
+    {
+        g_shm_map_stat.populated_size += sign * size;
+    }
+}
+
+static void shs_shm_add_region(void *addr, size_t size, int kinds)
+{
+    shs_shm_region_t *regions = NULL;
+    size_t            cap = 0;
+
+    pthread_mutex_lock(&g_shm_map_mutex);
+
+    if (g_shm_regions_cnt == g_shm_regions_cap) 
+    {
+        cap = g_shm_regions_cap ? g_shm_regions_cap * 2 : 16;
+        regions = (shs_shm_region_t *)realloc(g_shm_regions, 
+            cap * sizeof(shs_shm_region_t));
+        if (regions) 
+        {
+            g_shm_regions = regions;
+            g_shm_regions_cap = cap;
+        }
+    }
+
+    /* an unrecorded region is unmapped as a plain one */
+    if (g_shm_regions_cnt < g_shm_regions_cap) 
+    {
+        g_shm_regions[g_shm_regions_cnt].addr = addr;
+        g_shm_regions[g_shm_regions_cnt].size = size;
+        g_shm_regions[g_shm_regions_cnt].kinds = kinds;
+        g_shm_regions_cnt++;
+    }
+    else 
+    {
+        kinds = 0;
+    }
+
+    shs_shm_account(size, kinds, 1);
+
+    pthread_mutex_unlock(&g_shm_map_mutex);
+}
+
+static void shs_shm_remove_region(void *addr, size_t size)
+{
+    int kinds = 0;
+
+    pthread_mutex_lock(&g_shm_map_mutex);
+
+    for (size_t i = 0; i < g_shm_regions_cnt; i++) 
+    {
+        if (g_shm_regions[i].addr == addr) 
+        {
+            kinds = g_shm_regions[i].kinds;
+            g_shm_regions[i] = g_shm_regions[--g_shm_regions_cnt];
+            break;
+        }
+    }
+
+    shs_shm_account(size, kinds, -1);
+
+    pthread_mutex_unlock(&g_shm_map_mutex);
+}
+
+void shs_shm_set_policy(int pages, int populate)
+{
+    g_shm_pages = pages;
+    g_shm_populate = populate;
+}
+
+void * shs_shm_map(size_t size, size_t *mapped_size)
+{
+    void   *addr = MAP_FAILED;
+    size_t  page = SHS_PAGE_SIZE;
+    int     kinds = 0;
+    int     populate = g_shm_populate ? MAP_POPULATE : 0;
+    int     huge = g_shm_pages == SHS_SHM_PAGES_HUGE 
+        && size >= SHS_SHM_HUGE_PAGE_SIZE;
+
+#ifdef MAP_HUGETLB
+    if (huge) 
+    {
+        size = SHS_MATH_ROUND_UP(size, SHS_SHM_HUGE_PAGE_SIZE);
+        addr = mmap(NULL, size, PROT_READ|PROT_WRITE, 
+            MAP_ANON|MAP_SHARED|MAP_HUGETLB|populate, -1, 0);
+        if (addr != MAP_FAILED) 
+        {
+            kinds |= SHS_SHM_HUGETLB;
+        }
+    }
+#endif
+
+    if (addr == MAP_FAILED) 
+    {
+        size = SHS_MATH_ROUND_UP(size, page);
+
+        /* populating first would fault in small pages before the advice */
+        addr = mmap(NULL, size, PROT_READ|PROT_WRITE, 
+            MAP_ANON|MAP_SHARED|(huge ? 0 : populate), -1, 0);
+        if (addr == MAP_FAILED) 
+        {
+            return NULL;
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (huge && !madvise(addr, size, MADV_HUGEPAGE)) 
+        {
+            kinds |= SHS_SHM_ADVISED;
+        }
+#endif
+
+        if (huge && populate) 
+        {
+            for (size_t off = 0; off < size; off += page) 
+            {
+                ((volatile uchar_t *)addr)[off] = 0;
+            }
+        }
+    }
+
+    if (populate) 
+    {
+        kinds |= SHS_SHM_POPULATED;
+    }
+
+    shs_shm_add_region(addr, size, kinds);
+
+    if (mapped_size) 
+    {
+        *mapped_size = size;
+    }
+
+    return addr;
+}
+
+int shs_shm_unmap(void *addr, size_t mapped_size)
+{
+    if (munmap(addr, mapped_size)) 
+    {
+        return SHS_SHMEM_ERROR;
+    }
+
+    shs_shm_remove_region(addr, mapped_size);
+
+    return SHS_SHMEM_OK;
+}
+
+void shs_shm_get_map_stat(shs_shm_map_stat_t *stat)
+{
+    pthread_mutex_lock(&g_shm_map_mutex);
+    *stat = g_shm_map_stat;
+    pthread_mutex_unlock(&g_shm_map_mutex);
+}
+
 shs_shmem_t * shs_shmem_create(size_t size, size_t min_size, 
     size_t max_size, int level_type, size_t factor, unsigned int *shmem_errno)
 {
@@ -197,10 +389,8 @@ shs_shmem_t * shs_shmem_create(size_t size, size_t min_size,
         return NULL;
     }
 
-    shm = (shs_shmem_t*)mmap(NULL, total_size,
-        PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
-
-    if ((void *)shm == MAP_FAILED) 
+    shm = (shs_shmem_t*)shs_shm_map(total_size, &total_size);
+    if (!shm) 
     {
         *shmem_errno = SHS_SHMEM_ERR_CREATE_MMAP;
 		
@@ -218,7 +408,7 @@ shs_shmem_t * shs_shmem_create(size_t size, size_t min_size,
     system_size = sizeof(shs_shmem_t);
     if (free_size + system_size + sizeof(struct storage) >= total_size) 
     {
-        munmap(shm, total_size);
+        shs_shm_unmap(shm, total_size);
         *shmem_errno = SHS_SHMEM_ERR_CREATE_TOTALSIZE_NOT_ENOUGH;
 
         return NULL;
@@ -244,7 +434,7 @@ shs_shmem_t * shs_shmem_create(size_t size, size_t min_size,
     st->alloc = 0;
     if (st->size < max_size) 
     {
-        munmap(shm, total_size);
+        shs_shm_unmap(shm, total_size);
         *shmem_errno = SHS_SHMEM_ERR_CREATE_STORAGESIZE;
 
         return NULL;
@@ -280,7 +470,7 @@ int shs_shmem_release(shs_shmem_t **shm, unsigned int *shmem_errno)
         return SHS_SHMEM_ERROR;
     }
 
-    if (!munmap(*shm, (*shm)->shmem_stat.total_size)) 
+    if (shs_shm_unmap(*shm, (*shm)->shmem_stat.total_size) == SHS_SHMEM_OK) 
     {
         *shm = NULL;
         return SHS_SHMEM_OK;
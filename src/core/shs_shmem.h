@@ -109,6 +109,33 @@ typedef struct shs_shmem_s
     shs_shmem_stat_t  shmem_stat;// stat for shmem
 } shs_shmem_t;
 
+/*
+ * Anonymous shared mappings for the shmem allocator and the server's
+ * shared regions. Under SHS_SHM_PAGES_HUGE a region of at least
+ * SHS_SHM_HUGE_PAGE_SIZE is mapped from the hugetlb pool and, when that
+ * is short, advised for transparent huge pages instead. With populate
+ * every page is faulted in by shs_shm_map() itself, so regions mapped in
+ * the master before the fork don't fault while serving requests.
+ */
+#define SHS_SHM_PAGES_DEFAULT    0
+#define SHS_SHM_PAGES_HUGE       1
+#define SHS_SHM_HUGE_PAGE_SIZE   ((size_t)2 << 20)
+
+/* of the regions this process has mapped and not unmapped yet */
+typedef struct shs_shm_map_stat_s
+{
+    size_t regions;
+    size_t mapped_size;
+    size_t hugetlb_size;     // from the hugetlb pool
+    size_t advised_size;     // advised for transparent huge pages
+    size_t populated_size;
+} shs_shm_map_stat_t;
+
+void  shs_shm_set_policy(int pages, int populate);
+void *shs_shm_map(size_t size, size_t *mapped_size);
+int   shs_shm_unmap(void *addr, size_t mapped_size);
+void  shs_shm_get_map_stat(shs_shm_map_stat_t *stat);
+
 shs_shmem_t* shs_shmem_create(size_t size, size_t min_size, 
     size_t max_size, int level_type, size_t factor, unsigned int *shmem_errno);
 int shs_shmem_release(shs_shmem_t **shm, unsigned int *shmem_errno);   
@@ -1,3 +1,9 @@
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "shs_string.h"
 #include "shs_memory.h"
 
@@ -1226,9 +1232,129 @@ uchar_t * string_utf8_cpystrn(uchar_t *dst, uchar_t *src,
     return dst;
 }
 
+/*
+ * Vector kernels for the escape/unescape loops: AVX2 when built with
+ * -mavx2, SSE2 on any other x86_64 build, plain bytes elsewhere.
+ *
+ * An unsigned range test lo <= c <= hi is done with signed compares by
+ * biasing c - lo into [-128, 127].
+ */
+#if defined(__AVX2__)
+
+#define STRING_VEC_SIZE 32
+
+static inline uint32_t string_vec_alnum_mask(const uchar_t *p)
+{
+    __m256i c = _mm256_loadu_si256((const __m256i *) p);
+    __m256i l = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+    __m256i d = _mm256_cmpgt_epi8(_mm256_set1_epi8(10 - 128),
+        _mm256_add_epi8(c, _mm256_set1_epi8((char) (128 - '0'))));
+    __m256i a = _mm256_cmpgt_epi8(_mm256_set1_epi8(26 - 128),
+        _mm256_add_epi8(l, _mm256_set1_epi8((char) (128 - 'a'))));
+
+    return (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(d, a));
+}
+
+static inline uint32_t string_vec_eq2_mask(const uchar_t *p,
+    uchar_t c1, uchar_t c2)
+{
+    __m256i c = _mm256_loadu_si256((const __m256i *) p);
+
+    return (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_cmpeq_epi8(c, _mm256_set1_epi8((char) c1)),
+        _mm256_cmpeq_epi8(c, _mm256_set1_epi8((char) c2))));
+}
+
+#elif defined(__SSE2__)
+
+#define STRING_VEC_SIZE 16
+
+static inline uint32_t string_vec_alnum_mask(const uchar_t *p)
+{
+    __m128i c = _mm_loadu_si128((const __m128i *) p);
+    __m128i l = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i d = _mm_cmplt_epi8(
+        _mm_add_epi8(c, _mm_set1_epi8((char) (128 - '0'))),
+        _mm_set1_epi8(10 - 128));
+    __m128i a = _mm_cmplt_epi8(
+        _mm_add_epi8(l, _mm_set1_epi8((char) (128 - 'a'))),
+        _mm_set1_epi8(26 - 128));
+
+    return (uint32_t) _mm_movemask_epi8(_mm_or_si128(d, a));
+}
+
+static inline uint32_t string_vec_eq2_mask(const uchar_t *p,
+    uchar_t c1, uchar_t c2)
+{
+    __m128i c = _mm_loadu_si128((const __m128i *) p);
+
+    return (uint32_t) _mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(c, _mm_set1_epi8((char) c1)),
+        _mm_cmpeq_epi8(c, _mm_set1_epi8((char) c2))));
+}
+
+#endif
+
+#define string_is_alnum(c) \
+    (((c) >= '0' && (c) <= '9') || (((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'z'))
+
+/* the length of the leading run of [0-9A-Za-z] */
+size_t string_alnum_span(const uchar_t *p, size_t n)
+{
+    size_t   i = 0;
+
+#ifdef STRING_VEC_SIZE
+    uint32_t full = (uint32_t) ((1ULL << STRING_VEC_SIZE) - 1);
+    uint32_t mask = 0;
+
+    for (; i + STRING_VEC_SIZE <= n; i += STRING_VEC_SIZE) 
+    {
+        mask = string_vec_alnum_mask(p + i);
+        if (mask != full) 
+        {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+#endif
+
+    while (i < n && string_is_alnum(p[i])) 
+    {
+        i++;
+    }
+
+    return i;
+}
+
+/* the length of the leading run without c1 or c2 */
+size_t string_cspn2(const uchar_t *p, size_t n, uchar_t c1, uchar_t c2)
+{
+    size_t   i = 0;
+
+#ifdef STRING_VEC_SIZE
+    uint32_t mask = 0;
+
+    for (; i + STRING_VEC_SIZE <= n; i += STRING_VEC_SIZE) 
+    {
+        mask = string_vec_eq2_mask(p + i, c1, c2);
+        if (mask) 
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    while (i < n && p[i] != c1 && p[i] != c2) 
+    {
+        i++;
+    }
+
+    return i;
+}
+
 uintptr_t string_escape_uri(uchar_t *dst, uchar_t *src, 
     size_t size, uint32_t type)
 {
+    size_t          run = 0;
     uint32_t        i = 0, n = 0;
     uint32_t       *escape = NULL;
     static uchar_t  hex[] = "0123456789abcdef";
@@ -1337,6 +1463,7 @@ uintptr_t string_escape_uri(uchar_t *dst, uchar_t *src,
     static uint32_t *map[] =
         { uri, args, html, refresh, memcached, memcached };
 
+    /* letters and digits are never escaped, skip them in bulk */
     escape = map[type];
     if (NULL == dst) 
     {
@@ -1344,6 +1471,14 @@ uintptr_t string_escape_uri(uchar_t *dst, uchar_t *src,
         n  = 0;
         for (i = 0; i < size; i++) 
         {
+            run = string_alnum_span(src, size - i);
+            src += run;
+            i += run;
+            if (i == size) 
+            {
+                break;
+            }
+
             if (escape[*src >> 5] & (1 << (*src & 0x1f))) 
             {
                 n++;
@@ -1356,6 +1491,16 @@ uintptr_t string_escape_uri(uchar_t *dst, uchar_t *src,
 
     for (i = 0; i < size; i++) 
     {
+        run = string_alnum_span(src, size - i);
+        memory_memcpy(dst, src, run);
+        dst += run;
+        src += run;
+        i += run;
+        if (i == size) 
+        {
+            break;
+        }
+
         if (escape[*src >> 5] & (1 << (*src & 0x1f))) 
         {
             *dst++ = '%';
@@ -1375,7 +1520,8 @@ uintptr_t string_escape_uri(uchar_t *dst, uchar_t *src,
 void string_unescape_uri(uchar_t **dst, uchar_t **src, 
     size_t size, uint32_t type)
 {
-    uchar_t *d = NULL, *s = NULL, ch = 0, c = 0, decoded = 0;
+    uchar_t *d = NULL, *s = NULL, ch = 0, c = 0, decoded = 0, stop = 0;
+    size_t   run = 0;
 
     enum 
     {
@@ -1389,9 +1535,26 @@ void string_unescape_uri(uchar_t **dst, uchar_t **src,
     //state = 0;
     state = sw_usual;
     decoded = 0;
+    stop = (type & (SHS_UNESCAPE_URI|SHS_UNESCAPE_REDIRECT)) ? '?' : '%';
 
-    while (size--) 
+    while (size) 
     {
+        if (state == sw_usual) 
+        {
+            /* copy the plain run up to the next '%' (or '?') at once */
+            run = string_cspn2(s, size, '%', stop);
+            memory_memcpy(d, s, run);
+            d += run;
+            s += run;
+            size -= run;
+
+            if (0 == size) 
+            {
+                break;
+            }
+        }
+
+        size--;
         ch = *s++;
 		
         switch (state) 
@@ -76,6 +76,8 @@ uint32_t  string_utf8_decode(uchar_t **p, size_t n);
 size_t    string_utf8_length(uchar_t *p, size_t n);
 uchar_t  *string_utf8_cpystrn(uchar_t *dst, uchar_t *src, size_t n, 
     size_t len);
+size_t    string_alnum_span(const uchar_t *p, size_t n);
+size_t    string_cspn2(const uchar_t *p, size_t n, uchar_t c1, uchar_t c2);
 uintptr_t string_escape_uri(uchar_t *dst, uchar_t *src, size_t size,
     uint32_t type);
 void      string_unescape_uri(uchar_t **dst, uchar_t **src, size_t size, 
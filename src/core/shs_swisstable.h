@@ -0,0 +1,478 @@
+#ifndef SHS_SWISSTABLE_H
+#define SHS_SWISSTABLE_H
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "shs_hashtable.h"
+#include "shs_memory.h"
+
+/*
+ * Open-addressing variant of shs_hashtable with the same intrusive
+ * links: the table only keeps pointers to the callers' links.
+ *
+ * Slots come in groups of 16 with one control byte each, holding 7 bits
+ * of the key's hash when the slot is full. A lookup compares the bytes
+ * of a whole group at once (with SSE2 where there is), so it only calls
+ * the compare for slots whose fingerprint matches and stops at the first
+ * group with an empty slot. HASH and CMP are function objects, so both
+ * are inlined:
+ *
+ *     size_t HASH::operator()(const void *key, size_t len) const;
+ *     int    CMP::operator()(const void *key, const void *link_key,
+ *                size_t len) const;    // 0 when equal
+ *
+ * The table doubles once 7/8 of it is used. Like shs_hashtable it is
+ * created on the allocator when there is one, so it can live in shared
+ * memory; it isn't locked either.
+ */
+#define SHS_SWISSTABLE_GROUP      16
+#define SHS_SWISSTABLE_MIN_SIZE   16
+
+#define SHS_SWISSTABLE_EMPTY      ((uint8_t)0x80)
+#define SHS_SWISSTABLE_DELETED    ((uint8_t)0xfe)
+
+struct shs_swisstable_hash_fnv
+{
+    size_t operator()(const void *key, size_t len) const
+    {
+        const uchar_t *p = (const uchar_t *)key;
+        uint64_t       h = 14695981039346656037ULL;
+
+        while (len--)
+        {
+            h = (h ^ *p++) * 1099511628211ULL;
+        }
+
+        return h;
+    }
+};
+
+struct shs_swisstable_cmp_mem
+{
+    int operator()(const void *key, const void *link_key, size_t len) const
+    {
+        return memcmp(key, link_key, len);
+    }
+};
+
+template <typename HASH = shs_swisstable_hash_fnv,
+    typename CMP = shs_swisstable_cmp_mem>
+struct shs_swisstable_s
+{
+    uint8_t               *ctrl;        // size bytes, then the slots
+    shs_hashtable_link_t **slots;
+    shs_mem_allocator_t   *allocator;   // create on shmem
+    size_t                 size;        // slots, a power of 2
+    size_t                 growth_left; // inserts into empty slots left
+    int                    count;
+    HASH                   hash;
+    CMP                    cmp;
+};
+
+/* the caller's hash may be weak in any bits, the table uses all of them */
+static inline uint64_t shs_swisstable_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/* bit i set for each control byte i of the group equal to c */
+static inline uint32_t shs_swisstable_match(const uint8_t *group, uint8_t c)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)c)));
+#else
+    uint32_t mask = 0;
+
+    for (int i = 0; i < SHS_SWISSTABLE_GROUP; i++)
+    {
+        mask |= (uint32_t)(group[i] == c) << i;
+    }
+
+    return mask;
+#endif
+}
+
+/* bit i set for each empty or deleted slot of the group */
+static inline uint32_t shs_swisstable_match_free(const uint8_t *group)
+{
+#ifdef __SSE2__
+    /* both have the high bit set, full slots don't */
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    uint32_t mask = 0;
+
+    for (int i = 0; i < SHS_SWISSTABLE_GROUP; i++)
+    {
+        mask |= (uint32_t)(group[i] >> 7) << i;
+    }
+
+    return mask;
+#endif
+}
+
+static inline size_t shs_swisstable_growth(size_t size)
+{
+    return size - size / 8;
+}
+
+template <typename HASH, typename CMP>
+static int shs_swisstable_alloc(shs_swisstable_s<HASH, CMP> *ht, size_t size)
+{
+    size_t       bytes = size + size * sizeof(shs_hashtable_link_t *);
+    uint8_t     *mem = NULL;
+    unsigned int err_no = -1;
+
+    if (ht->allocator)
+    {
+        mem = (uint8_t *)ht->allocator->alloc(ht->allocator, bytes, &err_no);
+    }
+    else
+    {
+        mem = (uint8_t *)memory_alloc(bytes);
+    }
+
+    if (!mem)
+    {
+        return SHS_HASHTABLE_ERROR;
+    }
+
+    memset(mem, SHS_SWISSTABLE_EMPTY, size);
+
+    ht->ctrl = mem;
+    ht->slots = (shs_hashtable_link_t **)(mem + size);
+    ht->size = size;
+    ht->growth_left = shs_swisstable_growth(size) - ht->count;
+
+    return SHS_HASHTABLE_OK;
+}
+
+template <typename HASH, typename CMP>
+static void shs_swisstable_release(shs_swisstable_s<HASH, CMP> *ht,
+    uint8_t *ctrl, size_t size)
+{
+    unsigned int err_no = -1;
+
+    if (ht->allocator)
+    {
+        ht->allocator->free(ht->allocator, ctrl, &err_no);
+    }
+    else
+    {
+        memory_free(ctrl, size + size * sizeof(shs_hashtable_link_t *));
+    }
+}
+
+/* the first free slot on the probe sequence of h */
+template <typename HASH, typename CMP>
+static size_t shs_swisstable_find_free(shs_swisstable_s<HASH, CMP> *ht,
+    uint64_t h)
+{
+    size_t   mask = ht->size / SHS_SWISSTABLE_GROUP - 1;
+    size_t   g = (h >> 7) & mask;
+    uint32_t match = 0;
+
+    for (size_t step = 1; ; step++)
+    {
+        match = shs_swisstable_match_free(ht->ctrl + g * SHS_SWISSTABLE_GROUP);
+        if (match)
+        {
+            return g * SHS_SWISSTABLE_GROUP + __builtin_ctz(match);
+        }
+
+        g = (g + step) & mask;
+    }
+}
+
+template <typename HASH, typename CMP>
+static int shs_swisstable_rehash(shs_swisstable_s<HASH, CMP> *ht,
+    size_t size)
+{
+    uint8_t               *old_ctrl = ht->ctrl;
+    shs_hashtable_link_t **old_slots = ht->slots;
+    size_t                 old_size = ht->size;
+    shs_hashtable_link_t  *hl = NULL;
+    uint64_t               h = 0;
+    size_t                 i = 0;
+
+    if (shs_swisstable_alloc(ht, size) != SHS_HASHTABLE_OK)
+    {
+        ht->ctrl = old_ctrl;
+        ht->slots = old_slots;
+
+        return SHS_HASHTABLE_ERROR;
+    }
+
+    for (size_t j = 0; j < old_size; j++)
+    {
+        if (old_ctrl[j] & 0x80)
+        {
+            continue;
+        }
+
+        hl = old_slots[j];
+        h = shs_swisstable_mix(ht->hash(hl->key, hl->len));
+        i = shs_swisstable_find_free(ht, h);
+        ht->ctrl[i] = h & 0x7f;
+        ht->slots[i] = hl;
+    }
+
+    shs_swisstable_release(ht, old_ctrl, old_size);
+
+    return SHS_HASHTABLE_OK;
+}
+
+/* size is a hint of the number of links, 0 for the minimum */
+template <typename HASH, typename CMP>
+int shs_swisstable_init(shs_swisstable_s<HASH, CMP> *ht, size_t size,
+    shs_mem_allocator_t *allocator)
+{
+    size_t slots = SHS_SWISSTABLE_MIN_SIZE;
+
+    while (shs_swisstable_growth(slots) < size)
+    {
+        slots <<= 1;
+    }
+
+    ht->allocator = allocator;
+    ht->count = 0;
+
+    return shs_swisstable_alloc(ht, slots);
+}
+
+template <typename HASH, typename CMP>
+shs_swisstable_s<HASH, CMP> * shs_swisstable_create(size_t size,
+    shs_mem_allocator_t *allocator)
+{
+    shs_swisstable_s<HASH, CMP> *ht = NULL;
+    unsigned int                 err_no = -1;
+
+    if (allocator)
+    {
+        ht = (shs_swisstable_s<HASH, CMP> *)allocator->calloc(allocator,
+            sizeof(shs_swisstable_s<HASH, CMP>), &err_no);
+    }
+    else
+    {
+        ht = (shs_swisstable_s<HASH, CMP> *)memory_calloc(
+            sizeof(shs_swisstable_s<HASH, CMP>));
+    }
+
+    if (!ht)
+    {
+        return NULL;
+    }
+
+    if (shs_swisstable_init(ht, size, allocator) == SHS_HASHTABLE_OK)
+    {
+        return ht;
+    }
+
+    if (allocator)
+    {
+        allocator->free(allocator, ht, &err_no);
+    }
+    else
+    {
+        memory_free(ht, sizeof(shs_swisstable_s<HASH, CMP>));
+    }
+
+    return NULL;
+}
+
+template <typename HASH, typename CMP>
+void shs_swisstable_free_memory(shs_swisstable_s<HASH, CMP> *ht)
+{
+    unsigned int err_no = -1;
+
+    if (!ht)
+    {
+        return;
+    }
+
+    if (ht->ctrl)
+    {
+        shs_swisstable_release(ht, ht->ctrl, ht->size);
+    }
+
+    if (ht->allocator)
+    {
+        ht->allocator->free(ht->allocator, ht, &err_no);
+    }
+    else
+    {
+        memory_free(ht, sizeof(shs_swisstable_s<HASH, CMP>));
+    }
+}
+
+/* returns the link, or NULL */
+template <typename HASH, typename CMP>
+void * shs_swisstable_lookup(shs_swisstable_s<HASH, CMP> *ht,
+    const void *key, size_t len)
+{
+    uint64_t       h = 0;
+    size_t         mask = 0;
+    size_t         g = 0;
+    const uint8_t *group = NULL;
+    uint32_t       match = 0;
+    size_t         i = 0;
+
+    if (!ht || !key)
+    {
+        return NULL;
+    }
+
+    h = shs_swisstable_mix(ht->hash(key, len));
+    mask = ht->size / SHS_SWISSTABLE_GROUP - 1;
+    g = (h >> 7) & mask;
+
+    for (size_t step = 1; step <= mask + 1; step++)
+    {
+        group = ht->ctrl + g * SHS_SWISSTABLE_GROUP;
+
+        for (match = shs_swisstable_match(group, h & 0x7f); match;
+            match &= match - 1)
+        {
+            i = g * SHS_SWISSTABLE_GROUP + __builtin_ctz(match);
+            if (ht->slots[i]->len == len
+                && ht->cmp(key, ht->slots[i]->key, len) == 0)
+            {
+                return ht->slots[i];
+            }
+        }
+
+        if (shs_swisstable_match(group, SHS_SWISSTABLE_EMPTY))
+        {
+            return NULL;
+        }
+
+        g = (g + step) & mask;
+    }
+
+    return NULL;
+}
+
+/*
+ * Adds hl under hl->key, without looking for a link with the same key
+ * first, like shs_hashtable_join().
+ */
+template <typename HASH, typename CMP>
+int shs_swisstable_join(shs_swisstable_s<HASH, CMP> *ht,
+    shs_hashtable_link_t *hl)
+{
+    uint64_t h = 0;
+    size_t   i = 0;
+
+    if (!ht || !hl)
+    {
+        return SHS_HASHTABLE_ERROR;
+    }
+
+    h = shs_swisstable_mix(ht->hash(hl->key, hl->len));
+    i = shs_swisstable_find_free(ht, h);
+
+    if (0 == ht->growth_left && ht->ctrl[i] == SHS_SWISSTABLE_EMPTY)
+    {
+        /* mostly tombstones: clean them out in place, else grow */
+        if (shs_swisstable_rehash(ht, (size_t)ht->count * 2
+            < shs_swisstable_growth(ht->size) ? ht->size : ht->size * 2)
+            != SHS_HASHTABLE_OK)
+        {
+            return SHS_HASHTABLE_ERROR;
+        }
+
+        i = shs_swisstable_find_free(ht, h);
+    }
+
+    if (ht->ctrl[i] == SHS_SWISSTABLE_EMPTY)
+    {
+        ht->growth_left--;
+    }
+
+    ht->ctrl[i] = h & 0x7f;
+    ht->slots[i] = hl;
+    ht->count++;
+
+    return SHS_HASHTABLE_OK;
+}
+
+template <typename HASH, typename CMP>
+int shs_swisstable_remove_link(shs_swisstable_s<HASH, CMP> *ht,
+    shs_hashtable_link_t *hl)
+{
+    uint64_t       h = 0;
+    size_t         mask = 0;
+    size_t         g = 0;
+    uint8_t       *group = NULL;
+    uint32_t       match = 0;
+    size_t         i = 0;
+
+    if (!ht || !hl)
+    {
+        return SHS_HASHTABLE_ERROR;
+    }
+
+    h = shs_swisstable_mix(ht->hash(hl->key, hl->len));
+    mask = ht->size / SHS_SWISSTABLE_GROUP - 1;
+    g = (h >> 7) & mask;
+
+    for (size_t step = 1; step <= mask + 1; step++)
+    {
+        group = ht->ctrl + g * SHS_SWISSTABLE_GROUP;
+
+        for (match = shs_swisstable_match(group, h & 0x7f); match;
+            match &= match - 1)
+        {
+            i = g * SHS_SWISSTABLE_GROUP + __builtin_ctz(match);
+            if (ht->slots[i] != hl)
+            {
+                continue;
+            }
+
+            /*
+             * A lookup stops at a group with an empty slot, so no probe
+             * runs past this one and the slot can be emptied outright.
+             */
+            if (shs_swisstable_match(group, SHS_SWISSTABLE_EMPTY))
+            {
+                ht->ctrl[i] = SHS_SWISSTABLE_EMPTY;
+                ht->growth_left++;
+            }
+            else
+            {
+                ht->ctrl[i] = SHS_SWISSTABLE_DELETED;
+            }
+
+            ht->count--;
+
+            return SHS_HASHTABLE_OK;
+        }
+
+        if (shs_swisstable_match(group, SHS_SWISSTABLE_EMPTY))
+        {
+            return SHS_HASHTABLE_ERROR;
+        }
+
+        g = (g + step) & mask;
+    }
+
+    return SHS_HASHTABLE_ERROR;
+}
+
+template <typename HASH, typename CMP>
+int shs_swisstable_empty(shs_swisstable_s<HASH, CMP> *ht)
+{
+    return ht && ht->count ? SHS_HASHTABLE_FALSE : SHS_HASHTABLE_TRUE;
+}
+
+#endif
@@ -0,0 +1,455 @@
+#include "shs_tcache.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define TCACHE_SPAN_SHIFT  20
+#define TCACHE_SPAN_SIZE   ((size_t)1 << TCACHE_SPAN_SHIFT)
+#define TCACHE_CLASSES     52
+#define TCACHE_ROUNDS_MAX  64
+#define TCACHE_MAG_BYTES   (128 * 1024)
+
+typedef struct tcache_magazine_s tcache_magazine_t;
+
+struct tcache_magazine_s
+{
+    tcache_magazine_t *next;
+    int                n;
+    void              *obj[TCACHE_ROUNDS_MAX];
+};
+
+typedef struct tcache_depot_s
+{
+    pthread_mutex_t    mutex;
+    tcache_magazine_t *full;
+    tcache_magazine_t *empty;
+    void              *loose;     // objects freed with no magazine to take them
+    uchar_t           *carve;     // unused part of the class's last span
+    uchar_t           *carve_end;
+} __attribute__((aligned(DEFAULT_CACHELINE_SIZE))) tcache_depot_t;
+
+typedef struct tcache_thread_s
+{
+    tcache_magazine_t *loaded[TCACHE_CLASSES];
+    tcache_magazine_t *previous[TCACHE_CLASSES];
+} tcache_thread_t;
+
+static uchar_t        *g_arena = NULL;
+static uchar_t        *g_arena_next = NULL;   // next span to hand out
+static size_t          g_arena_size = 0;
+static uint8_t        *g_span_class = NULL;
+static size_t          g_class_size[TCACHE_CLASSES];
+static int             g_class_rounds[TCACHE_CLASSES];
+static tcache_depot_t  g_depot[TCACHE_CLASSES];
+static pthread_key_t   g_thread_key;
+
+static __thread tcache_thread_t *t_tcache = NULL;
+
+static void tcache_thread_exit(void *data);
+static void tcache_atfork_child();
+
+/*
+ * 16 byte steps up to 128, then four classes per power of two, so the
+ * rounding loses at most a quarter.
+ */
+static int tcache_class(size_t size)
+{
+    int k = 0;
+
+    if (size <= 128)
+    {
+        return size ? (size + 15) / 16 - 1 : 0;
+    }
+
+    size--;
+    k = 63 - __builtin_clzl(size);
+
+    return 8 + (k - 7) * 4 + ((size >> (k - 2)) & 3);
+}
+
+int tcache_init(size_t reserve)
+{
+    void   *mem = NULL;
+    int     cls = 0;
+    int     k = 0;
+    size_t  size = 0;
+
+    if (g_arena)
+    {
+        return SHS_OK;
+    }
+
+    reserve = reserve ? reserve : TCACHE_RESERVE_DEFAULT;
+    reserve = (reserve + TCACHE_SPAN_SIZE - 1) & ~(TCACHE_SPAN_SIZE - 1);
+
+    /*
+     * Address space only: an inaccessible mapping is not charged against
+     * the commit limit, even with vm.overcommit_memory=2. Spans are made
+     * writable, and charged, one at a time as they are handed out.
+     */
+    mem = mmap(NULL, reserve, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return SHS_ERROR;
+    }
+
+    g_span_class = (uint8_t *)calloc(reserve >> TCACHE_SPAN_SHIFT, 1);
+    if (!g_span_class)
+    {
+        munmap(mem, reserve);
+
+        return SHS_ERROR;
+    }
+
+    for (cls = 0; cls < 8; cls++)
+    {
+        g_class_size[cls] = (cls + 1) * 16;
+    }
+
+    for (k = 7; cls < TCACHE_CLASSES; k++)
+    {
+        for (int sub = 1; sub <= 4 && cls < TCACHE_CLASSES; sub++)
+        {
+            g_class_size[cls++] = ((size_t)1 << k) + sub * ((size_t)1 << (k - 2));
+        }
+    }
+
+    for (cls = 0; cls < TCACHE_CLASSES; cls++)
+    {
+        size = TCACHE_MAG_BYTES / g_class_size[cls];
+        g_class_rounds[cls] = size < 2 ? 2
+            : (size > TCACHE_ROUNDS_MAX ? TCACHE_ROUNDS_MAX : size);
+
+        pthread_mutex_init(&g_depot[cls].mutex, NULL);
+    }
+
+    pthread_key_create(&g_thread_key, tcache_thread_exit);
+    pthread_atfork(NULL, NULL, tcache_atfork_child);
+
+    g_arena_next = (uchar_t *)mem;
+    g_arena_size = reserve;
+    __sync_synchronize();
+    g_arena = (uchar_t *)mem;
+
+    return SHS_OK;
+}
+
+int tcache_owns(const void *p)
+{
+    return g_arena && (const uchar_t *)p >= g_arena
+        && (const uchar_t *)p < g_arena + g_arena_size;
+}
+
+size_t tcache_usable_size(const void *p)
+{
+    size_t span = ((const uchar_t *)p - g_arena) >> TCACHE_SPAN_SHIFT;
+
+    return g_class_size[g_span_class[span]];
+}
+
+static tcache_thread_t *tcache_thread()
+{
+    if (t_tcache)
+    {
+        return t_tcache;
+    }
+
+    t_tcache = (tcache_thread_t *)calloc(1, sizeof(tcache_thread_t));
+    if (t_tcache)
+    {
+        pthread_setspecific(g_thread_key, t_tcache);
+    }
+
+    return t_tcache;
+}
+
+static tcache_magazine_t *tcache_magazine_new()
+{
+    tcache_magazine_t *m = (tcache_magazine_t *)malloc(sizeof(tcache_magazine_t));
+    if (m)
+    {
+        m->next = NULL;
+        m->n = 0;
+    }
+
+    return m;
+}
+
+/* with the depot locked */
+static int tcache_depot_carve(int cls, tcache_magazine_t *m)
+{
+    tcache_depot_t *depot = &g_depot[cls];
+    size_t          size = g_class_size[cls];
+    uchar_t        *span = NULL;
+
+    while (m->n < g_class_rounds[cls])
+    {
+        if (depot->carve + size > depot->carve_end || !depot->carve)
+        {
+            span = (uchar_t *)__sync_fetch_and_add(&g_arena_next,
+                TCACHE_SPAN_SIZE);
+            if (span + TCACHE_SPAN_SIZE > g_arena + g_arena_size
+                || mprotect(span, TCACHE_SPAN_SIZE, PROT_READ | PROT_WRITE))
+            {
+                break;
+            }
+
+            g_span_class[(span - g_arena) >> TCACHE_SPAN_SHIFT] = cls;
+            depot->carve = span;
+            depot->carve_end = span + TCACHE_SPAN_SIZE;
+        }
+
+        m->obj[m->n++] = depot->carve;
+        depot->carve += size;
+    }
+
+    return m->n;
+}
+
+/* with the depot locked, loose objects go before new ones are carved */
+static int tcache_depot_fill(int cls, tcache_magazine_t *m)
+{
+    tcache_depot_t *depot = &g_depot[cls];
+
+    while (depot->loose && m->n < g_class_rounds[cls])
+    {
+        m->obj[m->n++] = depot->loose;
+        depot->loose = *(void **)depot->loose;
+    }
+
+    return tcache_depot_carve(cls, m);
+}
+
+/*
+ * Gives an object to the depot when the freeing thread has no magazine
+ * for it: into the first full magazine if that has room, else onto the
+ * class's loose list, so it is never dropped.
+ */
+static void tcache_depot_put(int cls, void *p)
+{
+    tcache_depot_t    *depot = &g_depot[cls];
+    tcache_magazine_t *m = NULL;
+
+    pthread_mutex_lock(&depot->mutex);
+
+    m = depot->full;
+    if (m && m->n < g_class_rounds[cls])
+    {
+        m->obj[m->n++] = p;
+    }
+    else
+    {
+        *(void **)p = depot->loose;
+        depot->loose = p;
+    }
+
+    pthread_mutex_unlock(&depot->mutex);
+}
+
+/* swaps the thread's empty magazine for one with objects in it */
+static tcache_magazine_t *tcache_refill(tcache_thread_t *tc, int cls)
+{
+    tcache_depot_t    *depot = &g_depot[cls];
+    tcache_magazine_t *m = tc->loaded[cls];
+
+    pthread_mutex_lock(&depot->mutex);
+
+    if (depot->full)
+    {
+        if (m)
+        {
+            m->next = depot->empty;
+            depot->empty = m;
+        }
+
+        m = depot->full;
+        depot->full = m->next;
+    }
+    else if (m || (m = tcache_magazine_new()))
+    {
+        tcache_depot_fill(cls, m);
+    }
+
+    pthread_mutex_unlock(&depot->mutex);
+
+    tc->loaded[cls] = m;
+
+    return m;
+}
+
+/* swaps the thread's full magazine for an empty one */
+static tcache_magazine_t *tcache_spill(tcache_thread_t *tc, int cls)
+{
+    tcache_depot_t    *depot = &g_depot[cls];
+    tcache_magazine_t *m = tc->loaded[cls];
+
+    pthread_mutex_lock(&depot->mutex);
+
+    if (m)
+    {
+        m->next = depot->full;
+        depot->full = m;
+    }
+
+    m = depot->empty;
+    if (m)
+    {
+        depot->empty = m->next;
+    }
+
+    pthread_mutex_unlock(&depot->mutex);
+
+    if (!m)
+    {
+        m = tcache_magazine_new();
+    }
+
+    if (m)
+    {
+        m->n = 0;
+    }
+
+    tc->loaded[cls] = m;
+
+    return m;
+}
+
+void *tcache_alloc(size_t size)
+{
+    tcache_thread_t   *tc = NULL;
+    tcache_magazine_t *m = NULL;
+    int                cls = 0;
+
+    if (!g_arena || size > TCACHE_MAX_SIZE || !(tc = tcache_thread()))
+    {
+        return malloc(size);
+    }
+
+    cls = tcache_class(size);
+    m = tc->loaded[cls];
+
+    if (!m || 0 == m->n)
+    {
+        if (tc->previous[cls] && tc->previous[cls]->n > 0)
+        {
+            tc->loaded[cls] = tc->previous[cls];
+            tc->previous[cls] = m;
+            m = tc->loaded[cls];
+        }
+        else
+        {
+            m = tcache_refill(tc, cls);
+            if (!m || 0 == m->n)
+            {
+                return malloc(size);
+            }
+        }
+    }
+
+    return m->obj[--m->n];
+}
+
+void tcache_free(void *p)
+{
+    tcache_thread_t   *tc = NULL;
+    tcache_magazine_t *m = NULL;
+    int                cls = 0;
+
+    if (!tcache_owns(p))
+    {
+        free(p);
+
+        return;
+    }
+
+    cls = g_span_class[((uchar_t *)p - g_arena) >> TCACHE_SPAN_SHIFT];
+
+    tc = tcache_thread();
+    if (!tc)
+    {
+        tcache_depot_put(cls, p);
+
+        return;
+    }
+
+    m = tc->loaded[cls];
+
+    if (!m || m->n == g_class_rounds[cls])
+    {
+        if (tc->previous[cls] && tc->previous[cls]->n < g_class_rounds[cls])
+        {
+            tc->loaded[cls] = tc->previous[cls];
+            tc->previous[cls] = m;
+            m = tc->loaded[cls];
+        }
+        else
+        {
+            /* the full one goes to the depot, the previous one is kept */
+            if (m && !tc->previous[cls])
+            {
+                tc->previous[cls] = m;
+                tc->loaded[cls] = NULL;
+            }
+
+            m = tcache_spill(tc, cls);
+            if (!m)
+            {
+                tcache_depot_put(cls, p);
+
+                return;
+            }
+        }
+    }
+
+    m->obj[m->n++] = p;
+}
+
+/* an exiting thread's objects go back to the depots */
+static void tcache_thread_exit(void *data)
+{
+    tcache_thread_t   *tc = (tcache_thread_t *)data;
+    tcache_depot_t    *depot = NULL;
+    tcache_magazine_t *m[2];
+    int                cls = 0;
+
+    for (cls = 0; cls < TCACHE_CLASSES; cls++)
+    {
+        depot = &g_depot[cls];
+        m[0] = tc->loaded[cls];
+        m[1] = tc->previous[cls];
+
+        pthread_mutex_lock(&depot->mutex);
+        for (int i = 0; i < 2; i++)
+        {
+            if (!m[i])
+            {
+                continue;
+            }
+
+            if (m[i]->n > 0)
+            {
+                m[i]->next = depot->full;
+                depot->full = m[i];
+            }
+            else
+            {
+                m[i]->next = depot->empty;
+                depot->empty = m[i];
+            }
+        }
+        pthread_mutex_unlock(&depot->mutex);
+    }
+
+    free(tc);
+    t_tcache = NULL;
+}
+
+/* the depot locks may have been held by threads the child doesn't have */
+static void tcache_atfork_child()
+{
+    for (int cls = 0; cls < TCACHE_CLASSES; cls++)
+    {
+        pthread_mutex_init(&g_depot[cls].mutex, NULL);
+    }
+}
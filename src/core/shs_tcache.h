@@ -0,0 +1,33 @@
+#ifndef SHS_TCACHE_H
+#define SHS_TCACHE_H
+
+#include "shs_types.h"
+
+/*
+ * Thread-caching, size-classed allocator for 16 bytes to 256K.
+ *
+ * Objects come from 1M spans carved out of one reserved address range,
+ * each span serving a single size class, so tcache_free() needs neither
+ * a header nor the size: the class is looked up by span. Every thread
+ * keeps two magazines of free objects per class and only goes to the
+ * class's central depot, under its lock, to swap a whole magazine.
+ *
+ * The range is reserved inaccessible, so only spans in use count against
+ * the commit limit, also under vm.overcommit_memory=2; a span is made
+ * writable when a class first takes it. Freed objects stay with their
+ * class and spans are never given back to the system, so the resident
+ * size stays at its peak. Anything larger than TCACHE_MAX_SIZE, or any
+ * request once the range is used up or a span can't be committed, is
+ * served by malloc(); tcache_owns() tells the two apart.
+ */
+#define TCACHE_MAX_SIZE        (256 * 1024)
+#define TCACHE_RESERVE_DEFAULT ((size_t)8 << 30)
+
+/* reserve is the size of the address range, 0 for the default */
+int    tcache_init(size_t reserve);
+void  *tcache_alloc(size_t size);
+void   tcache_free(void *p);
+int    tcache_owns(const void *p);
+size_t tcache_usable_size(const void *p);
+
+#endif
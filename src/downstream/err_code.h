@@ -21,6 +21,7 @@ enum ErrCode
     E_REACH_SERVER_RETRY_LIMIT,
     E_REACH_HOST_RETRY_LIMIT,
     E_OTHER_FAIL,
+    E_CIRCUIT_OPEN,
 
     E_HTTP_INVALID_HEADER = 1001,
     E_HTTP_INVALID_BODY = 1002,
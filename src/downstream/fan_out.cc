@@ -0,0 +1,208 @@
+#include "fan_out.h"
+
+#include <boost/bind.hpp>
+
+#include "log/logging.h"
+#include "event_watcher.h"
+#include "downstream/server.h"
+#include "downstream/request.h"
+
+namespace shs
+{
+namespace downstream
+{
+
+FanOut::FanOut(Policy policy, size_t k, int timeout_ms)
+    : policy_(policy)
+    , k_(k)
+    , timeout_ms_(timeout_ms)
+    , pending_(0)
+    , succeeded_(0)
+    , failed_(0)
+    , completed_(false)
+{
+}
+
+FanOut::~FanOut()
+{
+    if (timeout_watcher_)
+    {
+        timeout_watcher_->Close();
+    }
+}
+
+void FanOut::Add(Server* server, Request* request)
+{
+    Reply reply;
+    reply.server = server;
+    reply.request = request;
+
+    replies_.push_back(reply);
+}
+
+void FanOut::Execute(const CompleteHandler& complete_handler)
+{
+    complete_handler_ = complete_handler;
+    pending_ = replies_.size();
+
+    // kFirstK with k == 0 would be satisfied before anything was called
+    if (replies_.empty() || Needed() > replies_.size()
+        || (policy_ == kFirstK && 0 == k_))
+    {
+        Complete(replies_.empty() ? OK : E_BAD_REQUEST);
+
+        return;
+    }
+
+    // Keep ourselves alive until the last reply, even if the caller
+    // drops its reference right after Execute().
+    boost::shared_ptr<FanOut> self = shared_from_this();
+
+    if (timeout_ms_ > 0 && replies_[0].server
+        && replies_[0].server->event_timer())
+    {
+        timeout_watcher_.reset(new TimedEventWatcher(
+            replies_[0].server->event_base(),
+            replies_[0].server->event_timer(), timeout_ms_,
+            std::tr1::bind(&FanOut::HandleTimeout, this)));
+        timeout_watcher_->Init();
+    }
+
+    for (size_t i = 0; i < replies_.size(); i++)
+    {
+        Reply& reply = replies_[i];
+        if (NULL == reply.request)
+        {
+            HandleResponse(i, E_BAD_REQUEST,
+                boost::shared_ptr<Response>(new Response(NULL)));
+
+            continue;
+        }
+
+        reply.request->Execute(reply.server, boost::bind(
+            &FanOut::HandleResponse, self, i, _1, _2));
+    }
+}
+
+void FanOut::HandleResponse(size_t idx, ErrCode ec,
+    boost::shared_ptr<Response> response)
+{
+    Reply& reply = replies_[idx];
+    if (reply.done)
+    {
+        return;
+    }
+
+    reply.done = true;
+    pending_--;
+
+    if (completed_)
+    {
+        return;
+    }
+
+    reply.ec = ec;
+    reply.response = response;
+
+    if (ec == OK)
+    {
+        succeeded_++;
+    }
+    else
+    {
+        failed_++;
+    }
+
+    if (Satisfied())
+    {
+        Complete(OK);
+    }
+    else if (Impossible())
+    {
+        Complete(ec);
+    }
+}
+
+void FanOut::HandleTimeout()
+{
+    if (completed_)
+    {
+        return;
+    }
+
+    SLOG(ERROR) << "FanOut deadline reached"
+        << "\ttimeout=" << timeout_ms_
+        << "\ttotal=" << replies_.size()
+        << "\tsucceeded=" << succeeded_
+        << "\tfailed=" << failed_
+        << "\tpending=" << pending_;
+
+    Complete(Satisfied() ? OK : E_REQUEST_TIMEOUT);
+}
+
+size_t FanOut::Needed() const
+{
+    switch (policy_)
+    {
+    case kQuorum:
+        return replies_.size() / 2 + 1;
+    case kFirstK:
+        return k_;
+    case kAll:
+    default:
+        return replies_.size();
+    }
+}
+
+bool FanOut::Satisfied() const
+{
+    if (policy_ == kAll)
+    {
+        return pending_ == 0 && failed_ == 0;
+    }
+
+    return succeeded_ >= Needed();
+}
+
+bool FanOut::Impossible() const
+{
+    if (policy_ == kAll)
+    {
+        return pending_ == 0;
+    }
+
+    return succeeded_ + pending_ < Needed();
+}
+
+void FanOut::Complete(ErrCode ec)
+{
+    if (completed_)
+    {
+        return;
+    }
+
+    completed_ = true;
+
+    if (timeout_watcher_)
+    {
+        timeout_watcher_->Close();
+    }
+
+    if (!complete_handler_)
+    {
+        return;
+    }
+
+    try
+    {
+        complete_handler_(ec, replies_);
+    }
+    catch (...)
+    {
+        SLOG(ERROR) << "FanOut complete handler throws exception"
+            << "\ttotal=" << replies_.size();
+    }
+}
+
+} // namespace downstream
+} // namespace shs
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <tr1/functional>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+#include "downstream/err_code.h"
+#include "downstream/response.h"
+
+namespace shs
+{
+
+class TimedEventWatcher;
+
+namespace downstream
+{
+
+class Server;
+class Request;
+
+// Scatter-gather helper: issues a set of downstream requests on the
+// current worker loop and completes exactly once.
+//
+//     boost::shared_ptr<FanOut> fo(new FanOut(FanOut::kQuorum, 0, 50));
+//     fo->Add(server_a, &req_a);
+//     fo->Add(server_b, &req_b);
+//     fo->Execute(handler);
+//
+// Requests must stay alive until every reply has arrived, which may be
+// after the completion handler ran (e.g. on deadline).
+class FanOut : public boost::enable_shared_from_this<FanOut>,
+               boost::noncopyable
+{
+public:
+    enum Policy
+    {
+        kAll,       // wait for every call
+        kQuorum,    // done once more than half succeeded
+        kFirstK     // done once k calls succeeded, k >= 1
+    };
+
+    struct Reply
+    {
+        Reply()
+            : server(NULL)
+            , request(NULL)
+            , ec(E_REQUEST_TIMEOUT)
+            , done(false)
+        {}
+
+        Server* server;
+        Request* request;
+        ErrCode ec;
+        bool done;
+        boost::shared_ptr<Response> response;
+    };
+
+    typedef std::vector<Reply> Replies;
+    typedef std::tr1::function<void(ErrCode, const Replies&)> CompleteHandler;
+
+    FanOut(Policy policy = kAll, size_t k = 0, int timeout_ms = 0);
+    ~FanOut();
+
+    void Add(Server* server, Request* request);
+    void Execute(const CompleteHandler& complete_handler);
+
+    size_t size() const { return replies_.size(); }
+    size_t succeeded() const { return succeeded_; }
+    size_t failed() const { return failed_; }
+
+private:
+    void HandleResponse(size_t idx, ErrCode ec,
+        boost::shared_ptr<Response> response);
+    void HandleTimeout();
+    bool Satisfied() const;
+    bool Impossible() const;
+    size_t Needed() const;
+    void Complete(ErrCode ec);
+
+private:
+    Policy policy_;
+    size_t k_;
+    int timeout_ms_;
+    size_t pending_;
+    size_t succeeded_;
+    size_t failed_;
+    bool completed_;
+    Replies replies_;
+    CompleteHandler complete_handler_;
+    boost::scoped_ptr<TimedEventWatcher> timeout_watcher_;
+};
+
+typedef boost::shared_ptr<FanOut> FanOutPtr;
+
+} // namespace downstream
+} // namespace shs
@@ -0,0 +1,212 @@
+#include "health_checker.h"
+
+#include <string.h>
+#include <vector>
+#include <tr1/functional>
+#include <gflags/gflags.h>
+
+#include "log/logging.h"
+#include "event_watcher.h"
+#include "downstream/host.h"
+#include "downstream/server.h"
+
+namespace shs
+{
+
+DEFINE_int32(ds_health_check_interval, 0,
+    "Downstream active health check interval in ms, 0 to disable");
+DEFINE_int32(ds_health_check_timeout, 500,
+    "Downstream active health check timeout in ms");
+DEFINE_string(ds_health_check_path, "/status",
+    "Downstream active health check http path");
+
+namespace downstream
+{
+
+struct HealthChecker::ProbeContext
+{
+    HealthChecker* checker;
+    HostRef ref;
+    http_conn_t* hc;
+};
+
+HealthChecker::HealthChecker(event_base_t* event_base,
+    event_timer_t* event_timer, conn_pool_t* conn_pool)
+    : event_base_(event_base)
+    , event_timer_(event_timer)
+    , conn_pool_(conn_pool)
+    , stopped_(true)
+{
+}
+
+HealthChecker::~HealthChecker()
+{
+    Stop();
+}
+
+bool HealthChecker::Start()
+{
+    if (FLAGS_ds_health_check_interval <= 0)
+    {
+        return false;
+    }
+
+    stopped_ = false;
+    timer_.reset(new TimedEventWatcher(event_base_, event_timer_,
+        FLAGS_ds_health_check_interval,
+        std::tr1::bind(&HealthChecker::HandleTimer, this)));
+
+    return timer_->Init();
+}
+
+void HealthChecker::Stop()
+{
+    stopped_ = true;
+
+    if (timer_)
+    {
+        timer_->Close();
+    }
+}
+
+void HealthChecker::HandleTimer()
+{
+    if (stopped_)
+    {
+        return;
+    }
+
+    std::vector<HostRef> hosts;
+    HostGroupProvider::instance()->ListHosts(&hosts);
+
+    for (size_t i = 0; i < hosts.size(); i++)
+    {
+        Probe(hosts[i]);
+    }
+
+    timer_->Close();
+    timer_->Init();
+}
+
+void HealthChecker::Probe(const HostRef& ref)
+{
+    http_conn_t *hc = NULL;
+    http_req_t *req = NULL;
+    ProbeContext* ctx = NULL;
+
+    // previous probe still in flight, its timeout will report it
+    if (!probing_.insert(ref).second)
+    {
+        return;
+    }
+
+    hc = http_conn_create();
+    if (!hc)
+    {
+        goto failed;
+    }
+
+    hc->base = event_base_;
+    hc->timer = event_timer_;
+    hc->connpool = conn_pool_;
+    strncpy(hc->host, ref.ip.c_str(), sizeof(hc->host) - 1);
+    hc->port = ref.port;
+
+    hc->c = conn_pool_get_connection(hc->connpool);
+    if (!hc->c)
+    {
+        http_conn_free(hc);
+
+        goto failed;
+    }
+
+    http_conn_set_connect_timeout_ms(hc, FLAGS_ds_health_check_timeout);
+    http_conn_set_recv_timeout_ms(hc, FLAGS_ds_health_check_timeout);
+
+    req = http_request_create();
+    if (!req)
+    {
+        http_conn_free(hc);
+
+        goto failed;
+    }
+
+    ctx = new ProbeContext();
+    ctx->checker = this;
+    ctx->ref = ref;
+    ctx->hc = hc;
+
+    req->data = ctx;
+    req->cb = HealthChecker::HandleResponse;
+    req->hc = hc;
+    hc->req = req;
+
+    http_add_output_header(req, "host", ref.ip);
+    http_add_output_header(req, "Connection", "close");
+
+    if (http_make_request(req, SHS_HTTP_REQ_TYPE_GET,
+        FLAGS_ds_health_check_path, "") != SHS_OK)
+    {
+        HandleResponse(HTTP_CODE_CALLER_ERROR, NULL, ctx);
+    }
+
+    return;
+
+failed:
+    probing_.erase(ref);
+}
+
+void HealthChecker::HandleResponse(HTTP_CODE qec,
+    http_req_t* rsp, void* data)
+{
+    ProbeContext* ctx = (ProbeContext *)data;
+    bool ok = (qec == HTTP_CODE_OK && rsp && rsp->response_code == 200);
+
+    ctx->checker->HandleProbe(ctx, ok);
+
+    if (ctx->hc)
+    {
+        http_conn_free(ctx->hc);
+        ctx->hc = NULL;
+    }
+
+    delete ctx;
+}
+
+void HealthChecker::HandleProbe(ProbeContext* ctx, bool ok)
+{
+    probing_.erase(ctx->ref);
+
+    // the group may have been given back while the probe was out
+    HostGroupProvider::instance()->WithHost(ctx->ref, 
+        std::tr1::bind(&HealthChecker::ReportProbe, 
+            std::tr1::placeholders::_1, std::tr1::placeholders::_2, ok));
+}
+
+void HealthChecker::ReportProbe(Server* server, Host* host, bool ok)
+{
+    if (ok)
+    {
+        if (!host->IsOnline())
+        {
+            SLOG(ERROR) << "HealthChecker: host(" << host->ip_port()
+                << ") is back online";
+        }
+
+        host->SetOnline();
+
+        return;
+    }
+
+    bool online = host->IsOnline();
+    host->UpdateStats(Host::kStatusFail, server);
+    if (online && !host->IsOnline())
+    {
+        SLOG(ERROR) << "HealthChecker: host(" << host->ip_port()
+            << ") is marked offline"
+            << "\tpath=" << FLAGS_ds_health_check_path;
+    }
+}
+
+} // namespace downstream
+} // namespace shs
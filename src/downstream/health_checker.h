@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <set>
+#include <string>
+#include <boost/scoped_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "core/shs_epoll.h"
+#include "core/shs_conn_pool.h"
+#include "core/shs_event_timer.h"
+#include "http/http.h"
+#include "downstream/host.h"
+
+namespace shs
+{
+
+class TimedEventWatcher;
+
+namespace downstream
+{
+
+// Periodically probes every host of the shared host groups with an HTTP
+// GET and flips Host::SetOnline/kStatusFail, so that SelectHost skips
+// dead hosts without burning live requests on them. Meant to run in the
+// monitor process. Probes run outside the group lock and only report to
+// hosts whose group is still the one they were sent for.
+class HealthChecker : boost::noncopyable
+{
+public:
+    HealthChecker(event_base_t* event_base, event_timer_t* event_timer,
+        conn_pool_t* conn_pool);
+    ~HealthChecker();
+
+    bool Start();
+    void Stop();
+
+private:
+    struct ProbeContext;
+
+    typedef HostGroupProvider::HostRef HostRef;
+
+    void HandleTimer();
+    void Probe(const HostRef& ref);
+    void HandleProbe(ProbeContext* ctx, bool ok);
+    static void ReportProbe(Server* server, Host* host, bool ok);
+    static void HandleResponse(HTTP_CODE qec, http_req_t* rsp, void* data);
+
+    event_base_t* event_base_;
+    event_timer_t* event_timer_;
+    conn_pool_t* conn_pool_;
+    std::set<HostRef> probing_;
+    boost::scoped_ptr<TimedEventWatcher> timer_;
+    bool stopped_;
+};
+
+} // namespace downstream
+} // namespace shs
@@ -1,102 +1,895 @@
 #include "host.h"
 
+#include <math.h>
+#include <errno.h>
+#include <time.h>
 #include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
 #include <pthread.h>
+#include <stdlib.h>
 #include <algorithm>
-#include <boost/interprocess/sync/scoped_lock.hpp>
-#include <boost/interprocess/anonymous_shared_memory.hpp>
 #include <gflags/gflags.h>
 
 #include "log/logging.h"
 #include "comm/macros.h"
+#include "core/shs_lock.h"
+#include "core/shs_math.h"
+#include "core/shs_shmem.h"
 #include "downstream/util.h"
 #include "downstream/server.h"
 
-typedef boost::interprocess::scoped_lock<
-    boost::interprocess::interprocess_mutex> ScopedLock;
+extern pid_t g_pid;
+extern uint32_t g_process;
+extern uint32_t g_process_generation;
+
+namespace shs 
+{
+
+DECLARE_int32(num_processes);
+DEFINE_int32(ds_host_stats_capacity, 4096,
+    "Hosts of shared downstream host groups that keep statistics");
+
+namespace downstream 
+{
+
+// Statistics of the hosts of shared groups live in the HostGroupProvider
+// region, after its Data. Each host in use owns a block: a 60 second ring
+// plus a current-second entry and the counters in every shard. A process
+// writes only the shard it claimed, which starts on a cache line of its
+// own, folds each second into the ring once it is over and sums the
+// counters of all shards when they are read.
+struct Host::StatsPool
+{
+    uint32_t capacity;
+    uint32_t shards;
+    volatile uint32_t hint;     // where the next free block is looked for
+    Host* volatile* hosts;      // [capacity], owner of each block
+    volatile pid_t* owners;     // [shards], 0 while free
+    StatsRing* rings;           // [capacity]
+    char* base;                 // [shards], entries then counters
+
+    static size_t CountersOffset(uint32_t capacity);
+    static size_t ShardSize(uint32_t capacity);
+
+    StatsBucket* Entry(uint32_t shard, uint32_t idx) const
+    {
+        return reinterpret_cast<StatsBucket*>(
+            base + shard * ShardSize(capacity)) + idx;
+    }
+
+    HostCounters* Counters(uint32_t shard, uint32_t idx) const
+    {
+        return reinterpret_cast<HostCounters*>(base 
+            + shard * ShardSize(capacity) + CountersOffset(capacity)) + idx;
+    }
+};
+
+Host::StatsPool* Host::stats_pool_ = NULL;
+
+namespace
+{
+
+// The shard this process writes, claimed on its first use; -1 has it
+// count straight into the rings.
+pid_t g_stats_shard_pid = -1;
+int g_stats_shard = -1;
+pthread_mutex_t g_stats_shard_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+size_t CacheLineAlign(size_t size)
+{
+    return SHS_MATH_ALIGNMENT(size, DEFAULT_CACHELINE_SIZE);
+}
+
+bool ProcessGone(pid_t pid)
+{
+    return kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+} // namespace
+
+size_t Host::StatsPool::CountersOffset(uint32_t capacity)
+{
+    return CacheLineAlign(sizeof(StatsBucket) * capacity);
+}
+
+size_t Host::StatsPool::ShardSize(uint32_t capacity)
+{
+    return CountersOffset(capacity) 
+        + CacheLineAlign(sizeof(HostCounters) * capacity);
+}
+
+Host::Host()
+    : port_(0)
+    , backup_(false)
+    , last_time_(0)
+    , down_start_(0)
+    , group_idx_(-1)
+    , host_idx_(-1)
+    , is_online_(true)
+    , breaker_state_(kClosed)
+    , breaker_trials_(0)
+    , breaker_successes_(0)
+    , breaker_since_(0)
+    , breaker_checked_(0)
+    , stats_idx_(-1)
+    , stats_(NULL)
+{
+    memset(ip_, 0, sizeof ip_);
+    tag_[0] = '\0';
+    bzero(&counters_, sizeof counters_);
+}
+
+void Host::Reset()
+{
+    port_ = 0;
+    backup_ = false;
+    last_time_ = 0;
+    down_start_ = 0;
+
+    group_idx_ = -1;
+    host_idx_ = -1;
+
+    memset(ip_, 0, sizeof ip_);
+    tag_[0] = '\0';
+
+    is_online_ = true;
+
+    bzero(&counters_, sizeof counters_);
+
+    breaker_state_ = kClosed;
+    breaker_trials_ = 0;
+    breaker_successes_ = 0;
+    breaker_since_ = 0;
+    breaker_checked_ = 0;
+
+    DetachStats();
+}
+
+void Host::Init(const std::string& ip, uint16_t port, bool backup)
+{
+    strncpy(ip_, ip.c_str(), sizeof ip_);
+    ip_[sizeof(ip_)-1] = '\0';
+    port_ = port;
+    backup_ = backup;
+}
+
+size_t Host::StatsPoolSize()
+{
+    size_t capacity = FLAGS_ds_host_stats_capacity > 0 
+        ? FLAGS_ds_host_stats_capacity : 0;
+    // every process of this and the next generation, the monitor included
+    size_t shards = 2 * (FLAGS_num_processes + 1);
+
+    return CacheLineAlign(sizeof(StatsPool))
+        + CacheLineAlign(sizeof(Host*) * capacity)
+        + CacheLineAlign(sizeof(pid_t) * shards)
+        + CacheLineAlign(sizeof(StatsRing) * capacity)
+        + StatsPool::ShardSize(capacity) * shards;
+}
+
+void Host::InitStatsPool(void* mem, size_t size)
+{
+    StatsPool* pool = static_cast<StatsPool*>(mem);
+    char* p = static_cast<char*>(mem) + CacheLineAlign(sizeof(StatsPool));
+
+    if (size < StatsPoolSize())
+    {
+        return;
+    }
+
+    pool->capacity = FLAGS_ds_host_stats_capacity > 0 
+        ? FLAGS_ds_host_stats_capacity : 0;
+    pool->shards = 2 * (FLAGS_num_processes + 1);
+    pool->hint = 0;
+
+    // the region is fresh from mmap, so all of it reads zero already
+    pool->hosts = reinterpret_cast<Host* volatile*>(p);
+    p += CacheLineAlign(sizeof(Host*) * pool->capacity);
+    pool->owners = reinterpret_cast<volatile pid_t*>(p);
+    p += CacheLineAlign(sizeof(pid_t) * pool->shards);
+    pool->rings = reinterpret_cast<StatsRing*>(p);
+    p += CacheLineAlign(sizeof(StatsRing) * pool->capacity);
+    pool->base = p;
+
+    stats_pool_ = pool;
+}
+
+void Host::AttachStats(bool shared)
+{
+    StatsPool* pool = stats_pool_;
+
+    DetachStats();
+
+    if (!shared || NULL == pool)
+    {
+        stats_ = new StatsRing();
+        bzero(stats_, sizeof(StatsRing));
+
+        return;
+    }
+
+    for (uint32_t i = 0; i < pool->capacity; i++)
+    {
+        uint32_t idx = (pool->hint + i) % pool->capacity;
+        if (pool->hosts[idx] != NULL || !CAS(&pool->hosts[idx], (Host*)NULL, this))
+        {
+            continue;
+        }
+
+        pool->hint = idx + 1;
+
+        bzero(&pool->rings[idx], sizeof(StatsRing));
+        for (uint32_t shard = 0; shard < pool->shards; shard++)
+        {
+            bzero(pool->Entry(shard, idx), sizeof(StatsBucket));
+            bzero(pool->Counters(shard, idx), sizeof(HostCounters));
+        }
+
+        stats_idx_ = idx;
+        stats_ = &pool->rings[idx];
+
+        return;
+    }
+
+    SLOG(ERROR) << "Host::AttachStats: host(" << ip_ << ":" << port_ 
+        << ") keeps no statistics, all " << pool->capacity 
+        << " blocks are in use, raise --ds_host_stats_capacity";
+}
+
+void Host::DetachStats()
+{
+    if (stats_idx_ >= 0)
+    {
+        stats_pool_->hosts[stats_idx_] = NULL;
+    }
+    else if (stats_)
+    {
+        delete stats_;
+    }
+
+    stats_idx_ = -1;
+    stats_ = NULL;
+}
+
+int Host::ProcessShard()
+{
+    StatsPool* pool = stats_pool_;
+
+    if (g_stats_shard_pid == g_pid)
+    {
+        return g_stats_shard;
+    }
+
+    pthread_mutex_lock(&g_stats_shard_mutex);
+
+    if (g_stats_shard_pid != g_pid)
+    {
+        // forked processes start over with a shard of their own
+        pid_t self = getpid();
+        int shard = -1;
+
+        ReclaimStatsShards();
+
+        for (uint32_t i = 0; pool && i < pool->shards; i++)
+        {
+            if (0 == pool->owners[i] && CAS(&pool->owners[i], 0, self))
+            {
+                shard = i;
+                break;
+            }
+        }
+
+        if (pool && shard < 0)
+        {
+            SLOG(ERROR) << "Host::ProcessShard: all " << pool->shards 
+                << " shards are taken, counting into the shared rings";
+        }
+
+        g_stats_shard = shard;
+        __sync_synchronize();
+        g_stats_shard_pid = g_pid;
+    }
+
+    pthread_mutex_unlock(&g_stats_shard_mutex);
+
+    return g_stats_shard;
+}
+
+void Host::ReclaimStatsShards()
+{
+    StatsPool* pool = stats_pool_;
+
+    for (uint32_t i = 0; pool && i < pool->shards; i++)
+    {
+        pid_t owner = pool->owners[i];
+        if (owner > 0 && ProcessGone(owner) && CAS(&pool->owners[i], owner, -1))
+        {
+            ReclaimShard(i);
+            pool->owners[i] = 0;
+        }
+    }
+}
+
+// Nobody writes the shard any more: what its entries counted goes to the
+// rings and the shard starts over, which also drops the requests its
+// process left in flight.
+void Host::ReclaimShard(int shard)
+{
+    StatsPool* pool = stats_pool_;
+
+    for (uint32_t idx = 0; idx < pool->capacity; idx++)
+    {
+        StatsBucket* entry = pool->Entry(shard, idx);
+        Host* host = pool->hosts[idx];
+
+        if (host && entry->sec && !(entry->sec & kStatsRotating))
+        {
+            host->Fold(*entry);
+        }
+
+        bzero(entry, sizeof(StatsBucket));
+        bzero(pool->Counters(shard, idx), sizeof(HostCounters));
+    }
+}
+
+// Returns b once it counts second sec, moving it on from an older second
+// first. The tag reads kStatsRotating | sec while the counters are cleared,
+// so nothing is added in between, and *done, when given, gets what the
+// bucket counted before. NULL when b already counts a later second or
+// another writer is still moving it on; one that stalled for two seconds
+// is taken to have died and is taken over.
+Host::StatsBucket* Host::Advance(StatsBucket* b, uint32_t sec, 
+    StatsBucket* done)
+{
+    for (int i = 0; i < kStatsSpins; i++)
+    {
+        uint32_t cur = b->sec;
+        if (cur == sec)
+        {
+            return b;
+        }
+
+        if (cur & kStatsRotating)
+        {
+            if ((cur & ~kStatsRotating) + 2 > sec)
+            {
+                sched_yield();
+                continue;
+            }
+        }
+        else if (cur > sec)
+        {
+            return NULL;
+        }
+
+        if (!CAS(&b->sec, cur, kStatsRotating | sec))
+        {
+            continue;
+        }
+
+        StatsBucket old;
+        old.sec = (cur & kStatsRotating) ? 0 : cur;
+        old.num_req = __sync_lock_test_and_set(&b->num_req, 0);
+        old.num_rsp = __sync_lock_test_and_set(&b->num_rsp, 0);
+        old.num_retry = __sync_lock_test_and_set(&b->num_retry, 0);
+        old.num_fail = __sync_lock_test_and_set(&b->num_fail, 0);
+        old.delay = __sync_lock_test_and_set(&b->delay, 0);
+
+        CAS(&b->sec, kStatsRotating | sec, sec);
+
+        if (done)
+        {
+            *done = old;
+        }
+
+        return b;
+    }
+
+    return NULL;
+}
+
+// Adds a finished second to the ring, unless it is too old to be kept.
+void Host::Fold(const StatsBucket& done)
+{
+    uint32_t now = time(NULL);
+
+    if (0 == done.sec || NULL == stats_ || now - done.sec >= kStatsSeconds)
+    {
+        return;
+    }
+
+    StatsBucket* to = Advance(&stats_->buckets[done.sec % kStatsSeconds], 
+        done.sec, NULL);
+    if (NULL == to)
+    {
+        return;
+    }
+
+    __sync_fetch_and_add(&to->num_req, done.num_req);
+    __sync_fetch_and_add(&to->num_rsp, done.num_rsp);
+    __sync_fetch_and_add(&to->num_retry, done.num_retry);
+    __sync_fetch_and_add(&to->num_fail, done.num_fail);
+    __sync_fetch_and_add(&to->delay, done.delay);
+}
+
+// This process's entry for the host, NULL without a shard or a block.
+Host::StatsBucket* Host::ShardEntry()
+{
+    int shard = stats_idx_ >= 0 ? ProcessShard() : -1;
+
+    if (shard < 0)
+    {
+        return NULL;
+    }
+
+    return stats_pool_->Entry(shard, stats_idx_);
+}
+
+// This process's counters for the host, the host's own without a shard.
+Host::HostCounters* Host::OwnCounters()
+{
+    int shard = stats_idx_ >= 0 ? ProcessShard() : -1;
+
+    if (shard < 0)
+    {
+        return &counters_;
+    }
+
+    return stats_pool_->Counters(shard, stats_idx_);
+}
+
+uint32_t Host::NumShards() const
+{
+    return stats_idx_ >= 0 ? stats_pool_->shards : 0;
+}
+
+// NULL when no process writes the shard.
+Host::HostCounters* Host::ShardCounters(uint32_t shard) const
+{
+    if (stats_pool_->owners[shard] <= 0)
+    {
+        return NULL;
+    }
+
+    return stats_pool_->Counters(shard, stats_idx_);
+}
+
+int64_t Host::LastSuccess() const
+{
+    int64_t last = counters_.ok_time;
+
+    for (uint32_t i = 0; i < NumShards(); i++)
+    {
+        HostCounters* c = ShardCounters(i);
+        if (c && c->ok_time > last)
+        {
+            last = c->ok_time;
+        }
+    }
+
+    return last;
+}
+
+Host::Totals Host::Sum() const
+{
+    Totals totals;
+    bzero(&totals, sizeof totals);
+
+    int64_t last_ok = LastSuccess();
+    uint32_t shards = NumShards();
+
+    for (uint32_t i = 0; i <= shards; i++)
+    {
+        const HostCounters* c = i < shards ? ShardCounters(i) : &counters_;
+        if (NULL == c)
+        {
+            continue;
+        }
+
+        totals.inflight += c->inflight;
+        totals.status_fail_num += c->status_fail_num;
+        totals.delay_num += c->delay_num;
+        totals.delay_sum += c->delay_sum;
+
+        if (c->fail_since > last_ok)
+        {
+            totals.fail_num += c->fail_num;
+        }
+    }
+
+    return totals;
+}
+
+uint32_t Host::inflight() const
+{
+    return Sum().inflight;
+}
+
+uint32_t Host::fail_num() const
+{
+    return Sum().fail_num;
+}
+
+uint32_t Host::ewma_delay() const
+{
+    Totals totals = Sum();
+
+    return totals.delay_num > 0 ? totals.delay_sum / totals.delay_num : 0;
+}
+
+Host::StatsBucket* Host::CurrentBucket(uint32_t sec)
+{
+    StatsBucket* entry = ShardEntry();
+
+    if (NULL == stats_)
+    {
+        return NULL;
+    }
+
+    if (NULL == entry)
+    {
+        return Advance(&stats_->buckets[sec % kStatsSeconds], sec, NULL);
+    }
+
+    if (entry->sec == sec)
+    {
+        return entry;
+    }
+
+    StatsBucket done;
+    done.sec = 0;
+    StatsBucket* bucket = Advance(entry, sec, &done);
+    Fold(done);
+
+    // a writer whose clock lags a little counts into the newer second
+    if (NULL == bucket && !(entry->sec & kStatsRotating))
+    {
+        bucket = entry;
+    }
+
+    return bucket;
+}
+
+void Host::IncInflight()
+{
+    __sync_fetch_and_add(&OwnCounters()->inflight, 1);
+}
+
+void Host::DecInflight()
+{
+    __sync_fetch_and_sub(&OwnCounters()->inflight, 1);
+}
+
+void Host::AddRequest(bool retry)
+{
+    StatsBucket* bucket = CurrentBucket(time(NULL));
+    if (NULL == bucket)
+    {
+        return;
+    }
+
+    __sync_fetch_and_add(&bucket->num_req, 1);
+    if (retry)
+    {
+        __sync_fetch_and_add(&bucket->num_retry, 1);
+    }
+}
+
+// Counts b when it holds a second within [since, now] and was not moved
+// on while being read.
+void Host::Sample(const StatsBucket& b, uint32_t since, uint32_t now,
+    Stats* stats)
+{
+    uint32_t sec = b.sec;
+    if ((sec & kStatsRotating) || sec < since || sec > now)
+    {
+        return;
+    }
+
+    Stats s;
+    s.num_req = b.num_req;
+    s.num_rsp = b.num_rsp;
+    s.num_retry = b.num_retry;
+    s.num_fail = b.num_fail;
+    s.delay = b.delay;
+
+    __sync_synchronize();
+    if (b.sec != sec)
+    {
+        return;
+    }
+
+    stats->num_req += s.num_req;
+    stats->num_rsp += s.num_rsp;
+    stats->num_retry += s.num_retry;
+    stats->num_fail += s.num_fail;
+    stats->delay += s.delay;
+}
+
+Host::Stats Host::GetStats(int seconds) const
+{
+    Stats stats;
+    uint32_t now = time(NULL);
+
+    if (seconds <= 0 || NULL == stats_)
+    {
+        return stats;
+    }
+
+    if (seconds > kStatsSeconds)
+    {
+        seconds = kStatsSeconds;
+    }
+
+    uint32_t since = now - seconds + 1;
+
+    if (stats_idx_ >= 0)
+    {
+        StatsPool* pool = stats_pool_;
+        for (uint32_t i = 0; i < pool->shards; i++)
+        {
+            if (pool->owners[i] != 0)
+            {
+                Sample(*pool->Entry(i, stats_idx_), since, now, &stats);
+            }
+        }
+    }
+
+    for (int i = 0; i < kStatsSeconds; i++)
+    {
+        Sample(stats_->buckets[i], since, now, &stats);
+    }
+
+    return stats;
+}
+
+// Everything but the breaker goes to this process's shard; the host
+// itself is only read unless it changes state.
+void Host::UpdateStats(Result result, Server* server, int64_t delay_us)
+{
+    int64_t now = Timestamp::Now().MicroSecondsSinceEpoch();
+    uint32_t sec = now / Timestamp::kMicroSecondsPerSecond;
+    HostCounters* counters = OwnCounters();
+
+    if (delay_us >= 0)
+    {
+        StatsBucket* bucket = CurrentBucket(sec);
+        if (bucket)
+        {
+            __sync_fetch_and_add(&bucket->num_rsp, 1);
+            __sync_fetch_and_add(&bucket->delay, delay_us);
+        }
+
+        uint32_t num = __sync_add_and_fetch(&counters->delay_num, 1);
+        __sync_fetch_and_add(&counters->delay_sum, delay_us);
+        if (num >= 2 * kDelaySamples 
+            && CAS(&counters->delay_num, num, num / 2))
+        {
+            __sync_fetch_and_sub(&counters->delay_sum, 
+                counters->delay_sum / 2);
+        }
+    }
+
+    if (result == kFail)
+    {
+        if (NULL == server || server->option().max_fails > 0)
+        {
+            // a run some process saw a success after starts over
+            int64_t since = counters->fail_since;
+            if (since <= LastSuccess() 
+                && CAS(&counters->fail_since, since, now))
+            {
+                counters->fail_num = 0;
+            }
 
-extern uint32_t g_process;
-extern uint32_t g_process_generation;
+            __sync_fetch_and_add(&counters->fail_num, 1);
+        }
 
-namespace shs 
-{
+        StatsBucket* bucket = CurrentBucket(sec);
+        if (bucket)
+        {
+            __sync_fetch_and_add(&bucket->num_fail, 1);
+        }
+    }
+    else if (result == kOk)
+    {
+        if (counters->ok_time < now)
+        {
+            counters->ok_time = now;
+        }
 
-DECLARE_int32(num_processes);
+        // healthy hosts only ever read this line
+        if (down_start_ != 0)
+        {
+            down_start_ = 0;
+        }
+    }
+    else if (result == kStatusFail)
+    {
+        __sync_fetch_and_add(&counters->status_fail_num, 1);
+        if (is_online_ && Sum().status_fail_num >= 3)
+        {
+            is_online_ = false;
+        }
+    }
 
-namespace downstream 
-{
+    if (server && (result == kFail || delay_us >= 0))
+    {
+        CheckBreaker(server, now);
+    }
+}
 
-Host::Host()
-    : port_(0)
-    , backup_(false)
-    , fail_num_(0)
-    , status_fail_num_(0)
-    , group_idx_(-1)
-    , host_idx_(-1)
-    , is_online_(true)
-    , last_idx_(0)
+// Judges the window at most once a second: the first response of a second
+// to take breaker_checked_ does it for every process.
+void Host::CheckBreaker(Server* server, int64_t now)
 {
-    memset(ip_, 0, sizeof ip_);
-    tag_[0] = '\0';
-    bzero(&history_stats_, sizeof history_stats_);
+    const Server::Option& option = server->option();
+    if (0 == option.breaker_error_rate || breaker_state_ != kClosed)
+    {
+        return;
+    }
+
+    uint32_t sec = now / Timestamp::kMicroSecondsPerSecond;
+    uint32_t checked = breaker_checked_;
+    if (checked == sec || !CAS(&breaker_checked_, checked, sec))
+    {
+        return;
+    }
+
+    // only judge what happened since the breaker last closed
+    int64_t since = (now - breaker_since_) / Timestamp::kMicroSecondsPerSecond;
+    int window = option.breaker_window;
+    if (since + 1 < window)
+    {
+        window = since + 1;
+    }
+
+    Stats stats = GetStats(window);
+    if (stats.num_rsp < option.breaker_min_requests)
+    {
+        return;
+    }
+
+    if (stats.num_fail * 100 >= 
+        (uint64_t)option.breaker_error_rate * stats.num_rsp)
+    {
+        OpenBreaker(kClosed, "error rate");
+    }
+    else if (option.breaker_latency > 0 && stats.delay / stats.num_rsp 
+        >= option.breaker_latency * 1000)
+    {
+        OpenBreaker(kClosed, "latency");
+    }
 }
 
-void Host::Reset()
+// Only the caller that opens the breaker starts the open period, so a
+// second failing probe doesn't extend it.
+void Host::OpenBreaker(uint32_t from, const char* reason)
 {
-    port_ = 0;
-    backup_ = false;
-    fail_num_ = 0;
-    status_fail_num_ = 0;
-    last_time_ = Timestamp();
-    down_start_ = Timestamp();
-
-    group_idx_ = -1;
-    host_idx_ = -1;
+    if (!CAS(&breaker_state_, from, kOpen))
+    {
+        return;
+    }
 
-    memset(ip_, 0, sizeof ip_);
-    tag_[0] = '\0';
+    uint32_t episode = ((breaker_trials_ >> 16) + 1) & 0xffff;
+    if (0 == episode)
+    {
+        episode = 1;
+    }
 
-    is_online_ = true;
+    breaker_since_ = Timestamp::Now().MicroSecondsSinceEpoch();
+    breaker_successes_ = episode << 16;
+    breaker_trials_ = episode << 16;
 
-    bzero(&history_stats_, sizeof history_stats_);
-    last_idx_ = 0;
+    SLOG(ERROR) << "Host::OpenBreaker: host(" << ip_ << ":" << port_ 
+        << ") circuit opened, reason: " << reason;
 }
 
-void Host::Init(const std::string& ip, uint16_t port, bool backup)
+// Adds delta to the count of *counter while it belongs to episode trial,
+// never taking it below 0; false once the episode is over.
+bool Host::CountTrial(volatile uint32_t* counter, uint32_t trial, int delta,
+    uint32_t* count)
 {
-    strncpy(ip_, ip.c_str(), sizeof ip_);
-    ip_[sizeof(ip_)-1] = '\0';
-    port_ = port;
-    backup_ = backup;
+    uint32_t cur, next;
+    do
+    {
+        cur = *counter;
+        if (cur >> 16 != trial || (delta < 0 && 0 == (cur & 0xffff)))
+        {
+            return false;
+        }
+
+        next = cur + delta;
+    } while (!CAS(counter, cur, next));
+
+    *count = next & 0xffff;
+
+    return true;
 }
 
-void Host::UpdateStats(Result result, Server* server)
+bool Host::AllowRequest(Server* server, uint32_t* trial)
 {
-    ScopedLock lock(mutex_);
+    *trial = 0;
 
-    if (result == kFail)
+    const Server::Option& option = server->option();
+    if (0 == option.breaker_error_rate)
     {
-        ++fail_num_;
+        return true;
     }
-    else if (result == kOk)
+
+    uint32_t state = breaker_state_;
+    if (state == kClosed)
     {
-        fail_num_ = 0;
-        down_start_ = Timestamp();
+        return true;
     }
-    else if (result == kStatusFail)
+
+    if (state == kOpen)
     {
-        ++status_fail_num_;
-        if (status_fail_num_ >= 3)
+        int64_t now = Timestamp::Now().MicroSecondsSinceEpoch();
+        if (now - breaker_since_ < option.breaker_open_time * 1000LL)
         {
-            is_online_ = false;
+            return false;
+        }
+
+        if (CAS(&breaker_state_, kOpen, kHalfOpen))
+        {
+            breaker_since_ = now;
+        }
+    }
+
+    uint32_t trials;
+    do
+    {
+        trials = breaker_trials_;
+        if ((trials & 0xffff) >= option.breaker_half_open_trials)
+        {
+            return false;
         }
+    } while (!CAS(&breaker_trials_, trials, trials + 1));
+
+    *trial = trials >> 16;
+
+    return true;
+}
+
+void Host::EndTrial(Server* server, uint32_t trial, bool ok)
+{
+    uint32_t count;
+    if (breaker_state_ != kHalfOpen 
+        || !CountTrial(&breaker_trials_, trial, -1, &count))
+    {
+        return;
+    }
+
+    if (!ok)
+    {
+        OpenBreaker(kHalfOpen, "half-open probe failed");
+
+        return;
+    }
+
+    if (CountTrial(&breaker_successes_, trial, 1, &count)
+        && count >= server->option().breaker_half_open_trials
+        && CAS(&breaker_state_, kHalfOpen, kClosed))
+    {
+        breaker_since_ = Timestamp::Now().MicroSecondsSinceEpoch();
+
+        SLOG(ERROR) << "Host::EndTrial: host(" << ip_ << ":" << port_ 
+            << ") circuit closed";
     }
 }
 
-bool Host::CheckAlive(Server* server, bool strict, bool do_skip)
+// Frees the probe's slot without judging the host.
+void Host::ReleaseTrial(uint32_t trial)
 {
-    ScopedLock lock(mutex_);
+    uint32_t count;
+    CountTrial(&breaker_trials_, trial, -1, &count);
+}
 
+bool Host::CheckAlive(Server* server, bool strict, bool do_skip)
+{
     Timestamp now(Timestamp::Now());
     bool healthy = IsHealthy(server, strict, do_skip);
     if (!healthy)
@@ -104,20 +897,21 @@ bool Host::CheckAlive(Server* server, bool strict, bool do_skip)
         SLOG(ERROR)<< "Host::CheckAlive: host(" << ip_ << ":" 
             << port_ << ") is not alive. params: "
             << strict << " " << do_skip << " "
-            << is_online_ << ":" << status_fail_num_ << " "
-            << last_time_.MicroSecondsSinceEpoch()/1000 << " "
+            << is_online_ << ":" << Sum().status_fail_num << " "
+            << last_time_/1000 << " "
             << now.MicroSecondsSinceEpoch()/1000 << " "
-            << TimeDifference(now, last_time_)/1000;
-        if (!down_start_.Valid())
+            << (now.MicroSecondsSinceEpoch() - last_time_)/1000;
+
+        if (0 == down_start_)
         {
-            down_start_ = now;
+            CAS(&down_start_, 0, now.MicroSecondsSinceEpoch());
         }
     }
     else
     {
         if (do_skip)
         {
-            last_time_ = now;
+            last_time_ = now.MicroSecondsSinceEpoch();
         }
     }
 
@@ -131,17 +925,19 @@ bool Host::IsHealthy(Server* server, bool strict, bool do_skip)
         return false;
     }
 
-    if (0 == fail_num_)
+    uint32_t fail_num = this->fail_num();
+    if (0 == fail_num)
     {
         return true;
     }
 
-    if (!strict && fail_num_ < 3)
+    if (!strict && fail_num < (server ? server->option().max_fails : 3))
     {
         return true;
     }
 
-    if (last_time_.Valid() && Timestamp::Now() > AddTime(last_time_, 0))
+    int64_t last_time = last_time_;
+    if (last_time > 0 && Timestamp::Now() > Timestamp(last_time))
     {
         return true;
     }
@@ -156,12 +952,12 @@ const std::string Host::State(Server* server) const
         return "down";
     }
 
-    if (fail_num_ < 3)
+    if (fail_num() < (server ? server->option().max_fails : 3))
     {
         return "up";
     }
 
-    if (down_start_.Valid())
+    if (down_start_ > 0)
     {
         return "down";
     }
@@ -189,19 +985,26 @@ void Host::gen_tag()
 
 void Host::SetOnline()
 {
-    ScopedLock lock(mutex_);
+    counters_.status_fail_num = 0;
+    for (uint32_t i = 0; i < NumShards(); i++)
+    {
+        HostCounters* c = ShardCounters(i);
+        if (c)
+        {
+            c->status_fail_num = 0;
+        }
+    }
+
     is_online_ = true;
 }
 
 void Host::SetOffline()
 {
-    ScopedLock lock(mutex_);
     is_online_ = false;
 }
 
 bool Host::IsOnline() const
 {
-    ScopedLock lock(mutex_);
     return is_online_;
 }
 
@@ -225,6 +1028,7 @@ void HostGroupData::Reset()
 
     ref_cnt = 0;
     generation = 0;
+    serial++;
 }
 
 Host* HostGroupData::AddMaster()
@@ -235,6 +1039,7 @@ Host* HostGroupData::AddMaster()
     }
 
     master_hosts[master_hosts_cnt].set_host_idx(master_hosts_cnt);
+    master_hosts[master_hosts_cnt].AttachStats(index != -1);
 
     return &master_hosts[master_hosts_cnt++];
 }
@@ -247,6 +1052,7 @@ Host* HostGroupData::AddSlave()
     }
 
     slave_hosts[slave_hosts_cnt].set_host_idx(slave_hosts_cnt);
+    slave_hosts[slave_hosts_cnt].AttachStats(index != -1);
 
     return &slave_hosts[slave_hosts_cnt++];
 }
@@ -320,150 +1126,253 @@ void HostGroup::AddSlaveServer(const std::vector<std::string>& ips,
     }
 }
 
-int HostGroup::GetPos(size_t hash)
+void HostGroup::HashInit()
 {
-    int pos = virtual_node_set_.size();
-    for (unsigned int i = 0; i < virtual_node_set_.size(); i++)
+    // Maglev: every master fills the table following its own permutation
+    // (offset, skip), so each owns ~M/N slots and membership changes move
+    // few of them. Lookup is then a single index.
+    uint16_t cnt = data_->master_hosts_cnt;
+    lookup_.clear();
+
+    if (0 == cnt)
     {
-        VirtualNode& virtual_node = virtual_node_set_[i];
-        if (hash < virtual_node.hash_offset)
-        {
-            pos = i;
+        return;
+    }
 
-            break;
-        }
+    size_t size = cnt * kLookupFactor;
+    if (size > kMaxLookupSize)
+    {
+        size = kMaxLookupSize;
     }
 
-    return pos;
-}
+    size = shs_math_find_prime(size);
 
-void HostGroup::HashInit()
-{
-    virtual_node_set_.clear();
+    std::vector<uint32_t> offset(cnt);
+    std::vector<uint32_t> skip(cnt);
+    std::vector<uint32_t> next(cnt, 0);
 
-    for (unsigned int idx = 0; idx < data_->master_hosts_cnt; idx++)
+    for (uint16_t idx = 0; idx < cnt; idx++)
     {
         auto& host = data_->master_hosts[idx];
+        std::string str(host.ip() + "_" + std::to_string(host.port()));
+        std::string str2(str + "_skip");
 
-        for (int i = 0; i < 200; i++)
+        offset[idx] = CalcHash(str.c_str(), str.size()) % size;
+        skip[idx] = CalcHash(str2.c_str(), str2.size()) % (size - 1) + 1;
+    }
+
+    lookup_.assign(size, -1);
+
+    size_t filled = 0;
+    while (filled < size)
+    {
+        for (uint16_t idx = 0; idx < cnt && filled < size; idx++)
         {
-            std::string str(host.ip() + "_" + std::to_string(host.port()) 
-                + "_" + std::to_string(i));
-            auto hash = CalcHash(str.c_str(), str.size());
-            VirtualNode virtual_node;
-            virtual_node.idx = idx;
-            virtual_node.hash_offset = hash;
-            int pos = GetPos(hash);
-            virtual_node_set_.insert(virtual_node_set_.begin()+pos, virtual_node);
+            size_t pos = 0;
+            do
+            {
+                pos = (offset[idx] + (uint64_t)next[idx] * skip[idx]) % size;
+                next[idx]++;
+            } while (lookup_[pos] >= 0);
+
+            lookup_[pos] = idx;
+            filled++;
         }
     }
+}
+
+int HostGroup::GetHashIdx(size_t hash) const
+{
+    return hash % lookup_.size();
+}
+
+Host* HostGroup::SelectHost(size_t hash, HostSet& history_hosts, 
+    int retry_cnt)
+{
+    Host* host = NULL;
+    Server::Balance balance = server_ ? server_->option().balance 
+        : Server::kConsistentHash;
+
+    switch (balance)
+    {
+    case Server::kLeastRequest:
+        host = LeastRequest(history_hosts);
+        break;
+    case Server::kBoundedLoadHash:
+        host = BoundedLoad(hash, history_hosts);
+        break;
+    case Server::kConsistentHash:
+    default:
+        host = Master(hash, history_hosts);
+        break;
+    }
 
-    uint32_t avg = virtual_node_set_.back().hash_offset/virtual_node_set_.size();
-    for (uint32_t l = 0; l < virtual_node_set_.size(); l++)
+    if (!host)
     {
-        virtual_node_set_[l].hash_offset = avg * (l + 1);
+        return Slave(hash, retry_cnt);
     }
+
+    return host;
 }
 
-int HostGroup::GetHashIdx(int start, int end, size_t hash)
+Host* HostGroup::Master(size_t hash, HostSet& history_hosts)
 {
-    int middle = (start+end) / 2;
+    if (lookup_.empty())
+    {
+        SLOG(ERROR) << "SelectHost fail, lookup table is empty";
+
+        return NULL;
+    }
 
-    VirtualNode& virtual_node = virtual_node_set_[middle];
+    int idx = GetHashIdx(hash);
+    int host_idx = lookup_[idx];
+    if (!history_hosts.test(host_idx) 
+        && data_->master_hosts[host_idx].IsOnline()) 
+    {
+        history_hosts.set(host_idx);
+
+        return data_->GetMaster(host_idx);
+    }
 
-    if (hash == virtual_node.hash_offset)
+    if (history_hosts.count() >= data_->master_hosts_cnt)
     {
-        return middle;
+        return NULL;
     }
 
-    if (hash < virtual_node.hash_offset)
+    for (size_t i = 0; i < lookup_.size(); i++)
     {
-        if ((middle == start) 
-            || (hash > virtual_node_set_[middle - 1].hash_offset))
+        idx = (idx + 1) % lookup_.size();
+        host_idx = lookup_[idx];
+        if (history_hosts.test(host_idx) 
+            || !data_->master_hosts[host_idx].IsOnline())
         {
-            return middle;
+            continue;
         }
-        
-        return GetHashIdx(start, middle - 1, hash);
 
-    }
+        history_hosts.set(host_idx);
 
-    if ((middle == start) || (hash < virtual_node_set_[middle + 1].hash_offset))
-    {
-        return (middle + 1);
+        return data_->GetMaster(host_idx);
     }
 
-    return GetHashIdx(middle + 1, end, hash);
+    return NULL;
 }
 
-Host* HostGroup::SelectHost(size_t hash, std::set<int>& history_hosts, 
-    int retry_cnt)
+namespace
 {
-    Host* host = Master(hash, history_hosts);
-    if (!host)
+
+__thread unsigned int t_seed = 0;
+
+int PickRandom(HostGroupData* data, const HostSet& skip, int exclude)
+{
+    uint16_t cnt = data->master_hosts_cnt;
+    if (0 == t_seed)
     {
-        return Slave(hash, retry_cnt);
+        t_seed = time(NULL) ^ getpid() ^ (unsigned int)pthread_self();
     }
 
-    return host;
+    int start = rand_r(&t_seed) % cnt;
+    for (int i = 0; i < cnt; i++)
+    {
+        int idx = (start + i) % cnt;
+        if (idx != exclude && !skip.test(idx) 
+            && data->master_hosts[idx].IsOnline())
+        {
+            return idx;
+        }
+    }
+
+    return -1;
 }
 
-Host* HostGroup::Master(size_t hash, std::set<int>& history_hosts)
+uint64_t HostCost(const Host* host)
 {
-    std::set<int> fail_hosts = history_hosts;
-    if (virtual_node_set_.empty())
-    {
-        SLOG(ERROR) << "SelectHost fail, virtual_node_set_ is empty";
+    uint64_t delay = host->ewma_delay() > 0 ? host->ewma_delay() : 1;
+
+    return (host->inflight() + 1) * delay;
+}
 
+} // namespace
+
+Host* HostGroup::LeastRequest(HostSet& history_hosts)
+{
+    uint16_t cnt = data_->master_hosts_cnt;
+    if (0 == cnt)
+    {
         return NULL;
     }
 
-    int idx = GetHashIdx(0, virtual_node_set_.size(), hash) 
-        % virtual_node_set_.size();
-    if (idx < 0)
+    int first = PickRandom(data_, history_hosts, -1);
+    if (first < 0)
     {
-        SLOG(ERROR) << "SelectHost fail, invalid virtual node idx";
-
         return NULL;
     }
 
-    int host_idx = virtual_node_set_[idx].idx;
-    Host* host = data_->GetMaster(host_idx);
-    if (!host)
+    int chosen = first;
+    int second = PickRandom(data_, history_hosts, first);
+    if (second >= 0)
     {
-        return NULL;
+        Host* a = data_->GetMaster(first);
+        Host* b = data_->GetMaster(second);
+        uint32_t max_fails = server_->option().max_fails;
+        bool a_failing = max_fails > 0 && a->fail_num() >= max_fails;
+        bool b_failing = max_fails > 0 && b->fail_num() >= max_fails;
+
+        if (a_failing != b_failing)
+        {
+            chosen = a_failing ? second : first;
+        }
+        else if (HostCost(b) < HostCost(a))
+        {
+            chosen = second;
+        }
     }
 
-    if (fail_hosts.find(host_idx) == fail_hosts.end()) 
+    history_hosts.set(chosen);
+
+    return data_->GetMaster(chosen);
+}
+
+Host* HostGroup::BoundedLoad(size_t hash, HostSet& history_hosts)
+{
+    uint16_t cnt = data_->master_hosts_cnt;
+    if (0 == cnt || lookup_.empty())
     {
-        history_hosts.insert(host_idx);
+        return Master(hash, history_hosts);
+    }
 
-        return host;
+    uint64_t total = 0;
+    for (uint16_t i = 0; i < cnt; i++)
+    {
+        total += data_->master_hosts[i].inflight();
     }
 
-    fail_hosts.insert(host_idx);
+    double factor = server_->option().load_factor;
+    uint64_t cap = static_cast<uint64_t>(
+        ceil(factor * (total + 1) / cnt));
 
-    for (unsigned int i = 0; i < virtual_node_set_.size(); i++)
+    int idx = GetHashIdx(hash);
+    for (size_t i = 0; i < lookup_.size(); i++)
     {
-        idx = (idx+1) % virtual_node_set_.size();
-        host_idx = virtual_node_set_[idx].idx;
-        if (fail_hosts.find(host_idx) != fail_hosts.end())
+        int host_idx = lookup_[idx];
+        idx = (idx + 1) % lookup_.size();
+
+        if (history_hosts.test(host_idx))
         {
             continue;
         }
 
-        host = data_->GetMaster(host_idx);
-        if (!host)
+        Host* host = data_->GetMaster(host_idx);
+        if (!host || !host->IsOnline() || host->inflight() + 1 > cap)
         {
             continue;
         }
 
-        history_hosts.insert(host_idx);
+        history_hosts.set(host_idx);
 
         return host;
     }
 
-    return NULL;
+    return Master(hash, history_hosts);
 }
 
 Host* HostGroup::Slave(size_t hash, int retry_cnt)
@@ -484,7 +1393,8 @@ Host* HostGroup::Slave(size_t hash, int retry_cnt)
     for (uint32_t i = start_idx; i < start_idx + data_->slave_hosts_cnt; i++)
     {
         uint32_t idx = i % data_->slave_hosts_cnt;
-        if (data_->slave_hosts[idx].fail_num() == 0)
+        if (data_->slave_hosts[idx].fail_num() == 0 
+            && data_->slave_hosts[idx].IsOnline())
         {
             return data_->GetSlave(idx);
         }
@@ -630,6 +1540,7 @@ struct HostGroupProvider::Data
 
         if (group->data()->index == -1)
         {
+            group->data()->Reset();
             delete group->data();
         }
         else
@@ -664,6 +1575,70 @@ struct HostGroupProvider::Data
         }
     }
 
+    void ListHosts(std::vector<HostGroupProvider::HostRef>* hosts)
+    {
+        SharedMemoryScopedLock lock(mutex);
+        HostGroupProvider::HostRef ref;
+
+        for (size_t i = 0; i < arraysize(group_data); i++)
+        {
+            HostGroupData* data = &group_data[i];
+            if (data->generation != g_process_generation || NULL == data->group)
+            {
+                continue;
+            }
+
+            ref.group = i;
+            ref.serial = data->serial;
+
+            for (int slave = 0; slave < 2; slave++)
+            {
+                uint16_t cnt = slave ? data->slave_hosts_cnt 
+                    : data->master_hosts_cnt;
+                for (uint16_t idx = 0; idx < cnt; idx++)
+                {
+                    Host* host = slave ? &data->slave_hosts[idx] 
+                        : &data->master_hosts[idx];
+
+                    ref.slave = slave;
+                    ref.host_idx = idx;
+                    ref.ip = host->ip();
+                    ref.port = host->port();
+                    hosts->push_back(ref);
+                }
+            }
+        }
+    }
+
+    bool WithHost(const HostGroupProvider::HostRef& ref, 
+        const HostGroupProvider::HostCallback& cb)
+    {
+        SharedMemoryScopedLock lock(mutex);
+
+        if (ref.group < 0 || ref.group >= (int)arraysize(group_data))
+        {
+            return false;
+        }
+
+        HostGroupData* data = &group_data[ref.group];
+        if (data->serial != ref.serial || NULL == data->group 
+            || data->generation != g_process_generation)
+        {
+            return false;
+        }
+
+        Host* host = ref.slave ? data->GetSlave(ref.host_idx) 
+            : data->GetMaster(ref.host_idx);
+        if (NULL == host || host->port() != ref.port || host->ip() != ref.ip)
+        {
+            return false;
+        }
+
+        cb(data->group->server(), host);
+
+        return true;
+    }
+
     std::vector<HostGroup*> GetAvailHostGroups() const
     {
         std::vector<HostGroup*> v;
@@ -706,22 +1681,69 @@ void HostGroupProvider::Release(HostGroup* group)
 
 void HostGroupProvider::Check(const CheckCallback& cb)
 {
+    Host::ReclaimStatsShards();
     data_->Check(cb);
 }
 
+void HostGroupProvider::ListHosts(std::vector<HostRef>* hosts)
+{
+    Host::ReclaimStatsShards();
+    data_->ListHosts(hosts);
+}
+
+bool HostGroupProvider::WithHost(const HostRef& ref, const HostCallback& cb)
+{
+    return data_->WithHost(ref, cb);
+}
+
+bool HostGroupProvider::HostRef::operator<(const HostRef& other) const
+{
+    if (group != other.group)
+    {
+        return group < other.group;
+    }
+
+    if (serial != other.serial)
+    {
+        return serial < other.serial;
+    }
+
+    if (slave != other.slave)
+    {
+        return slave < other.slave;
+    }
+
+    return host_idx < other.host_idx;
+}
+
 std::vector<HostGroup*> HostGroupProvider::GetAvailHostGroups() const
 {
     return data_->GetAvailHostGroups();
 }
 
 HostGroupProvider::HostGroupProvider()
-    : region_(boost::interprocess::anonymous_shared_memory(sizeof(Data)))
-    , data_(new (region_.get_address()) Data())
+    : region_(NULL)
+    , region_size_(0)
+    , data_(NULL)
 {
+    size_t data_size = SHS_MATH_ALIGNMENT(sizeof(Data), 
+        DEFAULT_CACHELINE_SIZE);
+    size_t stats_size = Host::StatsPoolSize();
+
+    region_ = shs_shm_map(data_size + stats_size, &region_size_);
+    if (NULL == region_)
+    {
+        SLOG(FATAL) << "HostGroupProvider: map shared memory failed! err="
+            << strerror(errno);
+    }
+
+    data_ = new (region_) Data();
+    Host::InitStatsPool(static_cast<char*>(region_) + data_size, stats_size);
 }
 
 HostGroupProvider::~HostGroupProvider()
 {
+    shs_shm_unmap(region_, region_size_);
 }
 
 } // namespace downstream
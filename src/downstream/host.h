@@ -1,16 +1,16 @@
 #pragma once
 
 #include <stdint.h>
-#include <set>
 #include <map>
+#include <bitset>
 #include <string>
+#include <vector>
 #include <pthread.h>
 #include <tr1/functional>
 #include <boost/noncopyable.hpp>
-#include <boost/interprocess/mapped_region.hpp>
-#include <boost/interprocess/sync/interprocess_mutex.hpp>
 
 #include "comm/timestamp.h"
+#include "core/shs_types.h"
 #include "comm/singleton.h"
 
 namespace shs 
@@ -22,6 +22,11 @@ class Server;
 class HostGroup;
 class HostGroupData;
 
+static const size_t kMaxHostsPerGroup = 2000;
+
+// Masters already tried by a request, indexed by host_idx
+typedef std::bitset<kMaxHostsPerGroup> HostSet;
+
 class Host
 {
 public:
@@ -33,10 +38,45 @@ public:
         kStatusFail
     };
 
+    struct Stats
+    {
+        Stats()
+            : delay(0)
+            , num_req(0)
+            , num_rsp(0)
+            , num_retry(0)
+            , num_fail(0)
+        {}
+
+        uint64_t delay; // us, summed over responses
+        uint32_t num_req;
+        uint32_t num_rsp;
+        uint32_t num_retry;
+        uint32_t num_fail;
+    };
+
+    enum BreakerState
+    {
+        kClosed,
+        kOpen,
+        kHalfOpen
+    };
+
     Host();
 
     void Reset();
 
+    // Hosts of shared groups take their statistics from the pool in the
+    // HostGroupProvider region, the others from the heap.
+    void AttachStats(bool shared);
+    void DetachStats();
+
+    static size_t StatsPoolSize();
+    static void InitStatsPool(void* mem, size_t size);
+
+    // Hands the shards of processes that are gone back to the pool.
+    static void ReclaimStatsShards();
+
     void Init(const std::string& ip, uint16_t port, bool backup);
 
     const std::string ip() const { return ip_; }
@@ -47,9 +87,9 @@ public:
     const std::string State(Server* server) const;
     std::string ip_port() const;
 
-    Timestamp down_start() const { return down_start_; }
-    Timestamp last_time() const { return last_time_; }
-    uint32_t fail_num() const { return fail_num_; }
+    Timestamp down_start() const { return Timestamp(down_start_); }
+    Timestamp last_time() const { return Timestamp(last_time_); }
+    uint32_t fail_num() const;
     void set_group_idx(int idx) { group_idx_ = idx; }
     void set_host_idx(int idx) { host_idx_ = idx; }
     int group_idx() const { return group_idx_; }
@@ -58,43 +98,131 @@ public:
     std::string tag() const { return tag_; }
     void gen_tag();
 
-    void UpdateStats(Result result, Server* server);
+    void AddRequest(bool retry);
+    void UpdateStats(Result result, Server* server, int64_t delay_us = -1);
+    void IncInflight();
+    void DecInflight();
+    // Summed over what every process keeps for the host.
+    uint32_t inflight() const;
+    uint32_t ewma_delay() const; // us, mean of the recent responses
     void SetOnline();
     void SetOffline();
     bool IsOnline() const;
 
+    // Sum of the last `seconds` seconds, current one included.
+    Stats GetStats(int seconds = 1) const;
+
+    // Circuit breaker, see Server::Option::breaker_*. AllowRequest sets
+    // *trial to the open episode when the request is a half-open probe, 0
+    // otherwise; the caller must then report it back through EndTrial,
+    // which ignores probes of an earlier episode, or through ReleaseTrial
+    // when the probe never reached the host.
+    bool AllowRequest(Server* server, uint32_t* trial);
+    void EndTrial(Server* server, uint32_t trial, bool ok);
+    void ReleaseTrial(uint32_t trial);
+    BreakerState breaker_state() const 
+    { 
+        return static_cast<BreakerState>(breaker_state_); 
+    }
+
 private:
     bool IsHealthy(Server* server, bool strict, bool do_skip);
 
+    static const int kStatsSeconds = 60;
+    static const uint32_t kStatsRotating = 0x80000000;
+    static const int kStatsSpins = 1000;
+
+    // sec tags the second counted; it reads kStatsRotating | the new
+    // second while the counters are being cleared for it.
+    struct StatsBucket
+    {
+        volatile uint32_t sec;
+        volatile uint32_t num_req;
+        volatile uint32_t num_rsp;
+        volatile uint32_t num_retry;
+        volatile uint32_t num_fail;
+        volatile uint64_t delay;
+    };
+
+    // What one process keeps for the host across seconds. fail_num counts
+    // a run of failures started at fail_since, which is over once any
+    // process had a success after that. delay_sum holds the last
+    // kDelaySamples to twice as many responses, halved as it fills up.
+    struct HostCounters
+    {
+        volatile uint32_t inflight;
+        volatile uint32_t fail_num;
+        volatile uint32_t status_fail_num;
+        volatile uint32_t delay_num;
+        volatile int64_t fail_since; // us
+        volatile int64_t ok_time;    // us, last success
+        volatile uint64_t delay_sum; // us
+    };
+
+    struct Totals
+    {
+        uint32_t inflight;
+        uint32_t fail_num;
+        uint32_t status_fail_num;
+        uint32_t delay_num;
+        uint64_t delay_sum;
+    };
+
+    static const uint32_t kDelaySamples = 16;
+
+    struct StatsRing
+    {
+        StatsBucket buckets[kStatsSeconds];
+    };
+
+    struct StatsPool;
+
+    StatsBucket* ShardEntry();
+    HostCounters* OwnCounters();
+    HostCounters* ShardCounters(uint32_t shard) const;
+    uint32_t NumShards() const;
+    int64_t LastSuccess() const;
+    Totals Sum() const;
+    StatsBucket* CurrentBucket(uint32_t sec);
+    void Fold(const StatsBucket& done);
+    void CheckBreaker(Server* server, int64_t now);
+    void OpenBreaker(uint32_t from, const char* reason);
+    static bool CountTrial(volatile uint32_t* counter, uint32_t trial,
+        int delta, uint32_t* count);
+    static StatsBucket* Advance(StatsBucket* b, uint32_t sec, 
+        StatsBucket* done);
+    static void Sample(const StatsBucket& b, uint32_t since, uint32_t now,
+        Stats* stats);
+    static int ProcessShard();
+    static void ReclaimShard(int shard);
+
     char ip_[32];
     uint16_t port_;
     bool backup_; // master or slave
 
-    mutable boost::interprocess::interprocess_mutex mutex_;
-    uint32_t fail_num_;
-    uint32_t status_fail_num_;
-
-    Timestamp last_time_;
-    Timestamp down_start_;
+    volatile int64_t last_time_;  // us
+    volatile int64_t down_start_; // us
 
     int group_idx_;
     int host_idx_;
 
     char tag_[128];
 
-    bool is_online_;
+    volatile bool is_online_;
 
-    struct Stats
-    {
-        uint32_t delay;
-        uint32_t num_req;
-        uint32_t num_rsp;
-        uint32_t num_retry;
-    };
+    HostCounters counters_; // for a process without a shard entry
+
+    volatile uint32_t breaker_state_;
+    // episode << 16 | count; every opening starts a new episode
+    volatile uint32_t breaker_trials_;    // half-open probes in flight
+    volatile uint32_t breaker_successes_; // half-open probes succeeded
+    volatile int64_t breaker_since_;      // us, last state change
+    volatile uint32_t breaker_checked_;   // second of the last CheckBreaker
+
+    int stats_idx_;     // block in the pool, -1 for a heap ring
+    StatsRing* stats_;  // NULL when the pool ran out
 
-    Stats history_stats_[60];
-    Stats current_stats_;
-    size_t last_idx_;
+    static StatsPool* stats_pool_;
 };
 
 struct HostGroupData
@@ -104,19 +232,21 @@ struct HostGroupData
         , slave_hosts_cnt(0)
         , ref_cnt(0)
         , generation(0)
+        , serial(0)
         , group(NULL)
         , index(-1)
     {
     }
 
-    Host master_hosts[2000];
-    Host slave_hosts[2000];
+    Host master_hosts[kMaxHostsPerGroup];
+    Host slave_hosts[kMaxHostsPerGroup];
 
     uint16_t master_hosts_cnt;
     uint16_t slave_hosts_cnt;
 
     uint16_t ref_cnt;
     uint16_t generation;
+    uint32_t serial; // moves on every time the slot is given back
 
     HostGroup* group;
     int index;
@@ -143,7 +273,7 @@ public:
 
     Host* GetMasterHost(size_t hash);
     Host* GetMasterHostByIndex(size_t index);
-    Host* SelectHost(size_t hash, std::set<int>& history_hosts, int host);
+    Host* SelectHost(size_t hash, HostSet& history_hosts, int host);
     size_t GetMasterHostSize() const { return data_->master_hosts_cnt; }
 
     int GetAliveHostCount(bool strict = false);
@@ -158,26 +288,19 @@ public:
     Server* server() const { return server_; }
 
 private:
-    Host* Master(size_t hash, std::set<int>& history_hosts);
+    Host* Master(size_t hash, HostSet& history_hosts);
+    Host* LeastRequest(HostSet& history_hosts);
+    Host* BoundedLoad(size_t hash, HostSet& history_hosts);
     Host* Slave(size_t hash, int retry_cnt);
-    int GetPos(size_t hash);
-    int GetHashIdx(int start, int end, size_t hash);
+    int GetHashIdx(size_t hash) const;
 
-    struct VirtualNode
-    {
-        VirtualNode()
-            : idx(0)
-            , hash_offset(0)
-        {}
-
-        int idx;
-        unsigned int hash_offset;
-    };
+    static const size_t kLookupFactor = 100;
+    static const size_t kMaxLookupSize = 65536;
 
     HostGroupData* data_;
     Server* server_;
     std::map<std::string, Host*> hosts_;
-    std::vector<VirtualNode> virtual_node_set_;
+    std::vector<int16_t> lookup_;
 };
 
 class HostGroupProvider : boost::noncopyable
@@ -186,11 +309,33 @@ public:
     static HostGroupProvider* instance();
     typedef std::tr1::function<void(Server*)> CheckCallback;
 
+    // A host of a shared group, found again by its place as long as the
+    // group's slot was not given back in between.
+    struct HostRef
+    {
+        int group;
+        uint32_t serial;
+        bool slave;
+        uint16_t host_idx;
+        std::string ip;
+        uint16_t port;
+
+        bool operator<(const HostRef& other) const;
+    };
+
+    typedef std::tr1::function<void(Server*, Host*)> HostCallback;
+
     HostGroup* Create(Server* server);
     void Release(HostGroup* group);
   
     void Check(const CheckCallback& cb);
 
+    // Lists the hosts of this generation's shared groups, so that they can
+    // be used without holding the lock.
+    void ListHosts(std::vector<HostRef>* hosts);
+    // Runs cb under the lock unless the host is gone; false then.
+    bool WithHost(const HostRef& ref, const HostCallback& cb);
+
     std::vector<HostGroup*> GetAvailHostGroups() const;
 
 private:
@@ -198,7 +343,8 @@ private:
     ~HostGroupProvider();
     friend class Singleton<HostGroupProvider>;
 
-    boost::interprocess::mapped_region region_;
+    void* region_;
+    size_t region_size_;
 
     struct Data;
     Data* data_;
@@ -1,20 +1,31 @@
 #include "request.h"
 
+#include <string.h>
 #include <string>
 #include <tr1/functional>
-#include <boost/format.hpp>
 #include <gflags/gflags.h>
 
 #include "log/logging.h"
+#include "histogram.h"
+#include "trace.h"
 #include "http/http.h"
+#include "core/shs_event_timer.h"
 #include "comm/timestamp.h"
 #include "downstream/host.h"
 #include "downstream/util.h"
 #include "downstream/request_context.h"
 #include "downstream/response.h"
+#include "downstream/single_flight.h"
+#include "downstream/response_cache.h"
 
 namespace shs 
 { 
+
+DECLARE_string(trace_header);
+DEFINE_int32(ds_coalesce_poll_interval, 5,
+    "ms between the checks of a worker waiting for a GET another worker "
+    "fetches, see Server::Option::coalesce_shared");
+
 namespace downstream 
 { 
 
@@ -65,6 +76,73 @@ ErrCode ConvertToErrCode(HTTP_CODE qec,
     return ec;
 }
 
+// A claim that gets no response is dropped, so the workers waiting on
+// it fetch for themselves.
+void StoreResponse(const std::string& key, uint32_t ttl, uint32_t stale,
+    bool claimed, const ResponseHandler& handler, ErrCode ec, 
+    boost::shared_ptr<Response> response)
+{
+    bool stored = false;
+
+    if (ec == OK && response->code() == 200)
+    {
+        stored = ResponseCache::instance()->Store(key, response->code(), 
+            response->body_data(), response->body_size(), ttl, stale);
+    }
+
+    if (claimed && !stored)
+    {
+        ResponseCache::instance()->Unclaim(key);
+    }
+
+    if (handler)
+    {
+        handler(ec, response);
+    }
+}
+
+// Cache hits reach the caller from the event loop, as downstream replies
+// do, never from inside Execute().
+struct CachedReply
+{
+    event_t ev;
+    ResponseHandler handler;
+    boost::shared_ptr<Response> response;
+};
+
+void DeliverCachedReply(event_t* ev)
+{
+    CachedReply* reply = (CachedReply *)ev->data;
+
+    try
+    {
+        reply->handler(OK, reply->response);
+    }
+    catch (...)
+    {
+        SLOG(ERROR) << "Get Exception\tcached reply";
+    }
+
+    delete reply;
+}
+
+void RefreshDone(Request* req, const std::string& key, uint32_t ttl, 
+    uint32_t stale, ErrCode ec, boost::shared_ptr<Response> response)
+{
+    StoreResponse(key, ttl, stale, false, ResponseHandler(), ec, response);
+
+    delete req;
+}
+
+// A worker waiting for the response of a GET another worker claimed.
+struct SharedWait
+{
+    event_t ev;
+    RequestContext* ctx;
+    std::string key;
+    int64_t deadline_us;
+};
+
 } // namespace
 
 RequestUri::RequestUri(const string& base)
@@ -86,24 +164,31 @@ void RequestUri::AddQuery(const string& name, const string& value)
     query_[name] = value;
 }
 
+// Sized up front and encoded in place: one allocation per uri.
 string RequestUri::uri()
 {
-    string uri = base_uri_;
     map<string, string>::iterator iter;
+    size_t len = base_uri_.size();
     for (iter = query_.begin(); iter != query_.end(); ++iter)
     {
-        std::string encoded_value = http_encode_uri(iter->second.c_str());
+        len += 2 + iter->first.size() 
+            + http_encode_uri_len(iter->second.data(), iter->second.size());
+    }
 
-        if (iter == query_.begin())
-        {
-            uri += boost::str(boost::format("?%1%=%2%") 
-                % iter->first % encoded_value);
-        }
-        else
-        {
-            uri += boost::str(boost::format("&%1%=%2%") 
-                % iter->first % encoded_value);
-        }
+    string uri;
+    uri.resize(len);
+
+    char* p = &uri[0];
+    memcpy(p, base_uri_.data(), base_uri_.size());
+    p += base_uri_.size();
+
+    for (iter = query_.begin(); iter != query_.end(); ++iter)
+    {
+        *p++ = (iter == query_.begin()) ? '?' : '&';
+        memcpy(p, iter->first.data(), iter->first.size());
+        p += iter->first.size();
+        *p++ = '=';
+        p = http_encode_uri_to(p, iter->second.data(), iter->second.size());
     }
 
     return uri;
@@ -138,6 +223,26 @@ static void HandlerResponse(HTTP_CODE qec,
     int port = ctx->host->port();
     boost::shared_ptr<Response> response;
 
+    // a non-200 answer still proves the host is reachable
+    ctx->host->DecInflight();
+    if (ctx->breaker_trial)
+    {
+        ctx->host->EndTrial(ctx->server, ctx->breaker_trial, 
+            ec == OK || ec == E_BAD_RESPONSE);
+        ctx->breaker_trial = 0;
+    }
+
+    int64_t elapsed = TimeDifference(Timestamp::Now(), ctx->start_timestamp);
+    ctx->host->UpdateStats(
+        (ec == OK || ec == E_BAD_RESPONSE) ? Host::kOk : Host::kFail,
+        ctx->server, elapsed);
+    LatencyHistogram::Record(ctx->server->latency_id(), elapsed);
+
+    if (ctx->trace)
+    {
+        ctx->trace->Mark(kTraceDownstreamDone, ctx->retry_num);
+    }
+
     if (ec == OK)
     {
         response.reset(new Response(rsp, ip, ctx->retry_num));
@@ -168,6 +273,7 @@ static void HandlerResponse(HTTP_CODE qec,
 
     try
     {
+        Trace::Scope scope(ctx->trace);
         ctx->response_handler(ec, response);
     }
     catch (...)
@@ -187,16 +293,30 @@ void Request::AddHeader(const std::string& key, const std::string& value)
 
 void Request::Execute(RequestContext* ctx)
 {
-    pool_t *mempool = NULL;
-    pool_t *mempool2 = NULL;
     http_conn_t *hc = NULL;
     http_req_t *req = NULL;
     int conn_timeout = -1;
     int recv_timeout = -1;
     int retry_cnt = -1;
+    size_t tries = ctx->server->GetMasterHostSize() + 1;
 
     ctx->host = ctx->server->Create(ctx->hash, ctx->retry_num,
         ctx->history_hosts, &ctx->err_code);
+    while (ctx->host 
+        && !ctx->host->AllowRequest(ctx->server, &ctx->breaker_trial))
+    {
+        ctx->host = NULL;
+        ctx->err_code = E_CIRCUIT_OPEN;
+
+        if (--tries == 0)
+        {
+            break;
+        }
+
+        ctx->host = ctx->server->Create(ctx->hash, ctx->retry_num,
+            ctx->history_hosts, &ctx->err_code);
+    }
+
     if (!ctx->host)
     {
         goto failed;
@@ -208,31 +328,22 @@ void Request::Execute(RequestContext* ctx)
         ctx->hc = NULL;
     }
 
-    mempool = pool_create(CONN_DEFAULT_POOL_SIZE, CONN_DEFAULT_POOL_SIZE);
-    if (!mempool)
-    {
-        goto failed;
-    }
- 
-    hc = (http_conn_t *)pool_calloc(mempool, sizeof(http_conn_t));
+    hc = http_conn_create();
     if (!hc)
     {
-        pool_destroy(mempool);
-
         goto failed;
     }
 
-    hc->mempool = mempool;
     hc->base = ctx->server->event_base();
     hc->timer = ctx->server->event_timer();
     hc->connpool = ctx->server->conn_pool();
-    strcpy(hc->host, ctx->host->ip().c_str());
+    snprintf(hc->host, sizeof(hc->host), "%s", ctx->host->ip().c_str());
     hc->port = ctx->host->port(); 
 
     hc->c = conn_pool_get_connection(hc->connpool);
     if (!hc->c)
     {
-        pool_destroy(mempool);
+        http_conn_free(hc);
 
         goto failed;
     }
@@ -257,28 +368,14 @@ void Request::Execute(RequestContext* ctx)
 
     ctx->hc = hc;
 
-    mempool2 = pool_create(CONN_DEFAULT_POOL_SIZE, CONN_DEFAULT_POOL_SIZE);
-    if (!mempool2)
-    {
-        goto failed;
-    }
-
-    req = (http_req_t *)pool_calloc(mempool2, sizeof(http_req_t));
+    req = http_request_create();
     if (!req)
     {
-        pool_destroy(mempool2);
-
         goto failed;
     }
 
-    req->mempool = mempool2;
     req->data = ctx;
     req->cb = HandlerResponse;
-    req->input_body = string_null;
-    req->output_body = string_null;
-    req->uri = string_null;
-    req->response_code_line = string_null;
-    http_init_headers(req);
     req->hc = hc;
     hc->req = req;
 
@@ -306,6 +403,22 @@ void Request::Execute(RequestContext* ctx)
             std::to_string(end.MicroSecondsSinceEpoch()));
     }
 
+    if (ctx->trace)
+    {
+        if (ctx->trace->sampled() 
+            && !http_exist_header(req->output_headers, FLAGS_trace_header))
+        {
+            http_add_output_header(req, FLAGS_trace_header, 
+                ctx->trace->id_string());
+        }
+
+        ctx->trace->Mark(kTraceDownstream, ctx->retry_num);
+    }
+
+    ctx->start_timestamp = Timestamp::Now();
+    ctx->host->IncInflight();
+    ctx->host->AddRequest(ctx->retry_num > 0);
+
     if (http_make_request(req, type_, uri_, body_) != SHS_OK)
     {
         ctx->err_code = E_HTTP_CONNECT_FAIL;
@@ -319,8 +432,15 @@ void Request::Execute(RequestContext* ctx)
     return;
 
 failed:
+    // nothing was sent, so the host has not been probed
+    if (ctx->host && ctx->breaker_trial)
+    {
+        ctx->host->ReleaseTrial(ctx->breaker_trial);
+    }
+
     boost::shared_ptr<Response> response(new Response(NULL));
-    ctx->response_handler(E_BAD_REQUEST, response);
+    ctx->response_handler(ctx->err_code == E_CIRCUIT_OPEN 
+        ? E_CIRCUIT_OPEN : E_BAD_REQUEST, response);
 
     delete ctx;
 }
@@ -351,9 +471,263 @@ void Request::Execute(Server *server,
     ctx->server = server;
     ctx->response_handler = response_handler;
 
+    const Server::Option& option = server->option();
+    std::string cache_key;
+    ResponseCache::Status status = ResponseCache::kMiss;
+
+    if (type_ == SHS_HTTP_REQ_TYPE_GET && option.cache_ttl > 0
+        && ResponseCache::instance()->enabled())
+    {
+        int code = 0;
+        SharedBuffer body;
+        size_t body_len = 0;
+
+        cache_key = CacheKey(server);
+        status = ResponseCache::instance()->Lookup(
+            cache_key, server->max_timeout(), &code, &body, &body_len);
+        if (status != ResponseCache::kMiss 
+            && status != ResponseCache::kPending)
+        {
+            // the caller may drop us in its handler, refresh with a copy
+            Request* refresh = NULL;
+            if (status == ResponseCache::kRefresh)
+            {
+                refresh = new Request(*this);
+                ctx->req = refresh;
+                ctx->response_handler = std::tr1::bind(RefreshDone, 
+                    refresh, cache_key, option.cache_ttl, 
+                    option.cache_stale, std::tr1::placeholders::_1, 
+                    std::tr1::placeholders::_2);
+            }
+
+            boost::shared_ptr<Response> response(
+                new Response(code, body, body_len));
+            event_timer_t* timer = server->event_timer();
+            if (timer)
+            {
+                CachedReply* reply = new CachedReply();
+                memset(&reply->ev, 0, sizeof(event_t));
+                reply->ev.data = reply;
+                reply->ev.handler = DeliverCachedReply;
+                reply->handler = response_handler;
+                reply->response = response;
+                event_timer_add(timer, &reply->ev, 0);
+            }
+            else
+            {
+                response_handler(OK, response);
+            }
+
+            if (refresh)
+            {
+                refresh->Execute(ctx);
+            }
+            else
+            {
+                delete ctx;
+            }
+
+            return;
+        }
+    }
+
+    if (type_ == SHS_HTTP_REQ_TYPE_GET && option.coalesce)
+    {
+        std::string key = CoalesceKey(server);
+        SingleFlight* flight = SingleFlight::instance();
+
+        if (flight->Join(key, response_handler))
+        {
+            delete ctx;
+
+            return;
+        }
+
+        ctx->response_handler = std::tr1::bind(&SingleFlight::Complete, 
+            flight, key, std::tr1::placeholders::_1, 
+            std::tr1::placeholders::_2);
+    }
+
+    if (!cache_key.empty())
+    {
+        bool claimed = false;
+
+        if (option.coalesce && option.coalesce_shared 
+            && server->event_timer())
+        {
+            if (status == ResponseCache::kPending 
+                || !ResponseCache::instance()->Claim(cache_key, 
+                    server->max_timeout()))
+            {
+                WaitShared(ctx, cache_key);
+
+                return;
+            }
+
+            claimed = true;
+        }
+
+        ctx->response_handler = std::tr1::bind(StoreResponse, cache_key,
+            option.cache_ttl, option.cache_stale, claimed, 
+            ctx->response_handler, std::tr1::placeholders::_1, 
+            std::tr1::placeholders::_2);
+    }
+
     Execute(ctx);
 }
 
+// Waits at most as long as a claim lives.
+void Request::WaitShared(RequestContext* ctx, const std::string& cache_key)
+{
+    SharedWait* wait = new SharedWait();
+    memset(&wait->ev, 0, sizeof(event_t));
+    wait->ev.data = wait;
+    wait->ev.handler = PollShared;
+    wait->ctx = ctx;
+    wait->key = cache_key;
+    wait->deadline_us = Timestamp::Now().MicroSecondsSinceEpoch() 
+        + ctx->server->max_timeout() * 1000LL;
+
+    event_timer_add(ctx->server->event_timer(), &wait->ev, 
+        FLAGS_ds_coalesce_poll_interval);
+}
+
+void Request::PollShared(event_t* ev)
+{
+    SharedWait* wait = (SharedWait *)ev->data;
+    RequestContext* ctx = wait->ctx;
+    Server* server = ctx->server;
+    const Server::Option& option = server->option();
+    int code = 0;
+    SharedBuffer body;
+    size_t body_len = 0;
+
+    ResponseCache::Status status = ResponseCache::instance()->Lookup(
+        wait->key, server->max_timeout(), &code, &body, &body_len);
+    bool expired = Timestamp::Now().MicroSecondsSinceEpoch() 
+        >= wait->deadline_us;
+
+    // a claim dropped without a response is taken over by the first
+    // waiter to see it gone
+    bool claimed = false;
+    if (status == ResponseCache::kMiss && !expired)
+    {
+        claimed = ResponseCache::instance()->Claim(wait->key, 
+            server->max_timeout());
+        if (!claimed)
+        {
+            status = ResponseCache::kPending;
+        }
+    }
+
+    if (status == ResponseCache::kPending && !expired)
+    {
+        event_timer_add(server->event_timer(), ev, 
+            FLAGS_ds_coalesce_poll_interval);
+
+        return;
+    }
+
+    std::string key;
+    key.swap(wait->key);
+    delete wait;
+
+    if (status == ResponseCache::kMiss || status == ResponseCache::kPending)
+    {
+        ctx->response_handler = std::tr1::bind(StoreResponse, key,
+            option.cache_ttl, option.cache_stale, claimed, 
+            ctx->response_handler, std::tr1::placeholders::_1, 
+            std::tr1::placeholders::_2);
+        ctx->req->Execute(ctx);
+
+        return;
+    }
+
+    // the handler may drop the request, refresh with a copy
+    ResponseHandler handler = ctx->response_handler;
+    if (status == ResponseCache::kRefresh)
+    {
+        Request* refresh = new Request(*ctx->req);
+        ctx->req = refresh;
+        ctx->response_handler = std::tr1::bind(RefreshDone, refresh, key, 
+            option.cache_ttl, option.cache_stale, 
+            std::tr1::placeholders::_1, std::tr1::placeholders::_2);
+    }
+    else
+    {
+        delete ctx;
+        ctx = NULL;
+    }
+
+    boost::shared_ptr<Response> response(new Response(code, body, body_len));
+    try
+    {
+        handler(OK, response);
+    }
+    catch (...)
+    {
+        SLOG(ERROR) << "Get Exception\tcoalesced reply";
+    }
+
+    if (ctx)
+    {
+        ctx->req->Execute(ctx);
+    }
+}
+
+std::string Request::CoalesceKey(Server *server) const
+{
+    char prefix[32];
+    int len = snprintf(prefix, sizeof prefix, "%p:", (void *)server);
+
+    std::string key;
+    key.reserve(len + 16 + uri_.size());
+    key.append(prefix, len);
+    AppendRequestKey(server, &key);
+
+    return key;
+}
+
+// Shared by every process, so the server is named rather than addressed.
+std::string Request::CacheKey(Server *server) const
+{
+    const std::string& name = server->name();
+
+    std::string key;
+    key.reserve(name.size() + 16 + uri_.size());
+    key.append(name);
+    key += ':';
+    AppendRequestKey(server, &key);
+
+    return key;
+}
+
+// Built with appends into one reserved string, it runs for every
+// coalesced or cached call.
+void Request::AppendRequestKey(Server *server, std::string* key) const
+{
+    char type[16];
+    int len = snprintf(type, sizeof type, "%d:", (int)type_);
+
+    key->append(type, len);
+    key->append(uri_);
+
+    const std::vector<std::string>& names = server->option().coalesce_headers;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        std::map<std::string, std::string>::const_iterator it = 
+            headers_.find(names[i]);
+
+        *key += '\n';
+        key->append(names[i]);
+        *key += ':';
+        if (it != headers_.end())
+        {
+            key->append(it->second);
+        }
+    }
+}
+
 GetRequest::GetRequest(const std::string& uri, const std::string& hash)
     : Request(uri, "", hash, SHS_HTTP_REQ_TYPE_GET)
 {
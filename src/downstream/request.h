@@ -4,6 +4,7 @@
 #include <vector>
 #include <string>
 
+#include "core/shs_event_timer.h"
 #include "downstream/response.h"
 
 namespace shs 
@@ -48,6 +49,11 @@ public:
 
 private:
     void Execute(RequestContext* ctx);
+    void WaitShared(RequestContext* ctx, const std::string& cache_key);
+    static void PollShared(event_t* ev);
+    std::string CoalesceKey(Server *server) const;
+    std::string CacheKey(Server *server) const;
+    void AppendRequestKey(Server *server, std::string* key) const;
 
 private:
     std::string uri_;
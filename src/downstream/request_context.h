@@ -1,11 +1,11 @@
 #pragma once
 
-#include <set>
 #include <tr1/functional>
 
 #include "downstream/server.h"
 #include "comm/timestamp.h"
 #include "http/http.h"
+#include "trace.h"
 
 namespace shs 
 { 
@@ -22,14 +22,26 @@ public:
         , history_hosts()
         , server(NULL)
         , create_timestamp(Timestamp::Now())
+        , start_timestamp(create_timestamp)
         , req(NULL)
         , host(NULL)
         , hc(NULL)
+        , breaker_trial(0)
+        , trace(Trace::current())
     {
+        if (trace)
+        {
+            trace->Ref();
+        }
     }
 
     virtual ~RequestContext()
     {
+        if (trace)
+        {
+            trace->Unref();
+        }
+
         if (hc)
         {
             http_conn_free(hc);
@@ -59,12 +71,15 @@ public:
     uint32_t retry_num;
     size_t hash;
     ErrCode err_code;
-    std::set<int> history_hosts;
+    HostSet history_hosts;
     Server *server;
     Timestamp create_timestamp;
+    Timestamp start_timestamp;
     Request* req;
     Host* host;
     http_conn_t* hc;
+    uint32_t breaker_trial; // half-open episode probed, 0 for none
+    Trace* trace;   // of the request this call is made for, if traced
     ResponseHandler response_handler;
 };
 
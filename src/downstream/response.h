@@ -19,17 +19,34 @@ public:
     Response(http_req_t* rsp = NULL,
         const std::string& host = "", int retry_cnt = 0)
         : code_(0)
-        , host_(host)
         , retry_cnt_(retry_cnt)
+        , host_(host)
+        , body_len_(0)
+        , body_copied_(false)
     {
         if (NULL != rsp)
         {
             code_ = rsp->response_code;
-            body_.assign((const char *)rsp->input_body.data, 
-                rsp->input_body.len);
+            body_len_ = rsp->input_body.len;
+            body_data_ = http_take_input_body(rsp);
+            if (!body_data_)
+            {
+                body_len_ = 0;
+            }
         }
     }
 
+    Response(int code, const SharedBuffer& body, size_t body_len,
+        const std::string& host = "")
+        : code_(code)
+        , retry_cnt_(0)
+        , host_(host)
+        , body_data_(body)
+        , body_len_(body_len)
+        , body_copied_(false)
+    {
+    }
+
     virtual ~Response() {}
 
     void set_code(int code)
@@ -52,16 +69,45 @@ public:
         return retry_cnt_; 
     }
 
+    // Copies the body on first use; prefer body_data()/body_buffer().
     const std::string& body() const 
     { 
+        if (!body_copied_)
+        {
+            body_copied_ = true;
+            if (body_data_)
+            {
+                body_.assign(body_data_.get(), body_len_);
+            }
+        }
+
         return body_; 
     }
 
+    const char* body_data() const
+    {
+        return body_data_.get();
+    }
+
+    size_t body_size() const
+    {
+        return body_len_;
+    }
+
+    // Shared with the http layer, e.g. InvokeResult::set_body()
+    const SharedBuffer& body_buffer() const
+    {
+        return body_data_;
+    }
+
 private:
     int code_;
     int retry_cnt_;
     std::string host_;
-    std::string body_;
+    SharedBuffer body_data_;
+    size_t body_len_;
+    mutable std::string body_;
+    mutable bool body_copied_;
 };
 
 typedef std::tr1::function<void(ErrCode, 
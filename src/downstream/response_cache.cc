@@ -0,0 +1,500 @@
+#include "response_cache.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <boost/checked_delete.hpp>
+#include <gflags/gflags.h>
+
+#include "log/logging.h"
+#include "comm/timestamp.h"
+#include "core/shs_queue.h"
+#include "core/shs_shmem.h"
+#include "core/shs_shmem_allocator.h"
+#include "core/shs_shm_slabs.h"
+#include "core/shs_swisstable.h"
+#include "downstream/host.h"
+#include "downstream/util.h"
+
+namespace shs
+{
+
+DEFINE_int32(ds_cache_size, 0,
+    "Shared downstream response cache size in MB, 0 to disable");
+DEFINE_int32(ds_cache_budget, 0,
+    "Byte budget of cached downstream responses in MB, "
+    "0 for 3/4 of ds_cache_size");
+DEFINE_int32(ds_cache_max_entry, 1024,
+    "Largest cacheable downstream response in KB");
+DEFINE_int32(ds_cache_buckets, 65536,
+    "Entries the shared downstream response cache's index is sized for "
+    "up front, it grows past that as long as ds_cache_size has room");
+
+namespace downstream
+{
+
+struct ResponseCache::Entry
+{
+    shs_hashtable_link_t link;          // link.key points at data
+    queue_t clock;
+    int64_t expire_us;
+    int64_t stale_us;
+    int64_t refresh_until_us;
+    size_t slab_size;
+    uint32_t key_len;
+    uint32_t body_len;
+    int code;                           // 0 for a claim
+    int referenced;
+    char data[1];                       // key, then body
+};
+
+namespace
+{
+
+struct EntryHash
+{
+    size_t operator()(const void* key, size_t len) const
+    {
+        return CalcHash((const char *)key, len);
+    }
+};
+
+typedef shs_swisstable_s<EntryHash> EntryTable;
+
+} // namespace
+
+struct ResponseCache::Header
+{
+    pthread_mutex_t mutex;
+    EntryTable* table;
+    shs_shm_slabs_t* slabs;             // in a mapping of its own
+    queue_t clock;                      // head is the most recent entry
+    size_t budget;
+    size_t max_entry;
+    size_t used_bytes;
+    uint64_t hits;
+    uint64_t stale_hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+};
+
+namespace
+{
+
+int64_t NowUs()
+{
+    return Timestamp::Now().MicroSecondsSinceEpoch();
+}
+
+} // namespace
+
+ResponseCache* ResponseCache::instance()
+{
+    return Singleton<ResponseCache>::instance();
+}
+
+ResponseCache::ResponseCache()
+    : allocator_(NULL)
+    , header_(NULL)
+{
+}
+
+// The mapping is shared with the other processes, leave it to exit().
+ResponseCache::~ResponseCache()
+{
+}
+
+bool ResponseCache::Init()
+{
+    if (header_ || FLAGS_ds_cache_size <= 0)
+    {
+        return true;
+    }
+
+    size_t size = (size_t)FLAGS_ds_cache_size << 20;
+    size_t max_entry = (size_t)FLAGS_ds_cache_max_entry << 10;
+
+    // a quarter for the header and index, the rest for the entries
+    shs_shmem_allocator_param_t param;
+    param.size = size / 4;
+    param.min_size = 128;
+    param.max_size = param.size / 4;
+    param.factor = SHS_SHMEM_EXP_FACTOR;
+    param.level_type = SHS_SHMEM_LEVEL_TYPE_EXP;
+    param.err_no = 0;
+
+    allocator_ = shs_mem_allocator_new_init(SHS_MEM_ALLOCATOR_TYPE_SHMEM,
+        &param);
+    if (NULL == allocator_)
+    {
+        SLOG(ERROR) << "ResponseCache: create shared memory failed"
+            << "\tsize=" << size
+            << "\tmsg=" << shs_shmem_strerror(param.err_no);
+
+        return false;
+    }
+
+    unsigned int err_no = 0;
+    Header* header = (Header *)allocator_->calloc(allocator_,
+        sizeof(Header), &err_no);
+    if (NULL == header)
+    {
+        return false;
+    }
+
+    size_t arena_size = 0;
+    void* arena = shs_shm_map(size - size / 4, &arena_size);
+    shs_slab_errno_t slab_err;
+    header->slabs = NULL == arena ? NULL : shs_shm_slabs_create(arena,
+        arena_size, SHS_SLAB_UPTYPE_POWER, SHS_SLAB_POWER_FACTOR, 256,
+        max_entry + sizeof(Entry), &slab_err);
+    header->table = shs_swisstable_create<EntryHash, shs_swisstable_cmp_mem>(
+        FLAGS_ds_cache_buckets > 0 ? FLAGS_ds_cache_buckets : 0, allocator_);
+    if (NULL == header->slabs || NULL == header->table)
+    {
+        SLOG(ERROR) << "ResponseCache: create slabs or hashtable failed"
+            << "\tsize=" << size;
+
+        return false;
+    }
+
+    header->budget = FLAGS_ds_cache_budget > 0
+        ? (size_t)FLAGS_ds_cache_budget << 20 : size / 4 * 3;
+    header->max_entry = max_entry;
+    queue_init(&header->clock);
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    header_ = header;
+
+    return true;
+}
+
+ResponseCache::Entry* ResponseCache::Find(const std::string& key)
+{
+    shs_hashtable_link_t* link = (shs_hashtable_link_t *)
+        shs_swisstable_lookup(header_->table, key.data(), key.size());
+    if (NULL == link)
+    {
+        return NULL;
+    }
+
+    return (Entry *)((char *)link - offsetof(Entry, link));
+}
+
+void ResponseCache::Remove(Entry* entry)
+{
+    shs_slab_errno_t err;
+
+    shs_swisstable_remove_link(header_->table, &entry->link);
+    queue_remove(&entry->clock);
+    header_->used_bytes -= entry->slab_size;
+    shs_shm_slabs_free(header_->slabs, entry, &err);
+}
+
+// CLOCK: entries read since the hand last passed get a second chance,
+// everything else (and whatever is past its stale window) goes.
+void ResponseCache::Evict(size_t bytes)
+{
+    int64_t now = NowUs();
+    size_t freed = 0;
+    size_t scan = 2 * (size_t)header_->table->count;
+
+    while (freed < bytes && scan-- > 0 && !queue_empty(&header_->clock))
+    {
+        queue_t* q = queue_tail(&header_->clock);
+        Entry* e = queue_data(q, Entry, clock);
+
+        if (e->referenced && now < e->stale_us)
+        {
+            e->referenced = 0;
+            queue_remove(q);
+            queue_insert_head(&header_->clock, q);
+
+            continue;
+        }
+
+        freed += e->slab_size;
+        Remove(e);
+        header_->evictions++;
+    }
+}
+
+ResponseCache::Status ResponseCache::Lookup(const std::string& key,
+    int64_t refresh_timeout_ms, int* code, SharedBuffer* body,
+    size_t* body_len)
+{
+    if (NULL == header_)
+    {
+        return kMiss;
+    }
+
+    SharedMemoryScopedLock lock(header_->mutex, true);
+    if (!lock.Valid())
+    {
+        return kMiss;
+    }
+
+    int64_t now = NowUs();
+    Entry* e = Find(key);
+    if (e && now >= e->stale_us)
+    {
+        Remove(e);
+        e = NULL;
+    }
+
+    if (NULL == e)
+    {
+        header_->misses++;
+
+        return kMiss;
+    }
+
+    if (0 == e->code)
+    {
+        return kPending;
+    }
+
+    char* data = new char[e->body_len + 1];
+    memcpy(data, e->data + e->key_len, e->body_len);
+    data[e->body_len] = '\0';
+
+    body->reset(data, boost::checked_array_deleter<const char>());
+    *body_len = e->body_len;
+    *code = e->code;
+    e->referenced = 1;
+
+    if (now < e->expire_us)
+    {
+        header_->hits++;
+
+        return kFresh;
+    }
+
+    header_->stale_hits++;
+    if (e->refresh_until_us > now)
+    {
+        return kStale;
+    }
+
+    e->refresh_until_us = now + refresh_timeout_ms * 1000;
+
+    return kRefresh;
+}
+
+bool ResponseCache::Store(const std::string& key, int code,
+    const char* body, size_t body_len, int64_t ttl_ms, int64_t stale_ms)
+{
+    if (NULL == header_ || ttl_ms <= 0)
+    {
+        return false;
+    }
+
+    if (body_len > header_->max_entry)
+    {
+        return false;
+    }
+
+    Entry* e = NewEntry(key, body_len);
+    if (NULL == e)
+    {
+        return false;
+    }
+
+    e->expire_us = NowUs() + ttl_ms * 1000;
+    e->stale_us = e->expire_us + (stale_ms > 0 ? stale_ms * 1000 : 0);
+    e->code = code;
+    memcpy(e->data + key.size(), body, body_len);
+
+    bool linked = false;
+    {
+        SharedMemoryScopedLock lock(header_->mutex);
+        if (lock.Valid())
+        {
+            Entry* old = Find(key);
+            if (old)
+            {
+                Remove(old);
+            }
+
+            linked = Link(e);
+            if (linked)
+            {
+                header_->stores++;
+            }
+        }
+    }
+
+    if (!linked)
+    {
+        shs_slab_errno_t err;
+        shs_shm_slabs_free(header_->slabs, e, &err);
+    }
+
+    return linked;
+}
+
+bool ResponseCache::Claim(const std::string& key, int64_t timeout_ms)
+{
+    if (NULL == header_)
+    {
+        return true;
+    }
+
+    Entry* claim = NewEntry(key, 0);
+    if (claim)
+    {
+        claim->stale_us = NowUs() + timeout_ms * 1000;
+    }
+
+    // nobody can be told, so go alone
+    bool claimed = true;
+    {
+        SharedMemoryScopedLock lock(header_->mutex, true);
+        if (lock.Valid())
+        {
+            Entry* e = Find(key);
+            if (e && NowUs() >= e->stale_us)
+            {
+                Remove(e);
+                e = NULL;
+            }
+
+            if (e)
+            {
+                claimed = false;
+            }
+            else if (claim && Link(claim))
+            {
+                claim = NULL;
+            }
+        }
+    }
+
+    if (claim)
+    {
+        shs_slab_errno_t err;
+        shs_shm_slabs_free(header_->slabs, claim, &err);
+    }
+
+    return claimed;
+}
+
+void ResponseCache::Unclaim(const std::string& key)
+{
+    if (NULL == header_)
+    {
+        return;
+    }
+
+    SharedMemoryScopedLock lock(header_->mutex);
+    if (!lock.Valid())
+    {
+        return;
+    }
+
+    Entry* e = Find(key);
+    if (e && 0 == e->code)
+    {
+        Remove(e);
+    }
+}
+
+// An unlinked entry for key with room for the body, with everything past
+// the key left to the caller. Without the lock, which is only taken to
+// evict when the arena is used up.
+ResponseCache::Entry* ResponseCache::NewEntry(const std::string& key,
+    size_t body_len)
+{
+    size_t need = offsetof(Entry, data) + key.size() + body_len;
+
+    shs_slab_errno_t err;
+    size_t slab_size = 0;
+    Entry* e = (Entry *)shs_shm_slabs_alloc(header_->slabs,
+        SHS_SLAB_ALLOC_TYPE_ACT, need, &slab_size, &err);
+    if (NULL == e)
+    {
+        {
+            SharedMemoryScopedLock lock(header_->mutex);
+            if (!lock.Valid())
+            {
+                return NULL;
+            }
+
+            Evict(need);
+        }
+
+        e = (Entry *)shs_shm_slabs_alloc(header_->slabs,
+            SHS_SLAB_ALLOC_TYPE_ACT, need, &slab_size, &err);
+    }
+
+    if (NULL == e)
+    {
+        return NULL;
+    }
+
+    e->expire_us = 0;
+    e->stale_us = 0;
+    e->refresh_until_us = 0;
+    e->slab_size = slab_size;
+    e->key_len = key.size();
+    e->body_len = body_len;
+    e->code = 0;
+    e->referenced = 0;
+    memcpy(e->data, key.data(), key.size());
+
+    e->link.key = e->data;
+    e->link.len = e->key_len;
+    e->link.next = NULL;
+
+    return e;
+}
+
+// Makes a filled-in entry findable, evicting down to the budget first.
+// With the lock held; on false the entry is still the caller's.
+bool ResponseCache::Link(Entry* entry)
+{
+    if (header_->used_bytes + entry->slab_size > header_->budget)
+    {
+        Evict(header_->used_bytes + entry->slab_size - header_->budget);
+    }
+
+    // growing the index needs room in its mapping too
+    if (shs_swisstable_join(header_->table, &entry->link)
+        != SHS_HASHTABLE_OK)
+    {
+        return false;
+    }
+
+    queue_insert_head(&header_->clock, &entry->clock);
+    header_->used_bytes += entry->slab_size;
+
+    return true;
+}
+
+void ResponseCache::GetStats(Stats* stats) const
+{
+    memset(stats, 0, sizeof(*stats));
+
+    if (NULL == header_)
+    {
+        return;
+    }
+
+    stats->hits = header_->hits;
+    stats->stale_hits = header_->stale_hits;
+    stats->misses = header_->misses;
+    stats->stores = header_->stores;
+    stats->evictions = header_->evictions;
+    stats->entries = header_->table->count;
+    stats->used_bytes = header_->used_bytes;
+}
+
+} // namespace downstream
+} // namespace shs
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <boost/noncopyable.hpp>
+
+#include "types.h"
+#include "comm/singleton.h"
+#include "core/shs_mem_allocator.h"
+
+namespace shs
+{
+namespace downstream
+{
+
+// Cache of successful downstream GET responses, kept in anonymous shared
+// mappings so every worker process sees the same entries. Entries come
+// from a lock-free shs_shm_slabs arena and are filled in before the lock
+// is taken, which only covers linking them into the shs_swisstable index
+// and the CLOCK list they are evicted from once the byte budget is
+// reached.
+//
+// Init() must run in the master before the workers are forked, see
+// FLAGS_ds_cache_size.
+class ResponseCache : boost::noncopyable
+{
+public:
+    enum Status
+    {
+        kMiss,
+        kFresh,     // within ttl
+        kStale,     // past ttl, another process is refreshing
+        kRefresh,   // past ttl, the caller should refresh it
+        kPending    // claimed, another process is fetching it
+    };
+
+    static ResponseCache* instance();
+
+    bool Init();
+    bool enabled() const { return NULL != header_; }
+
+    Status Lookup(const std::string& key, int64_t refresh_timeout_ms,
+        int* code, SharedBuffer* body, size_t* body_len);
+    bool Store(const std::string& key, int code, const char* body,
+        size_t body_len, int64_t ttl_ms, int64_t stale_ms);
+
+    // Marks key as being fetched for up to timeout_ms, false when it
+    // already has an entry or a claim. Store() replaces the claim,
+    // Unclaim() drops it when no response is coming.
+    bool Claim(const std::string& key, int64_t timeout_ms);
+    void Unclaim(const std::string& key);
+
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t stale_hits;
+        uint64_t misses;
+        uint64_t stores;
+        uint64_t evictions;
+        uint64_t entries;
+        uint64_t used_bytes;
+    };
+
+    void GetStats(Stats* stats) const;
+
+private:
+    ResponseCache();
+    ~ResponseCache();
+    friend class Singleton<ResponseCache>;
+
+    struct Entry;
+    struct Header;
+
+    Entry* Find(const std::string& key);
+    Entry* NewEntry(const std::string& key, size_t body_len);
+    bool Link(Entry* entry);
+    void Remove(Entry* entry);
+    void Evict(size_t bytes);
+
+    shs_mem_allocator_t* allocator_;
+    Header* header_;
+};
+
+} // namespace downstream
+} // namespace shs
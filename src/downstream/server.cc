@@ -4,6 +4,7 @@
 
 #include "downstream/host.h"
 
+#include "histogram.h"
 #include "module.h"
 
 namespace shs 
@@ -16,6 +17,7 @@ Server::Server(Module* module, int port, const Option& option)
     , port_(port)
     , option_(option)
     , group_(HostGroupProvider::instance()->Create(this))
+    , latency_id_(-2)
 {
 }
 
@@ -45,7 +47,7 @@ Host* Server::GetMasterHostByIndex(size_t index)
 }
 
 Host* Server::Create(size_t hash, int retry_cnt,
-    std::set<int>& history_hosts, ErrCode* ec)
+    HostSet& history_hosts, ErrCode* ec)
 {
     Host* host = group_->SelectHost(hash, history_hosts, retry_cnt);
     if (!host) 
@@ -94,5 +96,15 @@ std::string Server::name() const
     return name_;
 }
 
+int Server::latency_id()
+{
+    if (latency_id_ == -2)
+    {
+        latency_id_ = LatencyHistogram::Resolve("downstream:" + name());
+    }
+
+    return latency_id_;
+}
+
 } // namespace downstream
 } // namespace shs
@@ -29,18 +29,69 @@ class HostGroup;
 class Server : boost::noncopyable 
 {
 public:
+    enum Balance
+    {
+        kConsistentHash,    // maglev table, default
+        kLeastRequest,      // power of two choices by inflight * ewma
+        kBoundedLoadHash    // ring, capped at load_factor * average load
+    };
+
     struct Option
     {
         uint32_t timeout_con;
         uint32_t timeout_rcv;
         uint32_t max_retry_con_num;
         uint32_t max_retry_req_num;
+        Balance balance;
+        double load_factor;
+
+        // failed replies in a row before a host stops counting as healthy
+        // (strict checks and slaves: after one); 0 keeps replies from
+        // marking hosts down at all
+        uint32_t max_fails;
+
+        // circuit breaker, disabled while breaker_error_rate is 0
+        uint32_t breaker_error_rate;        // percent of failed responses
+        uint32_t breaker_min_requests;      // responses needed to judge
+        uint32_t breaker_latency;           // ms, average; 0 ignores
+        uint32_t breaker_window;            // seconds, at most 60
+        uint32_t breaker_open_time;         // ms before going half-open
+        uint32_t breaker_half_open_trials;  // concurrent probes allowed
+
+        // merge identical in-flight GETs of one worker into a single call,
+        // keyed on uri plus the values of coalesce_headers
+        bool coalesce;
+        std::vector<std::string> coalesce_headers;
+        // with coalesce and cache_ttl, merge them across workers too: the
+        // first claims the key in the ResponseCache, the others wait for
+        // its response to land there, see FLAGS_ds_coalesce_poll_interval
+        bool coalesce_shared;
+
+        // keep 200 GET responses in the shared ResponseCache for
+        // cache_ttl ms, then serve them stale for up to cache_stale ms
+        // while a single caller refreshes; 0 disables. Entries are keyed
+        // on name(), so give servers created in a worker a set_name().
+        uint32_t cache_ttl;
+        uint32_t cache_stale;
 
         Option(uint32_t timeout_conn, uint32_t timeout_recv, uint32_t retry)
             : timeout_con(timeout_conn)
             , timeout_rcv(timeout_recv)
             , max_retry_con_num(retry)
             , max_retry_req_num(0)
+            , balance(kConsistentHash)
+            , load_factor(1.25)
+            , max_fails(3)
+            , breaker_error_rate(0)
+            , breaker_min_requests(20)
+            , breaker_latency(0)
+            , breaker_window(10)
+            , breaker_open_time(5000)
+            , breaker_half_open_trials(1)
+            , coalesce(false)
+            , coalesce_shared(false)
+            , cache_ttl(0)
+            , cache_stale(0)
         {}
     };
 
@@ -48,7 +99,7 @@ public:
     virtual ~Server();
 
     Host* Create(size_t hash, int retry_cnt,
-        std::set<int> &history_hosts, ErrCode* ec);
+        HostSet& history_hosts, ErrCode* ec);
 
     void AddMasterServer(const std::vector<std::string>& hosts);
     void AddSlaveServer(const std::vector<std::string>& hosts);
@@ -60,7 +111,7 @@ public:
     HostGroup* group() const { return group_; }
     size_t GetAliveHostCount() const { return group_->GetAliveHostCount(); }
     uint16_t port() const { return port_; } 
-    void set_name(const std::string& name) { name_ = name; }
+    void set_name(const std::string& name) { name_ = name; latency_id_ = -2; }
 
     const std::string type() const;
 
@@ -74,6 +125,9 @@ public:
 
     std::string name() const;
 
+    // The "downstream:<name>" histogram id, resolved on first use.
+    int latency_id();
+
 private:
     Module* module_;
     uint16_t port_;
@@ -81,6 +135,7 @@ private:
 
     HostGroup* group_;
     std::string name_;
+    int latency_id_;
 };
 
 } // namespace downstream
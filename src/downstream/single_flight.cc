@@ -0,0 +1,92 @@
+#include "single_flight.h"
+
+#include <pthread.h>
+
+#include "log/logging.h"
+
+namespace shs
+{
+namespace downstream
+{
+
+namespace
+{
+
+__thread SingleFlight* t_single_flight = NULL;
+
+pthread_once_t g_once = PTHREAD_ONCE_INIT;
+pthread_key_t g_key;
+
+// Handlers still parked belong to the exiting thread's loop, which runs
+// none of them any more.
+void DeleteSingleFlight(void* data)
+{
+    delete static_cast<SingleFlight*>(data);
+}
+
+void CreateKey()
+{
+    pthread_key_create(&g_key, DeleteSingleFlight);
+}
+
+} // namespace
+
+SingleFlight* SingleFlight::instance()
+{
+    if (NULL == t_single_flight)
+    {
+        pthread_once(&g_once, CreateKey);
+        t_single_flight = new SingleFlight();
+        pthread_setspecific(g_key, t_single_flight);
+    }
+
+    return t_single_flight;
+}
+
+bool SingleFlight::Join(const std::string& key,
+    const ResponseHandler& handler)
+{
+    std::map<std::string, Waiters>::iterator it = calls_.find(key);
+    if (it == calls_.end())
+    {
+        calls_[key].push_back(handler);
+
+        return false;
+    }
+
+    it->second.push_back(handler);
+
+    return true;
+}
+
+void SingleFlight::Complete(const std::string& key, ErrCode ec,
+    boost::shared_ptr<Response> response)
+{
+    std::map<std::string, Waiters>::iterator it = calls_.find(key);
+    if (it == calls_.end())
+    {
+        return;
+    }
+
+    // Detach first, a handler may start a new flight for the same key.
+    Waiters waiters;
+    waiters.swap(it->second);
+    calls_.erase(it);
+
+    for (size_t i = 0; i < waiters.size(); i++)
+    {
+        try
+        {
+            waiters[i](ec, response);
+        }
+        catch (...)
+        {
+            SLOG(ERROR) << "SingleFlight handler throws exception"
+                << "\tkey=" << key
+                << "\twaiters=" << waiters.size();
+        }
+    }
+}
+
+} // namespace downstream
+} // namespace shs
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "downstream/err_code.h"
+#include "downstream/response.h"
+
+namespace shs
+{
+namespace downstream
+{
+
+// Per-worker table of in-flight calls. The first caller of a key goes to
+// the network, callers that Join() while it is pending are parked and
+// get the same Response once the leader completes.
+class SingleFlight : boost::noncopyable
+{
+public:
+    static SingleFlight* instance();
+
+    // Returns true if a call for key is already in flight; the handler
+    // is then queued and must not issue its own request.
+    bool Join(const std::string& key, const ResponseHandler& handler);
+    void Complete(const std::string& key, ErrCode ec,
+        boost::shared_ptr<Response> response);
+
+    size_t size() const { return calls_.size(); }
+
+private:
+    SingleFlight() {}
+
+    typedef std::vector<ResponseHandler> Waiters;
+    std::map<std::string, Waiters> calls_;
+};
+
+} // namespace downstream
+} // namespace shs
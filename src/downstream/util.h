@@ -65,6 +65,8 @@ inline std::string ErrCodeToString(ErrCode ec)
         return "Select server from group fail";
     case E_OTHER_FAIL:
         return "Other fail";
+    case E_CIRCUIT_OPEN:
+        return "Circuit breaker open";
     case E_HTTP_INVALID_HEADER:
         return "Http invalid header";
     case E_HTTP_INVALID_BODY:
@@ -14,12 +14,16 @@
 #include "http/invoke_params.h"
 #include "log/logging.h"
 #include "core/shs_event_timer.h"
+#include "downstream/health_checker.h"
+#include "downstream/response_cache.h"
 
 #include "event_watcher.h"
 #include "result_wrapper.h"
 #include "module_wrapper.h"
 #include "config.h"
 #include "stats.h"
+#include "histogram.h"
+#include "trace.h"
 #include "process_cycle.h"
 
 extern bool g_running;
@@ -134,6 +138,11 @@ bool Framework::InitInMaster()
 {
     bool init_success = true;
 
+    if (!downstream::ResponseCache::instance()->Init())
+    {
+        fprintf(stderr, "Init downstream response cache failed\n");
+    }
+
     if (0 == modules_.size()) 
     {
         DIR *dir = opendir(cfg_->mod_path().c_str());
@@ -245,6 +254,10 @@ bool Framework::InitInMonitor(event_base_t *base,
     event_timer_ = timer;
     conn_pool_ = conn_pool;
 
+    health_checker_.reset(new downstream::HealthChecker(event_base_, 
+        event_timer_, conn_pool_));
+    health_checker_->Start();
+
     return true;
 }
 
@@ -265,6 +278,11 @@ void Framework::Stop()
 {
     bool wait = false;
 
+    if (health_checker_)
+    {
+        health_checker_->Stop();
+    }
+
     if (!exiting)
     {
         exiting = true;
@@ -374,8 +392,13 @@ void Framework::Invoke(
         return;
     }
     timers_[invoke_id]->set_module(module_name);
+    timers_[invoke_id]->set_method(method_name);
 
     invoke_params->set_enqueue_time(Timestamp::Now().MicroSecondsSinceEpoch());
+    if (invoke_params->trace())
+    {
+        invoke_params->trace()->Mark(kTraceEnqueue);
+    }
     invoke_params->set_timer_queue_size(timers_.size());
     invoke_params->set_timer(timers_[invoke_id]);
  
@@ -404,13 +427,20 @@ void Framework::Invoke(
     {
         module->Invoke(method_name, request_params,
             std::tr1::bind(&Framework::InvokeComplete, this, 
-            invoke_id, ignore_stats, std::tr1::placeholders::_1), invoke_params);
+            invoke_id, ignore_stats, invoke_params, 
+            std::tr1::placeholders::_1), invoke_params);
     }
 }
 
 void Framework::InvokeComplete(uint64_t id, bool ignore_stats,
+    boost::shared_ptr<InvokeParams> invoke_params,
     const InvokeResult& result)
 {
+    if (invoke_params->trace())
+    {
+        invoke_params->trace()->Mark(kTraceInvoked);
+    }
+
     bool need_notify = false;
     {
         boost::mutex::scoped_lock lock(results_mtx_);
@@ -447,6 +477,31 @@ bool Framework::AddInvokeTimer(
     return true;
 }
 
+// Runs in the framework loop only, so the id cache needs no lock.
+void Framework::RecordLatency(const InvokeTimer& timer)
+{
+    std::map<std::string, LatencyIds>& methods = latency_ids_[timer.module()];
+    std::map<std::string, LatencyIds>::iterator it =
+        methods.find(timer.method());
+    if (it == methods.end())
+    {
+        std::string name = timer.module() + "/" + timer.method();
+
+        LatencyIds ids;
+        ids.total = LatencyHistogram::Resolve("total:" + name);
+        ids.queue = LatencyHistogram::Resolve("queue:" + name);
+        ids.invoke = LatencyHistogram::Resolve("invoke:" + name);
+        it = methods.insert(std::make_pair(timer.method(), ids)).first;
+    }
+
+    int64_t total = (int64_t)(timer.ElapsedTime() * 1000000);
+    int64_t queue = (int64_t)(timer.ElapsedTimeInQueue() * 1000000);
+
+    LatencyHistogram::Record(it->second.total, total);
+    LatencyHistogram::Record(it->second.queue, queue);
+    LatencyHistogram::Record(it->second.invoke, total - queue);
+}
+
 void Framework::HandleInvokeTimeout(uint64_t id, bool ignore_stats)
 {
     auto it = timers_.find(id);
@@ -465,6 +520,7 @@ void Framework::HandleInvokeTimeout(uint64_t id, bool ignore_stats)
         ProcessStats::AddTimeoutRequest();
         ProcessStats::AddInvokeElapsedTime(timer->ElapsedTime());
         ProcessStats::AddElapsedTimeInQueue(timer->ElapsedTimeInQueue());
+        RecordLatency(*timer);
     }
 
     ProcessStats::SetQueueSize(timers_.size());
@@ -517,6 +573,7 @@ void Framework::HandleInvokeComplete()
         {
             ProcessStats::AddInvokeElapsedTime(timer->ElapsedTime());
             ProcessStats::AddElapsedTimeInQueue(timer->ElapsedTimeInQueue());
+            RecordLatency(*timer);
         }
     }
 
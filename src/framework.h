@@ -27,6 +27,11 @@ class ResultWrapper;
 class ModuleWrapper;
 class InvokeTimer;
 
+namespace downstream
+{
+class HealthChecker;
+} // namespace downstream
+
 class Framework 
 {
 public:
@@ -76,9 +81,11 @@ private:
     bool AddInvokeTimer(const InvokeCompleteHandler& complete_handler,
         uint64_t id, int32_t timeout_ms, bool ignore_stats);
     void InvokeComplete(uint64_t id, bool ignore_stats, 
+        boost::shared_ptr<InvokeParams> invoke_params,
         const InvokeResult& result);
     void HandleInvokeComplete();
     void HandleInvokeTimeout(uint64_t id, bool ignore_stats);
+    void RecordLatency(const InvokeTimer& timer);
 
 protected:
     Config *cfg_;
@@ -92,8 +99,18 @@ protected:
     std::vector<boost::shared_ptr<ResultWrapper> > results_;
     boost::scoped_ptr<PipedEventWatcher> result_watcher_;
     boost::scoped_ptr<TimedEventWatcher> waiting_stop_;
+    boost::scoped_ptr<downstream::HealthChecker> health_checker_;
     boost::mutex results_mtx_;
 
+    // histogram ids per module and method, resolved on first use
+    struct LatencyIds
+    {
+        int total;
+        int queue;
+        int invoke;
+    };
+    std::map<std::string, std::map<std::string, LatencyIds> > latency_ids_;
+
     uint64_t invoke_id_;
     bool exiting;
     bool ev_has_been_added;
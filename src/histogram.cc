@@ -0,0 +1,464 @@
+#include "histogram.h"
+
+#include <errno.h>
+#include <algorithm>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <gflags/gflags.h>
+
+#include "process.h"
+#include "core/shs_lock.h"
+#include "core/shs_shmem.h"
+#include "core/shs_types.h"
+
+namespace shs
+{
+
+DECLARE_int32(num_processes);
+
+namespace
+{
+
+const int kMaxHistograms = 128;
+const int kNameSize = 56;
+
+struct Counts
+{
+    uint64_t total;
+    uint64_t sum;
+    uint32_t buckets[LatencyHistogram::kBuckets];
+};
+
+struct Window
+{
+    volatile int64_t epoch;
+    Counts counts;
+};
+
+struct Shard
+{
+    Counts all;
+    Window windows[LatencyHistogram::kWindows];
+} __attribute__((aligned(DEFAULT_CACHELINE_SIZE)));
+
+struct Key
+{
+    uint32_t hash;
+    char name[kNameSize];
+};
+
+// The last block takes whatever has no slot of its own: the master and
+// slots past the others.
+struct Region
+{
+    pthread_mutex_t mutex;
+    volatile int32_t num_keys;
+    int32_t num_blocks;
+    Key keys[kMaxHistograms];
+    Shard shards[1];                    // [num_blocks][kMaxHistograms]
+};
+
+Region* g_region = NULL;
+
+// What a thread counted since it last added to its block.
+struct Pending
+{
+    time_t sec;
+    Counts counts;
+};
+
+struct ThreadCounts
+{
+    Pending* pending[kMaxHistograms];
+};
+
+pthread_once_t g_once = PTHREAD_ONCE_INIT;
+pthread_key_t g_thread_key;
+
+__thread ThreadCounts* t_counts = NULL;
+
+uint32_t HashName(const char* name, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+int FindKey(const std::string& name, uint32_t hash, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (g_region->keys[i].hash == hash
+            && 0 == strncmp(g_region->keys[i].name, name.c_str(),
+                kNameSize - 1))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Keys are only ever appended: the name is written before num_keys is
+// bumped, so lookups need no lock.
+int GetKey(const std::string& name)
+{
+    uint32_t hash = HashName(name.data(),
+        std::min(name.size(), (size_t)kNameSize - 1));
+
+    int idx = FindKey(name, hash, g_region->num_keys);
+    if (idx >= 0)
+    {
+        return idx;
+    }
+
+    int ret = pthread_mutex_lock(&g_region->mutex);
+    if (ret == EOWNERDEAD)
+    {
+        pthread_mutex_consistent(&g_region->mutex);
+    }
+    else if (ret != 0)
+    {
+        return -1;
+    }
+
+    int n = g_region->num_keys;
+    idx = FindKey(name, hash, n);
+    if (idx < 0 && n < kMaxHistograms)
+    {
+        Key* key = &g_region->keys[n];
+        strncpy(key->name, name.c_str(), kNameSize - 1);
+        key->hash = hash;
+        __sync_synchronize();
+        g_region->num_keys = n + 1;
+        idx = n;
+    }
+
+    pthread_mutex_unlock(&g_region->mutex);
+
+    return idx;
+}
+
+int ProcessBlock()
+{
+    int last = g_region->num_blocks - 1;
+
+    if (g_process_slot < 0 || g_process_slot >= last
+        || g_processes[g_process_slot].pid != getpid())
+    {
+        return last;
+    }
+
+    return g_process_slot;
+}
+
+void AddCounts(Counts* to, const Counts* from)
+{
+    for (int i = 0; i < LatencyHistogram::kBuckets; i++)
+    {
+        if (from->buckets[i])
+        {
+            __sync_fetch_and_add(&to->buckets[i], from->buckets[i]);
+        }
+    }
+
+    __sync_fetch_and_add(&to->total, from->total);
+    __sync_fetch_and_add(&to->sum, from->sum);
+}
+
+// A second's counts go to the block's totals and to the window the second
+// falls in. The first writer of a new period recycles the oldest window;
+// a concurrent write into it may be lost, which is fine for a view.
+void Flush(int id, Pending* pending)
+{
+    if (0 == pending->counts.total)
+    {
+        return;
+    }
+
+    Shard* shard = &g_region->shards[ProcessBlock() * kMaxHistograms + id];
+    AddCounts(&shard->all, &pending->counts);
+
+    int64_t epoch = pending->sec / LatencyHistogram::kWindowSeconds;
+    Window* window = &shard->windows[epoch % LatencyHistogram::kWindows];
+    int64_t old = window->epoch;
+    if (old < epoch && CAS(&window->epoch, old, epoch))
+    {
+        memset(&window->counts, 0, sizeof(window->counts));
+    }
+
+    if (window->epoch == epoch)
+    {
+        AddCounts(&window->counts, &pending->counts);
+    }
+
+    memset(&pending->counts, 0, sizeof(pending->counts));
+}
+
+void FlushThread(void* data)
+{
+    ThreadCounts* counts = (ThreadCounts *)data;
+
+    for (int i = 0; i < kMaxHistograms; i++)
+    {
+        if (counts->pending[i])
+        {
+            Flush(i, counts->pending[i]);
+            free(counts->pending[i]);
+        }
+    }
+
+    free(counts);
+}
+
+// The forking thread's counts stay with the parent.
+void ForgetThread()
+{
+    for (int i = 0; t_counts && i < kMaxHistograms; i++)
+    {
+        if (t_counts->pending[i])
+        {
+            memset(&t_counts->pending[i]->counts, 0, sizeof(Counts));
+        }
+    }
+}
+
+void InitThreadKey()
+{
+    pthread_key_create(&g_thread_key, FlushThread);
+    pthread_atfork(NULL, NULL, ForgetThread);
+}
+
+Pending* ThreadPending(int id)
+{
+    if (NULL == t_counts)
+    {
+        pthread_once(&g_once, InitThreadKey);
+
+        t_counts = (ThreadCounts *)calloc(1, sizeof(ThreadCounts));
+        if (NULL == t_counts)
+        {
+            return NULL;
+        }
+
+        pthread_setspecific(g_thread_key, t_counts);
+    }
+
+    if (NULL == t_counts->pending[id])
+    {
+        t_counts->pending[id] = (Pending *)calloc(1, sizeof(Pending));
+    }
+
+    return t_counts->pending[id];
+}
+
+void MergeCount(const Counts* counts, uint64_t* buckets,
+    uint64_t* total, uint64_t* sum)
+{
+    for (int i = 0; i < LatencyHistogram::kBuckets; i++)
+    {
+        buckets[i] += counts->buckets[i];
+    }
+
+    *total += counts->total;
+    *sum += counts->sum;
+}
+
+int64_t Percentile(const uint64_t* buckets, uint64_t total, double q)
+{
+    uint64_t rank = (uint64_t)(q * total + 0.999999);
+    uint64_t seen = 0;
+
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+
+    for (int i = 0; i < LatencyHistogram::kBuckets; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+            return LatencyHistogram::BucketValue(i);
+        }
+    }
+
+    return LatencyHistogram::BucketValue(LatencyHistogram::kBuckets - 1);
+}
+
+} // namespace
+
+bool LatencyHistogram::Init()
+{
+    // every process of this and the next generation, the monitor included,
+    // and the one for the rest
+    int blocks = 2 * (std::max(FLAGS_num_processes, 1) + 1) + 1;
+    if (blocks > MAX_PROCESSES + 1)
+    {
+        blocks = MAX_PROCESSES + 1;
+    }
+
+    size_t size = offsetof(Region, shards) 
+        + sizeof(Shard) * kMaxHistograms * blocks;
+
+    void* mem = shs_shm_map(size, NULL);
+    if (NULL == mem)
+    {
+        fprintf(stderr, "histogram_init: mmap failed! err=%s\n",
+            strerror(errno));
+
+        return false;
+    }
+
+    // anonymous mappings come zeroed, only the mutex needs setting up
+    Region* region = (Region *)mem;
+    region->num_blocks = blocks;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&region->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    g_region = region;
+
+    return true;
+}
+
+int LatencyHistogram::BucketIndex(int64_t us)
+{
+    if (us < kSubBuckets)
+    {
+        return us < 0 ? 0 : (int)us;
+    }
+
+    if (us >= (1LL << 32))
+    {
+        return kBuckets - 1;
+    }
+
+    int e = 63 - __builtin_clzll((uint64_t)us);
+    int sub = (int)((us >> (e - 4)) & (kSubBuckets - 1));
+
+    return kSubBuckets + (e - 4) * kSubBuckets + sub;
+}
+
+// The upper bound of the bucket.
+int64_t LatencyHistogram::BucketValue(int index)
+{
+    if (index < kSubBuckets)
+    {
+        return index;
+    }
+
+    int e = (index - kSubBuckets) / kSubBuckets + 4;
+    int sub = (index - kSubBuckets) % kSubBuckets;
+
+    return ((int64_t)(kSubBuckets + sub + 1) << (e - 4)) - 1;
+}
+
+int LatencyHistogram::Resolve(const std::string& name)
+{
+    if (NULL == g_region)
+    {
+        return -1;
+    }
+
+    return GetKey(name);
+}
+
+void LatencyHistogram::Record(int id, int64_t us)
+{
+    if (NULL == g_region || id < 0 || id >= kMaxHistograms)
+    {
+        return;
+    }
+
+    Pending* pending = ThreadPending(id);
+    if (NULL == pending)
+    {
+        return;
+    }
+
+    time_t now = time(NULL);
+    if (pending->sec != now)
+    {
+        Flush(id, pending);
+        pending->sec = now;
+    }
+
+    int bucket = BucketIndex(us);
+    pending->counts.buckets[bucket]++;
+    pending->counts.total++;
+    pending->counts.sum += (uint64_t)us;
+}
+
+void LatencyHistogram::GetSummaries(bool recent,
+    std::vector<Summary>* summaries)
+{
+    if (NULL == g_region)
+    {
+        return;
+    }
+
+    int64_t epoch = time(NULL) / kWindowSeconds;
+    int n = g_region->num_keys;
+
+    for (int i = 0; i < n; i++)
+    {
+        uint64_t buckets[kBuckets];
+        uint64_t total = 0;
+        uint64_t sum = 0;
+
+        memset(buckets, 0, sizeof(buckets));
+
+        for (int b = 0; b < g_region->num_blocks; b++)
+        {
+            const Shard* shard = &g_region->shards[b * kMaxHistograms + i];
+            if (!recent)
+            {
+                MergeCount(&shard->all, buckets, &total, &sum);
+
+                continue;
+            }
+
+            for (int w = 0; w < kWindows; w++)
+            {
+                const Window* window = &shard->windows[w];
+                if (window->epoch > epoch - kWindows
+                    && window->epoch <= epoch)
+                {
+                    MergeCount(&window->counts, buckets, &total, &sum);
+                }
+            }
+        }
+
+        if (total == 0)
+        {
+            continue;
+        }
+
+        Summary summary;
+        summary.name = g_region->keys[i].name;
+        summary.count = total;
+        summary.sum = sum;
+        summary.p50 = Percentile(buckets, total, 0.50);
+        summary.p90 = Percentile(buckets, total, 0.90);
+        summary.p99 = Percentile(buckets, total, 0.99);
+        summary.p999 = Percentile(buckets, total, 0.999);
+        summary.max = Percentile(buckets, total, 1.0);
+
+        summaries->push_back(summary);
+    }
+}
+
+} // namespace shs
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace shs
+{
+
+// Log-linear (HDR style) latency histograms in a shared mapping, keyed
+// by name, e.g. "invoke:module/method" or "downstream:server_80_0".
+//
+// Values are microseconds. Below 16us every value has its own bucket,
+// above that each power of two is split into 16 sub-buckets, so a
+// reported percentile is at most ~6% above the true value.
+//
+// Every process slot has a block of its own. A recording thread counts
+// into thread-local buckets and adds them to its process's block when
+// the second changes and when it exits; readers merge all blocks. Besides
+// the totals since start, every block keeps a ring of 10s windows for
+// the last-60s view.
+struct LatencyHistogram
+{
+    static const int kSubBuckets = 16;
+    static const int kBuckets = 16 + 28 * kSubBuckets;   // up to ~71min
+    static const int kWindows = 6;
+    static const int kWindowSeconds = 10;
+
+    struct Summary
+    {
+        std::string name;
+        uint64_t count;
+        uint64_t sum;
+        int64_t p50;
+        int64_t p90;
+        int64_t p99;
+        int64_t p999;
+        int64_t max;
+    };
+
+    // Must run in the master, before the workers are forked, and after
+    // the flags are parsed: there is a block per process slot of this and
+    // the next generation.
+    static bool Init();
+
+    // Returns the id of the named histogram, creating it on first use,
+    // or -1 once the table is full. Ids never change, so callers resolve
+    // a name once and keep the id for Record().
+    static int Resolve(const std::string& name);
+
+    // A negative id is ignored.
+    static void Record(int id, int64_t us);
+
+    // Merged over every block; recent limits it to the last 60s.
+    static void GetSummaries(bool recent, std::vector<Summary>* summaries);
+
+    static int BucketIndex(int64_t us);
+    static int64_t BucketValue(int index);
+};
+
+} // namespace shs
@@ -35,11 +35,14 @@
 #include "core/shs_epoll.h"
 
 #include "stats.h"
+#include "trace.h"
+#include "access_log.h"
 
 namespace shs 
 {
 
 DECLARE_string(default_module);
+DECLARE_string(trace_header);
 DEFINE_bool(disable_http_keepalive, false, "disable http 1.1 keepalive");
 
 static int http_get_request_with_connection(http_conn_t *);
@@ -229,6 +232,23 @@ static int conn_send(http_req_t *req)
 
     buffer_reset(req->out);
 
+    if (req->out_body)
+    {
+        size = buffer_size(req->out_body);
+        while (size)
+        {
+            n = c->send(c, req->out_body->pos, size);
+            if (n <= 0)
+            {
+                return n;
+            }
+
+            req->out_body->pos += n;
+            size -= n;
+            done += n;
+        }
+    }
+
     return done;
 }
 
@@ -411,7 +431,25 @@ static void http_make_header(http_req_t *req)
     memcpy(req->out->last, "\r\n", 2);
     req->out->last += 2;
 
-    if (req->output_body.len != 0) 
+    if (req->output_body_ref)
+    {
+        buffer_t *body = (buffer_t *)pool_calloc(req->mempool, 
+            sizeof(buffer_t));
+        if (!body)
+        {
+            SLOG(ERROR) << __FILE__ << ":" << __LINE__ 
+                << " pool_calloc() failed.";
+
+            return;
+        }
+
+        body->start = body->pos = req->output_body.data;
+        body->end = body->last = req->output_body.data + req->output_body.len;
+        body->memory = 1;
+
+        req->out_body = body;
+    }
+    else if (req->output_body.len != 0) 
     {
         size_t head_len = buffer_size(req->out);
         size_t body_len = req->output_body.len;
@@ -546,6 +584,54 @@ static void http_conn_done(http_conn_t *hc, http_req_t *req)
     }
 }
 
+static int http_append_body(http_req_t *req, const uchar_t *data, size_t len)
+{
+    if (len > (size_t)req->ntoread - req->input_body.len)
+    {
+        len = req->ntoread - req->input_body.len;
+    }
+
+    // grows with what has arrived, doubling, rather than trusting the
+    // peer's Content-Length up front; never past it
+    size_t size = req->input_body.len + len;
+    if (size > req->input_body_size)
+    {
+        size_t grow = req->input_body_size * 2;
+        if (grow < size)
+        {
+            grow = size;
+        }
+
+        if (grow < HTTP_BODY_MIN_ALLOC)
+        {
+            grow = HTTP_BODY_MIN_ALLOC;
+        }
+
+        if (grow > (size_t)req->ntoread)
+        {
+            grow = req->ntoread;
+        }
+
+        uchar_t *buf = (uchar_t *)memory_realloc(req->input_body_buf, grow);
+        if (!buf)
+        {
+            SLOG(ERROR) << __FILE__ << ":" << __LINE__ 
+                << " memory_realloc() failed."; 
+
+            return SHS_ERROR;
+        }
+
+        req->input_body_buf = buf;
+        req->input_body_size = grow;
+        req->input_body.data = buf;
+    }
+
+    memory_memcpy(req->input_body.data + req->input_body.len, data, len);
+    req->input_body.len += len;
+
+    return SHS_OK;
+}
+
 static void http_read_body(http_conn_t *hc, http_req_t *req)
 {
     buffer_t *buf = req->in;
@@ -559,56 +645,33 @@ static void http_read_body(http_conn_t *hc, http_req_t *req)
             req->input_body.data = buf->pos;
             req->input_body.len = req->ntoread;
         }
-        else
+        else if (http_append_body(req, buf->pos, blen) != SHS_OK)
         {
-            size_t len = req->input_body.len + blen;
-            uchar_t *data = (uchar_t *)pool_calloc(req->mempool, len);
-            if (!data)
-            {
-                SLOG(ERROR) << __FILE__ << ":" << __LINE__ 
-                    << " pool_calloc() failed."; 
-            }
-            memory_memcpy(data, req->input_body.data, req->input_body.len);
-            memory_memcpy(data + req->input_body.len, buf->pos, blen);
-            req->input_body.data = data;
-            req->input_body.len = len;
+            http_conn_fail(hc, HTTP_CODE_INVALID_BODY);
+
+            return;
         }
 
         buf->pos += blen;
         req->ntoread = 0;
         req->read_done = 0;
 
+        if (req->trace)
+        {
+            req->trace->Mark(kTraceBody);
+        }
+
         http_conn_done(hc, req);
 
         return;
     }
     else if (blen > 0)
     {
-        if (0 == req->input_body.len)
+        if (http_append_body(req, buf->pos, blen) != SHS_OK)
         {
-            req->input_body.data = (uchar_t *)pool_calloc(
-                req->mempool, blen);
-            if (!req->input_body.data)
-            {
-                SLOG(ERROR) << __FILE__ << ":" << __LINE__ 
-                    << " pool_calloc() failed."; 
-            }
-            memory_memcpy(req->input_body.data, buf->pos, blen);
-            req->input_body.len = blen;
-        }
-        else
-        {
-            size_t len = req->input_body.len + blen;
-            uchar_t *data = (uchar_t *)pool_calloc(req->mempool, len);
-            if (!data)
-            {
-                SLOG(ERROR) << __FILE__ << ":" << __LINE__ 
-                    << " pool_calloc() failed.";
-            }
-            memory_memcpy(data, req->input_body.data, req->input_body.len);
-            memory_memcpy(data + req->input_body.len, buf->pos, blen);
-            req->input_body.data = data;
-            req->input_body.len = len;
+            http_conn_fail(hc, HTTP_CODE_INVALID_BODY);
+
+            return;
         }
 
         buf->pos += blen;
@@ -651,6 +714,55 @@ static void request_block_writing(http_conn_t *hc)
     event_delete(c->ev_base, wev, EVENT_WRITE_EVENT, EVENT_CLEAR_EVENT);
 }
 
+http_conn_t *http_conn_create()
+{
+    pool_t *mempool = pool_cache_get();
+    if (!mempool)
+    {
+        return NULL;
+    }
+
+    http_conn_t *hc = (http_conn_t *)pool_calloc(mempool, 
+        sizeof(http_conn_t));
+    if (!hc)
+    {
+        pool_cache_put(mempool);
+
+        return NULL;
+    }
+
+    hc->mempool = mempool;
+
+    return hc;
+}
+
+http_req_t *http_request_create()
+{
+    pool_t *mempool = pool_cache_get();
+    if (!mempool)
+    {
+        return NULL;
+    }
+
+    http_req_t *req = (http_req_t *)pool_calloc(mempool, 
+        sizeof(http_req_t));
+    if (!req)
+    {
+        pool_cache_put(mempool);
+
+        return NULL;
+    }
+
+    req->mempool = mempool;
+    req->input_body = string_null;
+    req->output_body = string_null;
+    req->uri = string_null;
+    req->response_code_line = string_null;
+    http_init_headers(req);
+
+    return req;
+}
+
 void http_conn_free(http_conn_t *hc)
 {
     if (hc->req)
@@ -682,7 +794,7 @@ void http_conn_free(http_conn_t *hc)
 
     if (hc->mempool)
     {
-        pool_destroy(hc->mempool);
+        pool_cache_put(hc->mempool);
     }
 }
 
@@ -1272,6 +1384,35 @@ static void http_read_firstline(http_conn_t *hc, http_req_t *req)
     http_read_header(hc, req);
 }
 
+// The first request of a connection is timed from the accept, later ones
+// from their parsed headers.
+static void http_trace_start(http_conn_t *hc, http_req_t *req)
+{
+    if (!Trace::enabled() || !(req->flags & HTTP_REQ_FLAGS_INCOMING))
+    {
+        return;
+    }
+
+    std::string parent;
+    int64_t now = Trace::Now();
+    int64_t start = hc->accept_ns ? hc->accept_ns : now;
+
+    http_find_header(req->input_headers, FLAGS_trace_header, &parent);
+
+    req->trace = Trace::Start(start, parent);
+    if (req->trace)
+    {
+        if (hc->accept_ns)
+        {
+            req->trace->MarkAt(kTraceAccept, hc->accept_ns);
+        }
+
+        req->trace->MarkAt(kTraceHeader, now);
+    }
+
+    hc->accept_ns = 0;
+}
+
 static void http_read_header(http_conn_t *hc, http_req_t *req)
 {
     conn_t *c = hc->c;
@@ -1294,6 +1435,7 @@ static void http_read_header(http_conn_t *hc, http_req_t *req)
     switch (req->kind) 
     {
     case SHS_HTTP_KIND_REQUEST:
+        http_trace_start(hc, req);
         http_get_body(hc, req);
         break;
 
@@ -1405,7 +1547,7 @@ static int http_conn_connect(http_conn_t *hc)
 int http_make_request(http_req_t *req, http_cmd_type type, 
     const std::string& uri, const std::string& body)
 {
-    req->in = buffer_create(req->mempool, CONN_DEFAULT_RCVBUF);
+    req->in = buffer_cache_create(req->mempool, CONN_DEFAULT_RCVBUF);
     req->out = buffer_create(req->mempool, HEADER_SZ);
     if (!req->in || !req->out)
     {
@@ -1484,6 +1626,19 @@ static void http_send_done(http_conn_t *hc, http_req_t *req)
         need_close = true;
     }
 
+    if (req->trace)
+    {
+        req->trace->set_code(req->response_code);
+        req->trace->Mark(kTraceWritten);
+
+        if (AccessLog::enabled())
+        {
+            AccessLog::Append(req->trace, req->response_code, req->type, 
+                hc->host, hc->port, req->input_body.len, 
+                req->output_body.len);
+        }
+    }
+
     http_request_free(req);
 
     if (need_close)
@@ -1556,6 +1711,82 @@ void http_send_reply(http_req_t *req, int code, const std::string& reason,
     http_send(req, data);
 }
 
+void http_send_reply(http_req_t *req, int code, const std::string& reason, 
+    const SharedBuffer& data, size_t len)
+{
+    http_conn_t *hc = req->hc;
+    if (!hc)
+    {
+        http_request_free(req);
+
+        return;
+    }
+
+    http_response_code(req, code, reason);
+
+    req->userdone = true;
+
+    if (data && len > 0)
+    {
+        req->output_body_ref = new SharedBuffer(data);
+        req->output_body.data = (uchar_t *)data.get();
+        req->output_body.len = len;
+    }
+
+    http_make_header(req);
+
+    req->hc->conn_cb = http_send_done;
+    http_write_buffer(req->hc); 
+}
+
+namespace
+{
+
+struct BodyDeleter
+{
+    BodyDeleter(size_t size) : size_(size) {}
+
+    void operator()(const char *p) const
+    {
+        memory_free((void *)p, size_);
+    }
+
+    size_t size_;
+};
+
+} // namespace
+
+SharedBuffer http_take_input_body(http_req_t *req)
+{
+    size_t len = req->input_body.len;
+
+    if (0 == len)
+    {
+        return SharedBuffer();
+    }
+
+    if (req->input_body_buf)
+    {
+        SharedBuffer body((const char *)req->input_body_buf, 
+            BodyDeleter(req->input_body_size));
+        req->input_body_buf = NULL;
+        req->input_body_size = 0;
+
+        return body;
+    }
+
+    // body still points into the receive buffer, which is reused
+    char *data = (char *)memory_alloc(len);
+    if (!data)
+    {
+        return SharedBuffer();
+    }
+
+    memory_memcpy(data, req->input_body.data, len);
+
+    return SharedBuffer(data, BodyDeleter(len));
+}
+
 static void http_response_code(http_req_t *req, int code, 
     const std::string& reason)
 {
@@ -1616,54 +1847,110 @@ static const char uri_chars[256] = {
 #define CHAR_IS_UNRESERVED(c)           \
     (uri_chars[(unsigned char)(c)])
 
-static std::string http_uriencode(const std::string& value, 
-    bool space_as_plus)
+size_t http_encode_uri_len(const char *src, size_t len)
 {
-    std::string result;
-    for (size_t i = 0; i < value.length(); i++) 
+    const uchar_t *p = (const uchar_t *)src;
+    size_t         n = len;
+
+    for (size_t i = 0; i < len; i++) 
     {
-        if (CHAR_IS_UNRESERVED(value[i])) 
+        i += string_alnum_span(p + i, len - i);
+        if (i < len && !CHAR_IS_UNRESERVED(p[i])) 
         {
-            result.append(1, value[i]);
-        } 
-        else if (value[i] == ' ' && space_as_plus) 
+            n += 2;
+        }
+    }
+
+    return n;
+}
+
+char *http_encode_uri_to(char *dst, const char *src, size_t len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    const uchar_t    *p = (const uchar_t *)src;
+    size_t            run = 0;
+
+    for (size_t i = 0; i < len; i++) 
+    {
+        run = string_alnum_span(p + i, len - i);
+        memcpy(dst, p + i, run);
+        dst += run;
+        i += run;
+        if (i == len) 
+        {
+            break;
+        }
+
+        if (CHAR_IS_UNRESERVED(p[i])) 
         {
-            result.append(1, '+');
+            *dst++ = p[i];
         } 
         else 
         {
-            char buf[30];
-            snprintf(buf, sizeof(buf), "%%%02X", 
-                static_cast<unsigned char>(value[i]));
-            result.append(buf);
+            *dst++ = '%';
+            *dst++ = hex[p[i] >> 4];
+            *dst++ = hex[p[i] & 0xf];
         }
     }
 
-    return result;
+    return dst;
 }
 
 std::string http_encode_uri(const std::string& value)
 {
-    return http_uriencode(value, false);
+    std::string result;
+    result.resize(http_encode_uri_len(value.data(), value.size()));
+    http_encode_uri_to(&result[0], value.data(), value.size());
+
+    return result;
+}
+
+static int http_hex_value(char c)
+{
+    if (c >= '0' && c <= '9') 
+    {
+        return c - '0';
+    }
+
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') 
+    {
+        return c - 'a' + 10;
+    }
+
+    return -1;
 }
 
 static void http_decode_uri_internal(const std::string& value, 
     std::string* decode_value, bool decode_plus)
 {
-    for (size_t i = 0; i < value.length(); i++) 
+    const uchar_t *p = (const uchar_t *)value.data();
+    size_t         len = value.length();
+    size_t         run = 0;
+    int            hi = 0, lo = 0;
+
+    decode_value->reserve(decode_value->size() + len);
+
+    for (size_t i = 0; i < len; i++) 
     {
-        auto c = value[i];
-        if (c == '+' && decode_plus) 
+        run = string_cspn2(p + i, len - i, '%', decode_plus ? '+' : '%');
+        decode_value->append((const char *)p + i, run);
+        i += run;
+        if (i == len) 
+        {
+            break;
+        }
+
+        char c = p[i];
+        if (c == '+') 
         {
             c = ' ';
         } 
-        else if (c == '%' && isxdigit(value[i+1]) && isxdigit(value[i+2])) 
+        else if (i + 2 < len
+            && (hi = http_hex_value(p[i + 1])) >= 0
+            && (lo = http_hex_value(p[i + 2])) >= 0) 
         {
-            char tmp[3];
-            tmp[0] = value[i+1];
-            tmp[1] = value[i+2];
-            tmp[2] = '\0';
-            c = static_cast<char>(strtol(tmp, NULL, 16));
+            c = static_cast<char>((hi << 4) | lo);
             i += 2;
         }
         decode_value->append(1, c);
@@ -1769,40 +2056,32 @@ static void http_handle_request(HTTP_CODE ec,
 static void http_get_request(http_srv_t *http, conn_t *c, 
     char *host, int port)
 {
-    pool_t *mempool = pool_create(CONN_DEFAULT_POOL_SIZE, 
-        CONN_DEFAULT_POOL_SIZE);
-    if (!mempool)
-    {
-        conn_release(c);
-        conn_pool_free_connection(http->conn_pool, c);
-
-        return;
-    }
-
-    http_conn_t *hc = (http_conn_t *)pool_calloc(mempool, 
-        sizeof(http_conn_t));
+    http_conn_t *hc = http_conn_create();
     if (!hc)
     {
         conn_release(c);
         conn_pool_free_connection(http->conn_pool, c);
-        pool_destroy(mempool);
 
         return;
     }
 
     ProcessStats::SetServerConns(++http->connections);
 
-    hc->mempool = mempool;
     hc->http_srv = http;
     hc->connpool = http->conn_pool;
     hc->c = c;
-    strcpy(hc->host, host);
+    snprintf(hc->host, sizeof(hc->host), "%s", host);
     hc->port = port;
     hc->flags = HTTP_FLAGS_INCOMING;
     hc->status = HTTP_STATUS_READING_FIRSTLINE;
     hc->timeout_recv = CONN_TIME_OUT;
     hc->timeout_send = CONN_TIME_OUT;
 
+    if (Trace::enabled())
+    {
+        hc->accept_ns = Trace::Now();
+    }
+
     if (http_get_request_with_connection(hc) < 0)
     {
         http_conn_free(hc);
@@ -1840,7 +2119,7 @@ void http_accept_handler(event_t *ev)
     nc->ev_timer = http->timer;
     nc->write->ready = SHS_FALSE;
     
-    char ntop[HOST_LEN];
+    char ntop[HOST_ADDR_LEN];
     char strport[PORT_LEN];
     getnameinfo(reinterpret_cast<struct sockaddr *>(&addr), addrlen, 
         ntop, sizeof(ntop), strport, sizeof(strport), 1 | 2);
@@ -1858,8 +2137,30 @@ static void http_request_free(http_req_t *req)
     req->data = NULL;
     req->cb = NULL;
     req->hc = NULL;
+    buffer_cache_free(req->in);
     req->in = NULL;
     req->out = NULL;
+    req->out_body = NULL;
+
+    if (req->input_body_buf)
+    {
+        memory_free(req->input_body_buf, req->input_body_size);
+        req->input_body_buf = NULL;
+        req->input_body_size = 0;
+    }
+
+    if (req->output_body_ref)
+    {
+        delete req->output_body_ref;
+        req->output_body_ref = NULL;
+    }
+
+    if (req->trace)
+    {
+        req->trace->Unref();
+        req->trace = NULL;
+    }
+
     req->input_body = string_null;
     req->output_body = string_null;
     req->uri = string_null;
@@ -1868,7 +2169,7 @@ static void http_request_free(http_req_t *req)
 
     if (req->mempool)
     {
-        pool_destroy(req->mempool);
+        pool_cache_put(req->mempool);
     }
 }
 
@@ -1885,23 +2186,12 @@ void http_init_headers(http_req_t *req)
 
 static int http_get_request_with_connection(http_conn_t *hc)
 {
-    pool_t *mempool = pool_create(CONN_DEFAULT_POOL_SIZE, 
-        CONN_DEFAULT_POOL_SIZE);
-    if (!mempool)
-    {
-        return -1;
-    }
-
-    http_req_t *req = (http_req_t *)pool_calloc(mempool, 
-        sizeof(http_req_t));
+    http_req_t *req = http_request_create();
     if (!req)
     {
-        pool_destroy(mempool);
-
         return -1;
     }
 
-    req->mempool = mempool;
     req->data = hc->http_srv;
     req->cb = http_handle_request;
     req->hc = hc;
@@ -1914,7 +2204,7 @@ static int http_get_request_with_connection(http_conn_t *hc)
     req->response_code_line = string_null;
     http_init_headers(req);
 
-    req->in = buffer_create(req->mempool, CONN_DEFAULT_RCVBUF);
+    req->in = buffer_cache_create(req->mempool, CONN_DEFAULT_RCVBUF);
     req->out = buffer_create(req->mempool, HEADER_SZ);
     if (!req->in || !req->out)
     {
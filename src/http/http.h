@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string.h>
+#include <netinet/in.h>
 #include <map>
 #include <vector>
 #include <string>
@@ -17,6 +18,8 @@
 namespace shs 
 {
 
+class Trace;
+
 #define HTTP_OK          200
 #define HTTP_NOCONTENT   204
 #define HTTP_MOVEPERM    301
@@ -32,6 +35,8 @@ namespace shs
 #define HTTP_REQ_FLAGS_INCOMING 0x0004
 
 #define HOST_LEN      1024
+#define HOST_ADDR_LEN INET6_ADDRSTRLEN  // numeric peer address text
+#define HTTP_BODY_MIN_ALLOC (16 * 1024)  // first allocation of a split body
 #define PORT_LEN      32
 #define HEADER_SZ     4096
 #define HEADER_NUM    35
@@ -86,6 +91,9 @@ typedef void (*http_req_cb)(HTTP_CODE, http_req_t *, void *);
 
 void http_send_reply(http_req_t *, int, const std::string&, 
     const std::string&);
+void http_send_reply(http_req_t *, int, const std::string&, 
+    const SharedBuffer&, size_t);
+SharedBuffer http_take_input_body(http_req_t *);
 int http_add_input_header(http_req_t *, 
     const std::string&, const std::string&);
 int http_add_output_header(http_req_t *, 
@@ -93,6 +101,8 @@ int http_add_output_header(http_req_t *,
 void http_init_headers(http_req_t *);
 bool http_exist_header(const http_header_t headers[], const std::string&);
 const char* get_reason_phrase(int);
+http_conn_t *http_conn_create();
+http_req_t *http_request_create();
 void http_conn_free(http_conn_t *);
 void http_conn_set_recv_timeout_ms(http_conn_t *, int);
 void http_conn_set_connect_timeout_ms(http_conn_t *, int);
@@ -100,6 +110,8 @@ void http_conn_set_retries(http_conn_t *, int);
 int http_make_request(http_req_t *, http_cmd_type, 
     const std::string&, const std::string&);
 std::string http_encode_uri(const std::string&);
+size_t http_encode_uri_len(const char *, size_t);
+char *http_encode_uri_to(char *, const char *, size_t);
 std::string http_decode_uri(const std::string&, bool);
 void http_parse_query(const std::string&, HttpQuery *);
 void http_accept_handler(event_t *);
@@ -123,6 +135,12 @@ struct http_req_s
     string_t output_body;
     string_t response_code_line;
 
+    uchar_t *input_body_buf;        // malloc'ed body, see http_take_input_body
+    size_t input_body_size;         // bytes allocated at input_body_buf
+    buffer_t *out_body;             // body sent after out without copying
+    SharedBuffer *output_body_ref;  // keeps out_body alive
+    Trace *trace;                   // NULL unless traced, see trace.h
+
     http_header_t input_headers[HEADER_NUM];
     http_header_t output_headers[HEADER_NUM];
     http_request_kind kind;
@@ -138,29 +156,31 @@ struct http_req_s
     bool userdone;
 };
 
+// The handlers run on every readiness event need only the first cache
+// line; the peer address, timeouts and retry counters come after it.
 struct http_conn_s 
 {
+    enum HTTP_CONN_STATUS status;
+    int flags;
     http_req_t *req;
-    pool_t *mempool;
-    http_srv_t *http_srv;
-    conn_pool_t *connpool;
     conn_t *c;
-    event_base_t *base;
-    event_timer_t *timer;
-
     event_handler_pt read_event_handler;
     event_handler_pt write_event_handler;
     http_conn_cb conn_cb;
-    
-    char host[HOST_LEN];
-    int port;
-    int flags;
+    pool_t *mempool;
+    event_base_t *base;
+
+    event_timer_t *timer;
+    http_srv_t *http_srv;
+    conn_pool_t *connpool;
     int timeout_recv;
     int timeout_send;
     int timeout_connect;
     int retry_cnt;
     int retry_max;
-    enum HTTP_CONN_STATUS status;
+    int port;
+    int64_t accept_ns;              // until the first request is traced
+    char host[HOST_ADDR_LEN];
 };
 
 struct http_srv_s
@@ -11,17 +11,22 @@
 #include <gflags/gflags.h>
 
 #include "log/logging.h"
+#include "core/shs_shmem.h"
 
 #include "config.h"
 #include "framework.h"
 #include "http_invoke_params.h"
 #include "process.h"
 #include "stats.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "trace.h"
 
 namespace shs 
 {
 
 DECLARE_bool(rewrite_path_to_default);
+DECLARE_string(trace_header);
 
 using namespace std;
 using namespace boost;
@@ -116,6 +121,15 @@ void HttpStatsHandler(HTTP_CODE ec, http_req_t *req, void *data)
         str_stats += "</status>";
     }
 
+    shs_shm_map_stat_t shm_stat;
+    shs_shm_get_map_stat(&shm_stat);
+    str_stats += boost::str(boost::format("<shm regions=\"%1%\" mapped=\"%2%\" hugetlb=\"%3%\" thp-advised=\"%4%\" populated=\"%5%\" />")
+        % shm_stat.regions
+        % shm_stat.mapped_size
+        % shm_stat.hugetlb_size
+        % shm_stat.advised_size
+        % shm_stat.populated_size);
+
     str_stats += boost::str(boost::format("<queues ppid=\"%1%\">") % getppid());
     int64_t total_queue_size = 0;
     int64_t total_num_requests = 0;
@@ -131,36 +145,46 @@ void HttpStatsHandler(HTTP_CODE ec, http_req_t *req, void *data)
     int index = 0;
     for (int i = 0; i < MAX_PROCESSES; ++i)
     {
-        if (g_processes[i].type == 1)
+        if (g_processes[i].type != 1)
         {
-            total_persistent_num_requests += g_stats->process_stats[i].persistent_num_requests;
-            total_persistent_num_error_requests += g_stats->process_stats[i].persistent_num_error_requests;
-            total_persistent_num_timeout_requests += g_stats->process_stats[i].persistent_num_timeout_requests;
-            total_persistent_invoke_elapsed_time += g_stats->process_stats[i].persistent_invoke_elapsed_time;
+            continue;
         }
+
+        ProcessStats pstats;
+        ProcessStats::Snapshot(i, &pstats);
+
+        total_persistent_num_requests += pstats.persistent_num_requests;
+        total_persistent_num_error_requests += pstats.persistent_num_error_requests;
+        total_persistent_num_timeout_requests += pstats.persistent_num_timeout_requests;
+        total_persistent_invoke_elapsed_time += pstats.persistent_invoke_elapsed_time;
         
-        if (g_processes[i].pid <= 0 || g_processes[i].type != 1)
+        if (g_processes[i].pid <= 0)
         {
             continue;
         }
 
-        total_queue_size += g_stats->process_stats[i].curr_queue_size;
-        total_num_requests += g_stats->process_stats[i].num_requests;
-        total_num_error_requests += g_stats->process_stats[i].num_error_requests;
-        total_num_timeout_requests += g_stats->process_stats[i].num_timeout_requests;
-        total_invoke_elapsed_time += g_stats->process_stats[i].invoke_elapsed_time;
+        total_queue_size += pstats.curr_queue_size;
+        total_num_requests += pstats.num_requests;
+        total_num_error_requests += pstats.num_error_requests;
+        total_num_timeout_requests += pstats.num_timeout_requests;
+        total_invoke_elapsed_time += pstats.invoke_elapsed_time;
         str_stats += 
             boost::str(
-                boost::format("<queue id=\"%1%\" pid=\"%2%\" size=\"%3%\" max=\"%4%\" requests=\"%5%\" timeout=\"%6%\" error=\"%7%\" time-per-request=\"%8%\" queue-time-per-request=\"%9%\" />") 
+                boost::format("<queue id=\"%1%\" pid=\"%2%\" size=\"%3%\" max=\"%4%\" requests=\"%5%\" timeout=\"%6%\" error=\"%7%\" time-per-request=\"%8%\" queue-time-per-request=\"%9%\" log-records=\"%10%\" log-dropped=\"%11%\" pool-cache-hits=\"%12%\" pool-cache-misses=\"%13%\" pool-cache-trims=\"%14%\" />") 
                 % index++
                 % g_processes[i].pid
-                % g_stats->process_stats[i].curr_queue_size 
-                % g_stats->process_stats[i].max_queue_size
-                % g_stats->process_stats[i].num_requests
-                % g_stats->process_stats[i].num_timeout_requests
-                % g_stats->process_stats[i].num_error_requests
-                % g_stats->process_stats[i].persistent_avg_invoke_elapsed_time
-                % g_stats->process_stats[i].persistent_avg_elapsed_time_in_queue);
+                % pstats.curr_queue_size 
+                % pstats.max_queue_size
+                % pstats.num_requests
+                % pstats.num_timeout_requests
+                % pstats.num_error_requests
+                % pstats.persistent_avg_invoke_elapsed_time
+                % pstats.persistent_avg_elapsed_time_in_queue
+                % pstats.log_records
+                % pstats.log_dropped
+                % (uint64_t)pstats.pool_cache.hits
+                % (uint64_t)pstats.pool_cache.misses
+                % (uint64_t)pstats.pool_cache.trims);
     }
 
     g_stats->total_persistent_num_requests = total_persistent_num_requests;
@@ -241,12 +265,123 @@ void HttpStatsHandler(HTTP_CODE ec, http_req_t *req, void *data)
             % g_stats->avg_qps
             );
 
+    str_stats += "<latency>";
+    for (int recent = 0; recent < 2; recent++)
+    {
+        std::vector<LatencyHistogram::Summary> summaries;
+        LatencyHistogram::GetSummaries(recent, &summaries);
+
+        for (size_t i = 0; i < summaries.size(); i++)
+        {
+            const LatencyHistogram::Summary& h = summaries[i];
+            str_stats += boost::str(
+                    boost::format(
+                        "<histogram"
+                            " name=\"%s\""
+                            " window=\"%s\""
+                            " count=\"%lu\""
+                            " avg=\"%lu\""
+                            " p50=\"%ld\""
+                            " p90=\"%ld\""
+                            " p99=\"%ld\""
+                            " p999=\"%ld\""
+                            " max=\"%ld\""
+                        " />")
+                    % h.name
+                    % (recent ? "60s" : "all")
+                    % h.count
+                    % (h.sum / h.count)
+                    % h.p50
+                    % h.p90
+                    % h.p99
+                    % h.p999
+                    % h.max
+                    );
+        }
+    }
+    str_stats += "</latency>";
+
     str_stats += "</stats>";
 
     http_add_output_header(req, "Content-Type", "text/xml; charset=UTF-8"); 
     http_send_reply(req, HTTP_OK, "OK", str_stats);
 }
 
+static bool MatchPath(const http_req_t *req, const char* path)
+{
+    size_t len = strlen(path);
+    const char* uri = (const char *)req->uri.data;
+
+    return req->uri.len >= len && 0 == strncmp(uri, path, len)
+        && (req->uri.len == len || uri[len] == '?');
+}
+
+// The body is rendered into a buffer kept across scrapes and handed to
+// the reply without a copy; it is only reused once the previous reply
+// has released it.
+static void HttpMetricsHandler(http_req_t *req, Framework* framework)
+{
+    static boost::shared_ptr<std::string> buffer;
+
+    if (!buffer || !buffer.unique())
+    {
+        buffer.reset(new std::string());
+    }
+
+    buffer->clear();
+    RenderMetrics(framework->config(), buffer.get());
+
+    http_add_output_header(req, "Content-Type",
+        "application/openmetrics-text; version=1.0.0; charset=utf-8");
+    http_send_reply(req, HTTP_OK, "OK",
+        SharedBuffer(buffer, buffer->data()), buffer->size());
+}
+
+// Most recent finished traces, oldest first; ?n= caps the count.
+static void HttpTracesHandler(http_req_t *req)
+{
+    HttpQuery query;
+    size_t max = 100;
+
+    http_parse_query((const char *)req->uri.data, &query);
+    HttpQuery::iterator it = query.find("n");
+    if (it != query.end() && atoi(it->second.c_str()) > 0)
+    {
+        max = atoi(it->second.c_str());
+    }
+
+    std::vector<TraceRecord> records;
+    TraceRing::Read(max, &records);
+
+    string body;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        TraceRing::Format(records[i], &body);
+    }
+
+    http_add_output_header(req, "Content-Type", "text/plain; charset=UTF-8");
+    http_send_reply(req, HTTP_OK, "OK", body);
+}
+
+// Everything on the monitor port other than /status and /stats.
+void HttpMonitorHandler(HTTP_CODE ec, http_req_t *req, void *data)
+{
+    Framework* framework = (Framework *)data;
+
+    if (MatchPath(req, "/metrics"))
+    {
+        HttpMetricsHandler(req, framework);
+    }
+    else if (MatchPath(req, "/traces"))
+    {
+        HttpTracesHandler(req);
+    }
+    else
+    {
+        http_send_reply(req, HTTP_NOTFOUND, "Not Found", "");
+    }
+}
+
 void HttpStatusHandler(HTTP_CODE ec, http_req_t *req, void *data)
 {
     Framework* framework = (Framework *)data;
@@ -433,6 +568,19 @@ void HttpReqHandler(HTTP_CODE ec, http_req_t *req, void *data)
     invoke_params->set_client_port(req->hc->port);
     invoke_params->set_uri((const char *)req->uri.data);
 
+    if (req->trace)
+    {
+        req->trace->set_name(handler->module_name_ + "/" 
+            + handler->method_name_);
+        invoke_params->set_trace(req->trace);
+
+        if (req->trace->sampled())
+        {
+            http_add_output_header(req, FLAGS_trace_header, 
+                req->trace->id_string());
+        }
+    }
+
     handler->Invoke(boost::bind(&SHSHttpHandler::InvokeReply, handler, _1), 
         handler->module_name_, handler->method_name_, handler->params_, 
         handler->timeout_ms_, invoke_params);
@@ -525,6 +673,11 @@ void SHSHttpHandler::InvokeReply(const InvokeResult& result)
     std::string reason_phrase;
     std::string data;
 
+    if (req_->trace)
+    {
+        req_->trace->Mark(kTraceReply);
+    }
+
     if (ErrorCode::OK == result.ec)
     {   
         auto it = result.results.find("result");
@@ -579,7 +732,7 @@ void SHSHttpHandler::InvokeReply(const InvokeResult& result)
             }
         }
 
-        if (!user_define_response_code && data.empty())
+        if (!user_define_response_code && data.empty() && !result.body)
         {
             SLOG(ERROR) << __FILE__ << ":" << __LINE__ 
                 << "\tBad response, result is empty";
@@ -621,6 +774,14 @@ void SHSHttpHandler::InvokeReply(const InvokeResult& result)
         reason_phrase = get_reason_phrase(response_code);
     }
 
+    if (ErrorCode::OK == result.ec && result.body)
+    {
+        http_send_reply(req_, response_code, reason_phrase, 
+            result.body, result.body_len);
+
+        return;
+    }
+
     http_send_reply(req_, response_code, reason_phrase, data);
 }
 
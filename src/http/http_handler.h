@@ -17,6 +17,7 @@ class HttpInvokeParams;
 void HttpReqHandler(HTTP_CODE ec, http_req_t *req, void *);
 void HttpStatusHandler(HTTP_CODE ec, http_req_t *req, void *);
 void HttpStatsHandler(HTTP_CODE ec, http_req_t *req, void *);
+void HttpMonitorHandler(HTTP_CODE ec, http_req_t *req, void *);
 
 class SHSHttpHandler 
 {
@@ -1,5 +1,6 @@
 #include "invoke_params.h"
 #include "invoke_timer.h"
+#include "trace.h"
 
 namespace shs 
 {
@@ -11,9 +12,18 @@ InvokeParams::InvokeParams()
     , client_port_(0)
     , task_queue_size_(0)
     , timer_queue_size_(0)
+    , trace_(NULL)
 {
 }
 
+InvokeParams::~InvokeParams()
+{
+    if (trace_)
+    {
+        trace_->Unref();
+    }
+}
+
 void InvokeParams::set_request_time(double t)
 {
     request_time_ = t;
@@ -49,4 +59,19 @@ void InvokeParams::set_timer_queue_size(size_t size)
     timer_queue_size_ = size;
 }
 
+void InvokeParams::set_trace(Trace* trace)
+{
+    if (trace)
+    {
+        trace->Ref();
+    }
+
+    if (trace_)
+    {
+        trace_->Unref();
+    }
+
+    trace_ = trace;
+}
+
 } // namespace shs
@@ -12,12 +12,13 @@ namespace shs
 {
 
 class InvokeTimer;
+class Trace;
 
 class InvokeParams 
 {
 public:
     InvokeParams();
-    virtual ~InvokeParams() {}; 
+    virtual ~InvokeParams();
 
     void set_request_time(double t);
     void set_enqueue_time(double t);
@@ -45,6 +46,10 @@ public:
         timer_ = timer;
     }
 
+    // Takes a reference, NULL unless the request is traced.
+    void set_trace(Trace* trace);
+    Trace* trace() const { return trace_; }
+
 protected:
     double      request_time_;
     double      enqueue_time_;
@@ -55,6 +60,7 @@ protected:
     size_t      timer_queue_size_;
 
     boost::weak_ptr<InvokeTimer> timer_;
+    Trace*      trace_;
 };
 
 } // namespace shs
@@ -52,6 +52,13 @@ public:
 
     const std::string& module() const { return module_; }
 
+    void set_method(const std::string& name)
+    {
+        method_ = name;
+    }
+
+    const std::string& method() const { return method_; }
+
     void set_dequeue_time()
     {
         dequeue_time_ = Timestamp::Now();
@@ -63,6 +70,7 @@ private:
     InvokeCompleteHandler complete_handler_;
     boost::scoped_ptr<TimedEventWatcher> timeout_watcher_;
     std::string module_;
+    std::string method_;
 };
 
 } // namespace shs
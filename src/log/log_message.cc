@@ -1,4 +1,7 @@
 #include "log_message.h"
+
+#include <string.h>
+
 #include "output.h"
 #include "comm/logging.h"
 
@@ -15,10 +18,12 @@ LogMessage::~LogMessage()
     stream() << '\0';
     const auto& buf(stream().buffer());
 
-    output.PrintFormat("SHS", level_, "%s", buf.data());
+    output.Print("SHS", level_, buf.data(),
+        strnlen(buf.data(), buf.length()));
 
     if (level_ == FATAL)
     {
+        output.Flush();
         abort();
     }
 }
@@ -22,4 +22,12 @@ private:
     int level_;
 };
 
+// Gives both branches of SLOG_LEVEL's conditional the type void; & binds
+// looser than << and tighter than ?:.
+class LogMessageVoidify
+{
+public:
+    void operator&(LogStream&) {}
+};
+
 } // namespace shs
@@ -7,17 +7,19 @@
 
 #include "comm/logging.h"
 #include "log/log_message.h"
+#include "output.h"
 
-#define SLOG_TRACE \
-    shs::LogMessage(TRACE).stream()
-#define SLOG_DEBUG \
-    shs::LogMessage(DEBUG).stream()
-#define SLOG_INFO \
-    shs::LogMessage(INFO).stream()
-#define SLOG_WARN \
-    shs::LogMessage(WARN).stream()
-#define SLOG_ERROR \
-    shs::LogMessage(ERROR).stream()
+// The level is checked before the message is built, so a disabled SLOG
+// costs a compare and its arguments are never evaluated.
+#define SLOG_LEVEL(level) \
+    !shs::output.Enabled(level) ? (void)0 : \
+    shs::LogMessageVoidify() & shs::LogMessage(level).stream()
+
+#define SLOG_TRACE SLOG_LEVEL(TRACE)
+#define SLOG_DEBUG SLOG_LEVEL(DEBUG)
+#define SLOG_INFO SLOG_LEVEL(INFO)
+#define SLOG_WARN SLOG_LEVEL(WARN)
+#define SLOG_ERROR SLOG_LEVEL(ERROR)
 #define SLOG_FATAL \
     shs::LogMessage(FATAL).stream()
 
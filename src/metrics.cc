@@ -0,0 +1,493 @@
+#include "metrics.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <tr1/functional>
+
+#include "config.h"
+#include "stats.h"
+#include "process.h"
+#include "histogram.h"
+#include "core/shs_shmem.h"
+#include "downstream/host.h"
+#include "downstream/server.h"
+#include "downstream/response_cache.h"
+
+namespace shs
+{
+
+namespace
+{
+
+const MetricDesc kStartTime = { "shs_start_time_seconds",
+    MetricDesc::kGauge, "seconds", "Unix time the server was started" };
+const MetricDesc kReloads = { "shs_reloads",
+    MetricDesc::kCounter, "", "Configuration reloads" };
+const MetricDesc kCoredumps = { "shs_coredumps",
+    MetricDesc::kCounter, "", "Workers restarted after a crash" };
+const MetricDesc kWorkers = { "shs_workers",
+    MetricDesc::kGauge, "", "Configured worker processes" };
+
+const MetricDesc kShmMapped = { "shs_shm_mapped_bytes",
+    MetricDesc::kGauge, "bytes", "Shared memory mapped by this process" };
+const MetricDesc kShmHugetlb = { "shs_shm_hugetlb_bytes",
+    MetricDesc::kGauge, "bytes", "Shared memory mapped from the hugetlb pool" };
+const MetricDesc kShmAdvised = { "shs_shm_thp_advised_bytes",
+    MetricDesc::kGauge, "bytes",
+    "Shared memory advised for transparent huge pages" };
+const MetricDesc kShmPopulated = { "shs_shm_populated_bytes",
+    MetricDesc::kGauge, "bytes", "Shared memory faulted in when mapped" };
+
+const MetricDesc kRequests = { "shs_requests",
+    MetricDesc::kCounter, "", "Requests invoked" };
+const MetricDesc kErrors = { "shs_request_errors",
+    MetricDesc::kCounter, "", "Requests failed before invoking a module" };
+const MetricDesc kTimeouts = { "shs_request_timeouts",
+    MetricDesc::kCounter, "", "Requests timed out" };
+const MetricDesc kInvokeTime = { "shs_invoke_seconds",
+    MetricDesc::kCounter, "seconds", "Time spent in invokes" };
+const MetricDesc kQueueSize = { "shs_queue_size",
+    MetricDesc::kGauge, "", "Invokes waiting for a result" };
+const MetricDesc kQueueSizeMax = { "shs_queue_size_max",
+    MetricDesc::kGauge, "", "Largest invoke queue seen" };
+const MetricDesc kConns = { "shs_server_connections",
+    MetricDesc::kGauge, "", "Open client connections" };
+const MetricDesc kServerReqs = { "shs_server_requests",
+    MetricDesc::kGauge, "", "Client requests in flight" };
+const MetricDesc kLogRecords = { "shs_log_records",
+    MetricDesc::kCounter, "", "Log messages queued for the log writer" };
+const MetricDesc kLogDropped = { "shs_log_dropped",
+    MetricDesc::kCounter, "", "Log messages dropped on a full log buffer" };
+const MetricDesc kPoolCacheHits = { "shs_pool_cache_hits",
+    MetricDesc::kCounter, "", "Request pools taken from the thread cache" };
+const MetricDesc kPoolCacheMisses = { "shs_pool_cache_misses",
+    MetricDesc::kCounter, "", "Request pools created for an empty cache" };
+const MetricDesc kPoolCacheTrims = { "shs_pool_cache_trims",
+    MetricDesc::kCounter, "", "Request pools trimmed before reuse" };
+
+const MetricDesc kHostOnline = { "shs_downstream_host_online",
+    MetricDesc::kGauge, "", "1 if the host is considered online" };
+const MetricDesc kHostInflight = { "shs_downstream_host_inflight",
+    MetricDesc::kGauge, "", "Requests in flight to the host" };
+const MetricDesc kHostDelay = { "shs_downstream_host_delay_seconds",
+    MetricDesc::kGauge, "seconds", "Moving average of the response time" };
+const MetricDesc kHostBreaker = { "shs_downstream_host_breaker_state",
+    MetricDesc::kGauge, "", "Circuit breaker, 0 closed 1 open 2 half-open" };
+const MetricDesc kHostReqs = { "shs_downstream_host_requests_1m",
+    MetricDesc::kGauge, "", "Requests sent in the last minute" };
+const MetricDesc kHostFails = { "shs_downstream_host_failures_1m",
+    MetricDesc::kGauge, "", "Failed requests in the last minute" };
+const MetricDesc kHostRetries = { "shs_downstream_host_retries_1m",
+    MetricDesc::kGauge, "", "Retried requests in the last minute" };
+
+const MetricDesc kCacheHits = { "shs_downstream_cache_hits",
+    MetricDesc::kCounter, "", "Downstream response cache fresh hits" };
+const MetricDesc kCacheStaleHits = { "shs_downstream_cache_stale_hits",
+    MetricDesc::kCounter, "", "Downstream response cache stale hits" };
+const MetricDesc kCacheMisses = { "shs_downstream_cache_misses",
+    MetricDesc::kCounter, "", "Downstream response cache misses" };
+const MetricDesc kCacheEvictions = { "shs_downstream_cache_evictions",
+    MetricDesc::kCounter, "", "Downstream response cache evictions" };
+const MetricDesc kCacheBytes = { "shs_downstream_cache_bytes",
+    MetricDesc::kGauge, "bytes", "Downstream response cache bytes in use" };
+
+const MetricDesc kLatency = { "shs_latency_seconds",
+    MetricDesc::kSummary, "seconds", "Latency since start" };
+const MetricDesc kLatencyRecent = { "shs_latency_1m_seconds",
+    MetricDesc::kSummary, "seconds", "Latency over the last minute" };
+
+struct Worker
+{
+    int index;
+    pid_t pid;
+    ProcessStats stats;
+};
+
+typedef double (*StatsField)(const ProcessStats&);
+
+void RenderWorkers(MetricsWriter* writer, const std::vector<Worker>& workers,
+    const MetricDesc& desc, StatsField field)
+{
+    writer->Family(desc);
+
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        writer->Sample()
+            .Label("process", workers[i].index)
+            .Label("pid", workers[i].pid)
+            .Value(field(workers[i].stats));
+    }
+}
+
+double QueueSize(const ProcessStats& s) { return s.curr_queue_size; }
+double QueueSizeMax(const ProcessStats& s) { return s.max_queue_size; }
+double Requests(const ProcessStats& s) { return s.persistent_num_requests; }
+double Conns(const ProcessStats& s) { return s.curr_server_conns; }
+double ServerReqs(const ProcessStats& s) { return s.curr_server_reqs; }
+
+double LogRecords(const ProcessStats& s) { return s.log_records; }
+double LogDropped(const ProcessStats& s) { return s.log_dropped; }
+double PoolHits(const ProcessStats& s) { return s.pool_cache.hits; }
+double PoolMisses(const ProcessStats& s) { return s.pool_cache.misses; }
+double PoolTrims(const ProcessStats& s) { return s.pool_cache.trims; }
+
+double Errors(const ProcessStats& s)
+{
+    return s.persistent_num_error_requests;
+}
+
+double Timeouts(const ProcessStats& s)
+{
+    return s.persistent_num_timeout_requests;
+}
+
+double InvokeTime(const ProcessStats& s)
+{
+    return s.persistent_invoke_elapsed_time;
+}
+
+struct HostSample
+{
+    std::string server;
+    std::string host;
+    const char* role;
+    const downstream::Host* h;
+    downstream::Host::Stats stats;      // last minute
+};
+
+typedef double (*HostField)(const HostSample&);
+
+void CollectHosts(downstream::Server* server, std::vector<HostSample>* hosts)
+{
+    downstream::HostGroupData* data = server->group()->data();
+    HostSample sample;
+
+    sample.server = server->name();
+
+    for (uint16_t i = 0; i < data->master_hosts_cnt; i++)
+    {
+        sample.h = &data->master_hosts[i];
+        sample.host = sample.h->ip_port();
+        sample.role = "master";
+        sample.stats = sample.h->GetStats(60);
+        hosts->push_back(sample);
+    }
+
+    for (uint16_t i = 0; i < data->slave_hosts_cnt; i++)
+    {
+        sample.h = &data->slave_hosts[i];
+        sample.host = sample.h->ip_port();
+        sample.role = "slave";
+        sample.stats = sample.h->GetStats(60);
+        hosts->push_back(sample);
+    }
+}
+
+void RenderHosts(MetricsWriter* writer, const std::vector<HostSample>& hosts,
+    const MetricDesc& desc, HostField field)
+{
+    writer->Family(desc);
+
+    for (size_t i = 0; i < hosts.size(); i++)
+    {
+        writer->Sample()
+            .Label("server", hosts[i].server)
+            .Label("host", hosts[i].host)
+            .Label("role", hosts[i].role)
+            .Value(field(hosts[i]));
+    }
+}
+
+double HostOnline(const HostSample& s) { return s.h->IsOnline() ? 1 : 0; }
+double HostInflight(const HostSample& s) { return s.h->inflight(); }
+double HostDelay(const HostSample& s) { return s.h->ewma_delay() / 1e6; }
+double HostBreaker(const HostSample& s) { return s.h->breaker_state(); }
+double HostReqs(const HostSample& s) { return s.stats.num_req; }
+double HostFails(const HostSample& s) { return s.stats.num_fail; }
+double HostRetries(const HostSample& s) { return s.stats.num_retry; }
+
+// Histogram names are "kind:key", e.g. "invoke:module/method".
+void RenderLatency(MetricsWriter* writer, const MetricDesc& desc,
+    bool recent)
+{
+    static const char* kQuantiles[] = { "0.5", "0.9", "0.99", "0.999" };
+
+    std::vector<LatencyHistogram::Summary> summaries;
+    LatencyHistogram::GetSummaries(recent, &summaries);
+
+    writer->Family(desc);
+
+    for (size_t i = 0; i < summaries.size(); i++)
+    {
+        const LatencyHistogram::Summary& h = summaries[i];
+        size_t pos = h.name.find(':');
+        std::string kind = pos == std::string::npos
+            ? std::string() : h.name.substr(0, pos);
+        std::string key = pos == std::string::npos
+            ? h.name : h.name.substr(pos + 1);
+        int64_t values[] = { h.p50, h.p90, h.p99, h.p999 };
+
+        for (int q = 0; q < 4; q++)
+        {
+            writer->Sample()
+                .Label("kind", kind)
+                .Label("name", key)
+                .Label("quantile", kQuantiles[q])
+                .Value(values[q] / 1000000.0);
+        }
+
+        writer->Sample("_sum")
+            .Label("kind", kind)
+            .Label("name", key)
+            .Value(h.sum / 1000000.0);
+        writer->Sample("_count")
+            .Label("kind", kind)
+            .Label("name", key)
+            .Value(h.count);
+    }
+}
+
+} // namespace
+
+MetricsWriter::MetricsWriter(std::string* out)
+    : out_(out)
+    , desc_(NULL)
+    , in_labels_(false)
+{
+}
+
+void MetricsWriter::Family(const MetricDesc& desc)
+{
+    static const char* kTypes[] = { "counter", "gauge", "summary" };
+
+    desc_ = &desc;
+
+    out_->append("# TYPE ").append(desc.name).append(" ")
+        .append(kTypes[desc.type]).append("\n");
+
+    if (desc.unit[0] != '\0')
+    {
+        out_->append("# UNIT ").append(desc.name).append(" ")
+            .append(desc.unit).append("\n");
+    }
+
+    out_->append("# HELP ").append(desc.name).append(" ")
+        .append(desc.help).append("\n");
+}
+
+MetricsWriter& MetricsWriter::Sample(const char* suffix)
+{
+    if (NULL == suffix)
+    {
+        suffix = desc_->type == MetricDesc::kCounter ? "_total" : "";
+    }
+
+    out_->append(desc_->name).append(suffix);
+    in_labels_ = false;
+
+    return *this;
+}
+
+MetricsWriter& MetricsWriter::Label(const char* name,
+    const std::string& value)
+{
+    return Label(name, value.c_str());
+}
+
+MetricsWriter& MetricsWriter::Label(const char* name, const char* value)
+{
+    out_->push_back(in_labels_ ? ',' : '{');
+    out_->append(name).append("=\"");
+
+    for (const char* p = value; *p; p++)
+    {
+        switch (*p)
+        {
+        case '\\': out_->append("\\\\"); break;
+        case '"': out_->append("\\\""); break;
+        case '\n': out_->append("\\n"); break;
+        default: out_->push_back(*p); break;
+        }
+    }
+
+    out_->push_back('"');
+    in_labels_ = true;
+
+    return *this;
+}
+
+MetricsWriter& MetricsWriter::Label(const char* name, int64_t value)
+{
+    out_->push_back(in_labels_ ? ',' : '{');
+    out_->append(name).append("=\"");
+
+    if (value < 0)
+    {
+        out_->push_back('-');
+        value = -value;
+    }
+
+    AppendInt(value);
+    out_->push_back('"');
+    in_labels_ = true;
+
+    return *this;
+}
+
+void MetricsWriter::Value(double value)
+{
+    CloseLabels();
+
+    if (value >= 0 && value < 1e15 && value == floor(value))
+    {
+        AppendInt((uint64_t)value);
+    }
+    else if (isnan(value))
+    {
+        out_->append("NaN");
+    }
+    else if (isinf(value))
+    {
+        out_->append(value > 0 ? "+Inf" : "-Inf");
+    }
+    else
+    {
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "%.9g", value);
+        out_->append(buf, len);
+    }
+
+    out_->push_back('\n');
+}
+
+void MetricsWriter::Value(uint64_t value)
+{
+    CloseLabels();
+    AppendInt(value);
+    out_->push_back('\n');
+}
+
+void MetricsWriter::End()
+{
+    out_->append("# EOF\n");
+}
+
+void MetricsWriter::AppendInt(uint64_t value)
+{
+    char buf[24];
+    char* p = buf + sizeof(buf);
+
+    do
+    {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    out_->append(p, buf + sizeof(buf) - p);
+}
+
+void MetricsWriter::CloseLabels()
+{
+    if (in_labels_)
+    {
+        out_->push_back('}');
+        in_labels_ = false;
+    }
+
+    out_->push_back(' ');
+}
+
+void RenderMetrics(const Config* config, std::string* out)
+{
+    MetricsWriter writer(out);
+
+    writer.Family(kStartTime);
+    writer.Sample().Value((uint64_t)g_stats->started);
+    writer.Family(kReloads);
+    writer.Sample().Value((uint64_t)g_stats->num_reload);
+    writer.Family(kCoredumps);
+    writer.Sample().Value((uint64_t)g_stats->num_coredump);
+    writer.Family(kWorkers);
+    writer.Sample().Value((uint64_t)config->num_processes());
+
+    shs_shm_map_stat_t shm_stat;
+    shs_shm_get_map_stat(&shm_stat);
+    writer.Family(kShmMapped);
+    writer.Sample().Value((uint64_t)shm_stat.mapped_size);
+    writer.Family(kShmHugetlb);
+    writer.Sample().Value((uint64_t)shm_stat.hugetlb_size);
+    writer.Family(kShmAdvised);
+    writer.Sample().Value((uint64_t)shm_stat.advised_size);
+    writer.Family(kShmPopulated);
+    writer.Sample().Value((uint64_t)shm_stat.populated_size);
+
+    std::vector<Worker> workers;
+    for (int i = 0; i < MAX_PROCESSES; ++i)
+    {
+        if (g_processes[i].type != 1 || g_processes[i].pid <= 0)
+        {
+            continue;
+        }
+
+        Worker worker;
+        worker.index = workers.size();
+        worker.pid = g_processes[i].pid;
+        ProcessStats::Snapshot(i, &worker.stats);
+        workers.push_back(worker);
+    }
+
+    RenderWorkers(&writer, workers, kRequests, Requests);
+    RenderWorkers(&writer, workers, kErrors, Errors);
+    RenderWorkers(&writer, workers, kTimeouts, Timeouts);
+    RenderWorkers(&writer, workers, kInvokeTime, InvokeTime);
+    RenderWorkers(&writer, workers, kQueueSize, QueueSize);
+    RenderWorkers(&writer, workers, kQueueSizeMax, QueueSizeMax);
+    RenderWorkers(&writer, workers, kConns, Conns);
+    RenderWorkers(&writer, workers, kServerReqs, ServerReqs);
+    RenderWorkers(&writer, workers, kLogRecords, LogRecords);
+    RenderWorkers(&writer, workers, kLogDropped, LogDropped);
+    RenderWorkers(&writer, workers, kPoolCacheHits, PoolHits);
+    RenderWorkers(&writer, workers, kPoolCacheMisses, PoolMisses);
+    RenderWorkers(&writer, workers, kPoolCacheTrims, PoolTrims);
+
+    // Only groups created in the master are shared, and their Server
+    // outlives the fork, so the pointers are valid here.
+    std::vector<HostSample> hosts;
+    downstream::HostGroupProvider::instance()->Check(
+        std::tr1::bind(CollectHosts, std::tr1::placeholders::_1, &hosts));
+
+    RenderHosts(&writer, hosts, kHostOnline, HostOnline);
+    RenderHosts(&writer, hosts, kHostInflight, HostInflight);
+    RenderHosts(&writer, hosts, kHostDelay, HostDelay);
+    RenderHosts(&writer, hosts, kHostBreaker, HostBreaker);
+    RenderHosts(&writer, hosts, kHostReqs, HostReqs);
+    RenderHosts(&writer, hosts, kHostFails, HostFails);
+    RenderHosts(&writer, hosts, kHostRetries, HostRetries);
+
+    downstream::ResponseCache* cache = downstream::ResponseCache::instance();
+    if (cache->enabled())
+    {
+        downstream::ResponseCache::Stats stats;
+        cache->GetStats(&stats);
+
+        writer.Family(kCacheHits);
+        writer.Sample().Value(stats.hits);
+        writer.Family(kCacheStaleHits);
+        writer.Sample().Value(stats.stale_hits);
+        writer.Family(kCacheMisses);
+        writer.Sample().Value(stats.misses);
+        writer.Family(kCacheEvictions);
+        writer.Sample().Value(stats.evictions);
+        writer.Family(kCacheBytes);
+        writer.Sample().Value(stats.used_bytes);
+    }
+
+    RenderLatency(&writer, kLatency, false);
+    RenderLatency(&writer, kLatencyRecent, true);
+
+    writer.End();
+}
+
+} // namespace shs
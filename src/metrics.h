@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace shs
+{
+
+class Config;
+
+// A metric family, declared once as a static descriptor. name is the
+// family name without the _total suffix and, when unit is set, must end
+// with it, as OpenMetrics requires.
+struct MetricDesc
+{
+    enum Type
+    {
+        kCounter,
+        kGauge,
+        kSummary
+    };
+
+    const char* name;
+    Type type;
+    const char* unit;
+    const char* help;
+};
+
+// Appends OpenMetrics text to a caller-owned buffer; only plain string
+// appends, so a buffer kept across scrapes does not reallocate.
+//
+//   writer.Family(kRequests);
+//   writer.Sample().Label("process", 0).Value(n);
+//   writer.End();
+class MetricsWriter
+{
+public:
+    explicit MetricsWriter(std::string* out);
+
+    void Family(const MetricDesc& desc);
+
+    // Starts a sample of the current family; suffix defaults to "_total"
+    // for counters and nothing otherwise.
+    MetricsWriter& Sample(const char* suffix = NULL);
+    MetricsWriter& Label(const char* name, const char* value);
+    MetricsWriter& Label(const char* name, const std::string& value);
+    MetricsWriter& Label(const char* name, int64_t value);
+    void Value(double value);
+    void Value(uint64_t value);
+
+    void End();
+
+private:
+    void AppendInt(uint64_t value);
+    void CloseLabels();
+
+    std::string* out_;
+    const MetricDesc* desc_;
+    bool in_labels_;
+};
+
+// Process, queue, connection, downstream host and latency metrics of
+// every worker, rendered for the monitor's /metrics.
+void RenderMetrics(const Config* config, std::string* out);
+
+} // namespace shs
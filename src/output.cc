@@ -12,22 +12,129 @@
 #include <string>
 #include <boost/lexical_cast.hpp>
 #include <boost/format.hpp>
+#include <gflags/gflags.h>
+
+#include "stats.h"
 
 namespace shs 
 {
 
 using namespace std;
 
+DEFINE_bool(log_async, true,
+    "Hand log messages to a background thread instead of writing them "
+    "from the logging thread");
+DEFINE_int32(log_ring_size, 256, "KB of log buffer per thread");
+DEFINE_string(log_overflow, "drop",
+    "When a thread's log buffer is full: drop or block");
+
+// Single-producer single-consumer byte ring of one thread's messages.
+// Records are a RecordHeader plus the NUL-terminated message, padded
+// to kRecordAlign; a record with no category fills the end of the ring
+// when the next one doesn't fit there. head and tail only grow.
+struct LogRing
+{
+    volatile uint64_t head;     // owned by the logging thread
+    uint64_t records;
+    uint64_t dropped;
+    char pad[DEFAULT_CACHELINE_SIZE - 3 * sizeof(uint64_t)];
+
+    volatile uint64_t tail;     // owned by whoever holds drain_mutex_
+    volatile bool released;     // the thread has exited
+    size_t size;
+    char* data;
+};
+
+namespace
+{
+
+const size_t kRecordAlign = 16;
+
+struct RecordHeader
+{
+    uint32_t size;              // of the whole record
+    int32_t level;
+    const char* category;       // NULL for padding
+};
+
+__thread LogRing* t_ring = NULL;
+__thread bool t_writer = false;
+
+size_t RecordSize(size_t len)
+{
+    return (sizeof(RecordHeader) + len + 1 + kRecordAlign - 1)
+        & ~(kRecordAlign - 1);
+}
+
+bool Push(LogRing* ring, const char* category, int level,
+    const char* message, size_t len)
+{
+    // a record never takes more than half the ring
+    size_t max_len = ring->size / 2 - sizeof(RecordHeader) - kRecordAlign;
+    if (len > max_len)
+    {
+        len = max_len;
+    }
+
+    uint64_t head = ring->head;
+    size_t pos = head & (ring->size - 1);
+    size_t contiguous = ring->size - pos;
+    size_t need = RecordSize(len);
+    size_t skip = contiguous < need ? contiguous : 0;
+
+    if (head + skip + need - ring->tail > ring->size)
+    {
+        return false;
+    }
+
+    if (skip)
+    {
+        RecordHeader* pad = (RecordHeader *)(ring->data + pos);
+        pad->size = skip;
+        pad->category = NULL;
+        pos = 0;
+    }
+
+    RecordHeader* record = (RecordHeader *)(ring->data + pos);
+    record->size = need;
+    record->level = level;
+    record->category = category;
+
+    char* text = (char *)(record + 1);
+    memcpy(text, message, len);
+    text[len] = '\0';
+
+    __sync_synchronize();
+    ring->head = head + skip + need;
+    ring->records++;
+
+    return true;
+}
+
+} // namespace
+
 Output output;
 
 Output::Output()
     : level_(-1)
     , f_(NULL)
+    , writer_pid_(0)
+    , writer_sleeping_(false)
+    , stop_(false)
 {
+    pthread_mutex_init(&mutex_, NULL);
+    pthread_mutex_init(&drain_mutex_, NULL);
+    pthread_cond_init(&cond_, NULL);
+    pthread_key_create(&key_, ReleaseRing);
+    pthread_atfork(AtForkPrepare, AtForkParent, AtForkChild);
 }
 
 Output::~Output()
 {
+    // anything logged from here on is written synchronously
+    stop_ = true;
+    StopWriter();
+    DrainAll();
 }
 
 void Output::SetOutputFunction(OutputFunc f) 
@@ -94,8 +201,294 @@ void Output::PrintFormat(const char* category, int level,
         }
     }
 
-    f_(category, level, buffer);
+    Print(category, level, buffer, n);
     free(buffer);
 }
 
+void Output::Print(const char* category, int level, const char* message,
+    size_t len)
+{
+    if (!Enabled(level))
+    {
+        return;
+    }
+
+    // the writer itself, or no writer to hand the message to
+    if (!FLAGS_log_async || t_writer || stop_ || !StartWriter())
+    {
+        f_(category, level, message);
+
+        return;
+    }
+
+    LogRing* ring = GetRing();
+    if (NULL == ring)
+    {
+        f_(category, level, message);
+
+        return;
+    }
+
+    while (!Push(ring, category, level, message, len))
+    {
+        if (FLAGS_log_overflow != "block")
+        {
+            ring->dropped++;
+
+            return;
+        }
+
+        Wake();
+        usleep(1000);
+    }
+
+    // otherwise the writer picks it up on its next round
+    if (ring->head - ring->tail > ring->size / 2)
+    {
+        Wake();
+    }
+}
+
+void Output::Flush()
+{
+    DrainAll();
+}
+
+void Output::GetStats(uint64_t* records, uint64_t* dropped)
+{
+    *records = 0;
+    *dropped = 0;
+
+    pthread_mutex_lock(&mutex_);
+    for (size_t i = 0; i < rings_.size(); i++)
+    {
+        *records += rings_[i]->records;
+        *dropped += rings_[i]->dropped;
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+LogRing* Output::GetRing()
+{
+    if (t_ring)
+    {
+        return t_ring;
+    }
+
+    LogRing* ring = NULL;
+
+    pthread_mutex_lock(&mutex_);
+
+    // take over the ring of a thread that has exited once it's drained
+    for (size_t i = 0; i < rings_.size(); i++)
+    {
+        if (rings_[i]->released && rings_[i]->head == rings_[i]->tail)
+        {
+            ring = rings_[i];
+            ring->released = false;
+            break;
+        }
+    }
+
+    if (NULL == ring)
+    {
+        size_t size = 16 * 1024;
+        while (size < (size_t)FLAGS_log_ring_size * 1024)
+        {
+            size <<= 1;
+        }
+
+        char* data = (char *)malloc(size);
+        if (data)
+        {
+            ring = new LogRing();
+            memset(ring, 0, sizeof(LogRing));
+            ring->size = size;
+            ring->data = data;
+            rings_.push_back(ring);
+        }
+    }
+
+    pthread_mutex_unlock(&mutex_);
+
+    if (ring)
+    {
+        pthread_setspecific(key_, ring);
+        t_ring = ring;
+    }
+
+    return ring;
+}
+
+void Output::ReleaseRing(void* ring)
+{
+    ((LogRing *)ring)->released = true;
+}
+
+void Output::Drain(LogRing* ring)
+{
+    uint64_t head = ring->head;
+    uint64_t tail = ring->tail;
+    __sync_synchronize();
+
+    while (tail != head)
+    {
+        const RecordHeader* record = (const RecordHeader *)
+            (ring->data + (tail & (ring->size - 1)));
+
+        if (record->category && f_)
+        {
+            f_(record->category, record->level, (const char *)(record + 1));
+        }
+
+        tail += record->size;
+    }
+
+    __sync_synchronize();
+    ring->tail = tail;
+}
+
+void Output::DrainAll()
+{
+    pthread_mutex_lock(&drain_mutex_);
+
+    // GetRing() may grow rings_ meanwhile, so drain a copy; the rings
+    // themselves are never freed
+    pthread_mutex_lock(&mutex_);
+    draining_.assign(rings_.begin(), rings_.end());
+    pthread_mutex_unlock(&mutex_);
+
+    for (size_t i = 0; i < draining_.size(); i++)
+    {
+        Drain(draining_[i]);
+    }
+
+    pthread_mutex_unlock(&drain_mutex_);
+}
+
+void Output::Wake()
+{
+    if (writer_sleeping_)
+    {
+        pthread_cond_signal(&cond_);
+    }
+}
+
+bool Output::StartWriter()
+{
+    pid_t pid = getpid();
+    if (writer_pid_ == pid)
+    {
+        return true;
+    }
+
+    pthread_mutex_lock(&mutex_);
+
+    if (writer_pid_ != pid)
+    {
+        if (0 == pthread_create(&writer_, NULL, WriterMain, this))
+        {
+            writer_pid_ = pid;
+        }
+    }
+
+    pthread_mutex_unlock(&mutex_);
+
+    return writer_pid_ == pid;
+}
+
+void Output::StopWriter()
+{
+    if (writer_pid_ != getpid())
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&mutex_);
+    pthread_cond_signal(&cond_);
+    pthread_mutex_unlock(&mutex_);
+
+    pthread_join(writer_, NULL);
+    writer_pid_ = 0;
+}
+
+void* Output::WriterMain(void* arg)
+{
+    t_writer = true;
+    ((Output *)arg)->WriterLoop();
+
+    return NULL;
+}
+
+// f_ takes one message at a time, so what the writer batches is the
+// wakeups: it drains every ring once per round and the logging threads
+// only signal it when their ring is filling up.
+void Output::WriterLoop()
+{
+    while (!stop_)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 10 * 1000 * 1000;
+        if (ts.tv_nsec >= 1000 * 1000 * 1000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000 * 1000 * 1000;
+        }
+
+        pthread_mutex_lock(&mutex_);
+        if (!stop_)
+        {
+            writer_sleeping_ = true;
+            pthread_cond_timedwait(&cond_, &mutex_, &ts);
+            writer_sleeping_ = false;
+        }
+        pthread_mutex_unlock(&mutex_);
+
+        DrainAll();
+
+        uint64_t records, dropped;
+        GetStats(&records, &dropped);
+        ProcessStats::SetLogCounters(records, dropped);
+    }
+
+    DrainAll();
+}
+
+// The writer calls f_ only while holding drain_mutex_, so holding it
+// across fork() keeps the child from inheriting the output function's
+// locks or stdio mid-write, e.g. when the master forks its workers.
+void Output::AtForkPrepare()
+{
+    pthread_mutex_lock(&output.drain_mutex_);
+    pthread_mutex_lock(&output.mutex_);
+}
+
+void Output::AtForkParent()
+{
+    pthread_mutex_unlock(&output.mutex_);
+    pthread_mutex_unlock(&output.drain_mutex_);
+}
+
+// Only the forking thread survives: the writer has to be started again,
+// the locks are reset, and whatever was queued before the fork is the
+// parent's to write.
+void Output::AtForkChild()
+{
+    pthread_mutex_init(&output.mutex_, NULL);
+    pthread_mutex_init(&output.drain_mutex_, NULL);
+    pthread_cond_init(&output.cond_, NULL);
+    output.writer_pid_ = 0;
+    output.writer_sleeping_ = false;
+
+    for (size_t i = 0; i < output.rings_.size(); i++)
+    {
+        LogRing* ring = output.rings_[i];
+        ring->tail = ring->head;
+        ring->records = 0;
+        ring->dropped = 0;
+        ring->released = (ring != t_ring);
+    }
+}
+
 } // namespace shs 
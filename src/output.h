@@ -1,11 +1,17 @@
 #pragma once
 
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
 #include <string>
+#include <vector>
 #include <tr1/functional>
 
 namespace shs 
 {
 
+struct LogRing;
+
 class Output 
 {
 typedef void(*OutputFunc)(const char* category, 
@@ -19,9 +25,48 @@ public:
     void SetLevel(int level);
     void PrintFormat(const char* category, int level, const char *fmt, ...);
 
+    // Checked by SLOG before anything is formatted.
+    bool Enabled(int level) const { return f_ && level >= level_; }
+
+    // message[len] must be '\0' and category must outlive the call (a
+    // literal). With FLAGS_log_async the message is copied into the
+    // calling thread's ring and handed to the output function by a
+    // background thread, otherwise the output function runs right here.
+    void Print(const char* category, int level, const char* message,
+        size_t len);
+
+    // Writes out whatever the rings hold, from the calling thread.
+    void Flush();
+
+    void GetStats(uint64_t* records, uint64_t* dropped);
+
 private: 
+    LogRing* GetRing();
+    void Drain(LogRing* ring);
+    void DrainAll();
+    void Wake();
+    bool StartWriter();
+    void StopWriter();
+    void WriterLoop();
+    static void* WriterMain(void* arg);
+    static void ReleaseRing(void* ring);
+    static void AtForkPrepare();
+    static void AtForkParent();
+    static void AtForkChild();
+
     int level_;
     OutputFunc f_;
+
+    pthread_mutex_t mutex_;         // rings_ and the writer's lifecycle
+    pthread_mutex_t drain_mutex_;   // a ring has a single consumer
+    pthread_cond_t cond_;
+    pthread_key_t key_;
+    std::vector<LogRing*> rings_;
+    std::vector<LogRing*> draining_;  // DrainAll's copy, under drain_mutex_
+    pthread_t writer_;
+    pid_t writer_pid_;
+    volatile bool writer_sleeping_;
+    volatile bool stop_;
 };
 
 extern Output output;
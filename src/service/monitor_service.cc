@@ -121,6 +121,7 @@ bool MonitorService::RegisterEvent(event_base_t* base, event_timer_t *timer,
     http_->timer = timer;
     http_->conn_pool = pool;
     http_->stat_cb = HttpStatsHandler;
+    http_->req_cb = HttpMonitorHandler;
 
     conn_t *c = conn_get_from_mem(sockfd_);
     if (!c) 
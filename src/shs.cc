@@ -12,11 +12,16 @@
 #include "core/shs_socket.h"
 #include "core/shs_thread.h"
 #include "core/shs_time.h"
+#include "core/shs_memory.h"
+#include "core/shs_shmem.h"
 #include "service/http_service.h"
 #include "service/monitor_service.h"
 
 #include "output.h"
 #include "stats.h"
+#include "histogram.h"
+#include "trace.h"
+#include "access_log.h"
 #include "config.h"
 #include "framework.h"
 #include "process_cycle.h"
@@ -109,6 +114,7 @@ bool master_on_reload()
 bool worker_main(void *data)
 {
     ProcessStats::Reset();
+    pool_cache_bind_stats(&ProcessStats::current()->pool_cache);
 
     shs_thread_t* thread = (shs_thread_t *)data;
 
@@ -118,6 +124,9 @@ bool worker_main(void *data)
         return false;
     }
 
+    // logs its own failure, a worker without an access log still serves
+    AccessLog::Open();
+
     g_framework->RemoveService("Monitor");
 #ifdef USE_SO_REUSEPORT
     g_framework->BindService();
@@ -252,13 +261,34 @@ int main(int argc, char **argv)
         return -1;
     }
 
-    if (!Stats::Init())
+    // before anything is forked, so every process shares the setting
+    size_t reserve = FLAGS_memory_tcache_reserve > 0
+        ? (size_t)FLAGS_memory_tcache_reserve << 20 : 0;
+    if (FLAGS_memory_tcache && memory_use_tcache(SHS_TRUE, reserve) != SHS_OK)
+    {
+        fprintf(stderr, "Reserve thread-caching allocator failed!\n");
+
+        return -1;
+    }
+
+    shs_shm_set_policy(
+        FLAGS_shm_hugepages ? SHS_SHM_PAGES_HUGE : SHS_SHM_PAGES_DEFAULT,
+        FLAGS_shm_populate ? SHS_TRUE : SHS_FALSE);
+
+    if (!Stats::Init() || !LatencyHistogram::Init())
     {
         fprintf(stderr, "Create shared memory failed!\n");
 
         return -1;
     }
 
+    if (!TraceRing::Init())
+    {
+        fprintf(stderr, "Create trace ring failed!\n");
+
+        return -1;
+    }
+
     add_inherited_sockets(g_inherited_listening);
     g_pid_file = cfg.pid_file().c_str();
     daemon_pid_file_proc = get_pid_file;
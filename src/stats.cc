@@ -5,12 +5,12 @@
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
-#include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <boost/format.hpp>
 
 #include "types.h"
+#include "core/shs_shmem.h"
 
 namespace shs 
 {
@@ -22,9 +22,8 @@ void*  g_shared_mem;
 
 bool Stats::Init()
 {
-    g_shared_mem = mmap(0, sizeof(Stats), PROT_READ | PROT_WRITE, 
-        MAP_ANON | MAP_SHARED, -1, 0);
-    if (g_shared_mem == MAP_FAILED)
+    g_shared_mem = shs_shm_map(sizeof(Stats), NULL);
+    if (NULL == g_shared_mem)
     {
         fprintf(stderr, "stats_init: mmap failed! err=%s\n", strerror(errno));
 
@@ -34,32 +33,6 @@ bool Stats::Init()
     g_stats = (Stats*)g_shared_mem;
     memset(g_stats, 0, sizeof(Stats));
 
-    pthread_mutexattr_t mutex_shared_attr;
-    int ret = pthread_mutexattr_init(&mutex_shared_attr);
-    if (ret != 0)
-    {
-        fprintf(stderr, "pthread_mutexattr_init failed!\n");
-
-        return false;
-    }
-
-    ret = pthread_mutexattr_setpshared(
-        &mutex_shared_attr, PTHREAD_PROCESS_SHARED);
-    if (ret != 0)
-    {
-        fprintf(stderr, "pthread_mutexattr_setpshared failed!\n");
-
-        return false;
-    }
-
-    ret = pthread_mutex_init(&(g_stats->mutex), &mutex_shared_attr);
-    if (ret != 0)
-    {
-        fprintf(stderr, "pthread_mutex_init failed!\n");
-
-        return false;
-    }
-
     g_stats->started = Timestamp::Now().SecondsSinceEpoch();
 
     return true;
@@ -70,9 +43,48 @@ ProcessStats* ProcessStats::current()
     return &(g_stats->process_stats[g_process_slot]);
 }
 
+void ProcessStats::WriteBegin()
+{
+    seq++;
+    __sync_synchronize();
+}
+
+void ProcessStats::WriteEnd()
+{
+    __sync_synchronize();
+    seq++;
+}
+
+void ProcessStats::Snapshot(int slot, ProcessStats* stats)
+{
+    const ProcessStats* pstats = &(g_stats->process_stats[slot]);
+
+    // a writer that died mid-update leaves seq odd, take what is there
+    for (int i = 0; i < 100; i++)
+    {
+        uint32_t seq = pstats->seq;
+        if (seq & 1)
+        {
+            continue;
+        }
+
+        __sync_synchronize();
+        memcpy(stats, (const void *)pstats, sizeof(ProcessStats));
+        __sync_synchronize();
+
+        if (seq == pstats->seq)
+        {
+            return;
+        }
+    }
+
+    memcpy(stats, (const void *)pstats, sizeof(ProcessStats));
+}
+
 void ProcessStats::Reset()
 {
     ProcessStats* pstats = ProcessStats::current();
+    pstats->WriteBegin();
     pstats->num_requests = 0;
     pstats->num_error_requests = 0;
     pstats->num_timeout_requests = 0;
@@ -83,33 +95,40 @@ void ProcessStats::Reset()
 
     pstats->curr_server_conns = 0;
     pstats->curr_server_reqs = 0;
+    pstats->WriteEnd();
 }
 
 void ProcessStats::AddRequest()
 {
     ProcessStats* pstats = ProcessStats::current();
+    pstats->WriteBegin();
     pstats->num_requests++;
     pstats->persistent_num_requests++;
+    pstats->WriteEnd();
 }
 
 void ProcessStats::AddErrorRequest()
 {
     ProcessStats* pstats = ProcessStats::current();
+    pstats->WriteBegin();
     pstats->num_error_requests++;
     pstats->persistent_num_error_requests++;
+    pstats->WriteEnd();
 }
 
 void ProcessStats::AddTimeoutRequest()
 {
     ProcessStats* pstats = ProcessStats::current();
+    pstats->WriteBegin();
     pstats->num_timeout_requests++;
     pstats->persistent_num_timeout_requests++;
+    pstats->WriteEnd();
 }
 
 void ProcessStats::AddInvokeElapsedTime(double elapsed_time)
 {
     ProcessStats* pstats = ProcessStats::current();
-    pthread_mutex_lock(&g_stats->mutex);
+    pstats->WriteBegin();
     pstats->invoke_elapsed_time += elapsed_time;
     pstats->persistent_invoke_elapsed_time += elapsed_time;
     pstats->persistent_last_calc_avg_cnt += 1;
@@ -117,17 +136,17 @@ void ProcessStats::AddInvokeElapsedTime(double elapsed_time)
     pstats->persistent_avg_invoke_elapsed_time += 
         (elapsed_time - pstats->persistent_avg_invoke_elapsed_time) / 
         (pstats->persistent_last_calc_avg_cnt);
-    pthread_mutex_unlock(&g_stats->mutex);
+    pstats->WriteEnd();
 }
 
 void ProcessStats::AddElapsedTimeInQueue(double elapsed_time)
 {
     ProcessStats* pstats = ProcessStats::current();
-    pthread_mutex_lock(&g_stats->mutex);
+    pstats->WriteBegin();
     pstats->persistent_avg_elapsed_time_in_queue += 
         (elapsed_time - pstats->persistent_avg_elapsed_time_in_queue) / 
         pstats->persistent_last_calc_avg_cnt;
-    pthread_mutex_unlock(&g_stats->mutex);
+    pstats->WriteEnd();
 }
 
 void ProcessStats::SetQueueSize(size_t len)
@@ -156,6 +175,19 @@ void ProcessStats::DecServerReqs()
     ProcessStats::current()->curr_server_reqs--;
 }
 
+void ProcessStats::SetLogCounters(uint64_t records, uint64_t dropped)
+{
+    // the master has no slot of its own
+    if (NULL == g_stats || g_processes[g_process_slot].pid != getpid())
+    {
+        return;
+    }
+
+    ProcessStats* pstats = ProcessStats::current();
+    pstats->log_records = records;
+    pstats->log_dropped = dropped;
+}
+
 void ProcessStats::SetPid(pid_t pid)
 {
     ProcessStats* pstats = ProcessStats::current();
@@ -173,7 +205,6 @@ double Stats::GetAvgTimePerRequest()
     int cnt = 0;
     double total = 0.000000f;
 
-    pthread_mutex_lock(&g_stats->mutex);
     for (int i = 0; i < MAX_PROCESSES; ++i)
     {
         if (g_processes[i].pid <= 0 || g_processes[i].type != 1)
@@ -181,15 +212,15 @@ double Stats::GetAvgTimePerRequest()
             continue;
         }
 
-        if (g_stats->process_stats[i].persistent_last_calc_avg_cnt > 0)
+        ProcessStats pstats;
+        ProcessStats::Snapshot(i, &pstats);
+        if (pstats.persistent_last_calc_avg_cnt > 0)
         {
-            cnt += g_stats->process_stats[i].persistent_last_calc_avg_cnt;
-            total += (
-                g_stats->process_stats[i].persistent_avg_invoke_elapsed_time * 
-                g_stats->process_stats[i].persistent_last_calc_avg_cnt);
+            cnt += pstats.persistent_last_calc_avg_cnt;
+            total += (pstats.persistent_avg_invoke_elapsed_time * 
+                pstats.persistent_last_calc_avg_cnt);
         }
     }
-    pthread_mutex_unlock(&g_stats->mutex);
 
     if (cnt > 0)
     {
@@ -204,7 +235,6 @@ double Stats::GetAvgTimeInQueue()
     int cnt = 0;
     double total = 0.000000f;
 
-    pthread_mutex_lock(&g_stats->mutex);
     for (int i = 0; i < MAX_PROCESSES; ++i)
     {
         if (g_processes[i].pid <= 0 || g_processes[i].type != 1)
@@ -212,15 +242,15 @@ double Stats::GetAvgTimeInQueue()
             continue;
         }
 
-        if (g_stats->process_stats[i].persistent_last_calc_avg_cnt > 0)
+        ProcessStats pstats;
+        ProcessStats::Snapshot(i, &pstats);
+        if (pstats.persistent_last_calc_avg_cnt > 0)
         {
-            cnt += g_stats->process_stats[i].persistent_last_calc_avg_cnt;
-            total += (
-                g_stats->process_stats[i].persistent_avg_elapsed_time_in_queue * 
-                g_stats->process_stats[i].persistent_last_calc_avg_cnt);
+            cnt += pstats.persistent_last_calc_avg_cnt;
+            total += (pstats.persistent_avg_elapsed_time_in_queue * 
+                pstats.persistent_last_calc_avg_cnt);
         }
     }
-    pthread_mutex_unlock(&g_stats->mutex);
 
     if (cnt > 0)
     {
@@ -234,7 +264,6 @@ uint32_t Stats::GetQueueSize()
 {
     uint32_t ret = 0;
 
-    pthread_mutex_lock(&g_stats->mutex);
     for (int i = 0; i < MAX_PROCESSES; ++i)
     {
         if (g_processes[i].pid <= 0 || g_processes[i].type != 1)
@@ -243,7 +272,6 @@ uint32_t Stats::GetQueueSize()
         }
         ret += g_stats->process_stats[i].curr_queue_size;
     }
-    pthread_mutex_unlock(&g_stats->mutex);
 
     return ret;
 }
@@ -252,7 +280,6 @@ uint32_t Stats::GetServerConns()
 {
     uint32_t ret = 0;
 
-    pthread_mutex_lock(&g_stats->mutex);
     for (int i = 0; i < MAX_PROCESSES; ++i)
     {
         if (g_processes[i].pid <= 0 || g_processes[i].type != 1)
@@ -261,7 +288,6 @@ uint32_t Stats::GetServerConns()
         }
         ret += g_stats->process_stats[i].curr_server_conns;
     }
-    pthread_mutex_unlock(&g_stats->mutex);
 
     return ret;
 }
@@ -270,7 +296,6 @@ uint32_t Stats::GetServerReqs()
 {
     uint32_t ret = 0;
 
-    pthread_mutex_lock(&g_stats->mutex);
     for (int i = 0; i < MAX_PROCESSES; ++i)
     {
         if (g_processes[i].pid <= 0 || g_processes[i].type != 1)
@@ -279,7 +304,6 @@ uint32_t Stats::GetServerReqs()
         }
         ret += g_stats->process_stats[i].curr_server_reqs;
     }
-    pthread_mutex_unlock(&g_stats->mutex);
 
     return ret;
 }
@@ -5,14 +5,21 @@
 #include <string>
 
 #include "comm/timestamp.h"
+#include "core/shs_types.h"
+#include "core/shs_memory_pool.h"
 
 #include "process.h"
 
 namespace shs 
 {
 
+// One slot per process, written only by that process's event loop and
+// padded to a cache line so neighbours don't false-share. Multi-field
+// updates are bracketed by a seqlock; readers go through Snapshot().
 struct ProcessStats
 {
+    volatile uint32_t seq;
+
     uint32_t curr_queue_size;
     uint32_t max_queue_size;
     double   queueing_time; 
@@ -34,6 +41,13 @@ struct ProcessStats
     double   persistent_avg_invoke_elapsed_time;
     double   persistent_avg_elapsed_time_in_queue;
 
+    // written by the log writer thread, outside the seqlock
+    uint64_t log_records;
+    uint64_t log_dropped;
+
+    // bumped atomically by every thread, see pool_cache_bind_stats()
+    pool_cache_stats_t pool_cache;
+
     pid_t    pid_;
     int      type_; // 1: worker, 2 : monitor
 
@@ -47,11 +61,17 @@ struct ProcessStats
     static void SetServerConns(size_t len);
     static void IncServerReqs();
     static void DecServerReqs();
+    static void SetLogCounters(uint64_t records, uint64_t dropped);
     static ProcessStats* current();
+    static void Snapshot(int slot, ProcessStats* stats);
 
     static void SetPid(pid_t pid);
     static void SetType(int type);
-};
+
+private:
+    void WriteBegin();
+    void WriteEnd();
+} __attribute__((aligned(DEFAULT_CACHELINE_SIZE)));
 
 struct Stats
 {
@@ -81,8 +101,6 @@ struct Stats
     double   total_persistent_invoke_elapsed_time;
     ProcessStats process_stats[MAX_PROCESSES];
 
-    pthread_mutex_t mutex;
-
     static bool Init();
     static double GetAvgTimePerRequest();
     static double GetAvgTimeInQueue();
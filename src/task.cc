@@ -6,6 +6,7 @@
 #include "http/invoke_params.h"
 #include "http/http_invoke_params.h"
 #include "comm/timestamp.h"
+#include "trace.h"
 
 DEFINE_bool(drop_expired_task, true, "drop the expired task");
 
@@ -60,6 +61,14 @@ void Task::Run() const
         {
             invoke_params_->set_dequeue_time(
                 Timestamp::Now().MicroSecondsSinceEpoch());
+
+            Trace* trace = invoke_params_->trace();
+            if (trace)
+            {
+                trace->Mark(kTraceDequeue);
+            }
+
+            Trace::Scope scope(trace);
             (*method_)(request_params_, complete_handler_, invoke_params_);
         }
         else
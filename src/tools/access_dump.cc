@@ -0,0 +1,58 @@
+// Decodes binary access log segments to text, or JSON lines.
+//
+//   shs_access_dump --dump_json /var/log/shs/access.*.bin
+
+#include <stdio.h>
+#include <string>
+#include <gflags/gflags.h>
+
+#include "access_log.h"
+
+DEFINE_bool(dump_json, false, "One JSON object per line instead of text");
+
+int main(int argc, char **argv)
+{
+    google::SetUsageMessage("shs_access_dump [--dump_json] segment...");
+    google::ParseCommandLineFlags(&argc, &argv, true);
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "No segment given!\n");
+
+        return 1;
+    }
+
+    int ret = 0;
+    std::string out;
+    std::string name;
+    shs::AccessRecord record;
+
+    for (int i = 1; i < argc; i++)
+    {
+        shs::AccessSegment segment;
+        if (!segment.Open(argv[i]))
+        {
+            fprintf(stderr, "Open access log segment %s failed!\n", argv[i]);
+            ret = 1;
+
+            continue;
+        }
+
+        while (segment.Next(&record, &name))
+        {
+            out.clear();
+            if (FLAGS_dump_json)
+            {
+                shs::AccessSegment::FormatJson(record, name, &out);
+            }
+            else
+            {
+                shs::AccessSegment::FormatText(record, name, &out);
+            }
+
+            fputs(out.c_str(), stdout);
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,159 @@
+// Measures mem_get/mem_put throughput through the per-thread magazines
+// as the number of threads sharing one pool grows.
+//
+//   shs_magazine_bench --threads 0 --ops 1000000 --batch 48
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <vector>
+#include <gflags/gflags.h>
+
+#include "shs_mblks.h"
+
+DEFINE_int32(threads, 0, "Threads to run, 0 for 1, 2, 4 ... 64 in turn");
+DEFINE_int32(ops, 1000000, "Gets, each with its put, per thread");
+DEFINE_int32(batch, 48, "Blocks a thread holds before putting them back");
+DEFINE_int32(block_size, 64, "Bytes per block");
+
+static const int kMaxThreads = 64;
+
+struct Worker
+{
+    pthread_t         tid;
+    struct mem_mblks *pool;
+    int               failed;
+};
+
+static pthread_barrier_t g_start;
+
+static void *PoolAlloc(void *priv, size_t size)
+{
+    return malloc(size);
+}
+
+static void PoolFree(void *priv, void *mem)
+{
+    free(mem);
+}
+
+static int64_t NowUs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void *Run(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+    std::vector<void *> held(FLAGS_batch);
+
+    pthread_barrier_wait(&g_start);
+
+    for (int done = 0; done < FLAGS_ops; done += FLAGS_batch)
+    {
+        int n = 0;
+        for (; n < FLAGS_batch && done + n < FLAGS_ops; n++)
+        {
+            held[n] = mem_get(worker->pool);
+            if (!held[n])
+            {
+                worker->failed++;
+                break;
+            }
+        }
+
+        while (n > 0)
+        {
+            mem_put(held[--n]);
+        }
+    }
+
+    pthread_barrier_wait(&g_start);
+
+    return NULL;
+}
+
+static bool Bench(int threads)
+{
+    mem_mblks_param_t param = {PoolAlloc, PoolFree, NULL};
+
+    // enough for every thread's batch, its magazine and its spare
+    int64_t blocks = (int64_t)threads * (FLAGS_batch + 2 * MAGAZINE_ROUNDS);
+    struct mem_mblks *pool = mem_mblks_new_fn(FLAGS_block_size, blocks,
+        &param);
+    if (!pool)
+    {
+        fprintf(stderr, "Create pool of %ld blocks failed!\n", (long)blocks);
+
+        return false;
+    }
+
+    Worker workers[kMaxThreads];
+    pthread_barrier_init(&g_start, NULL, threads + 1);
+
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].pool = pool;
+        workers[i].failed = 0;
+        pthread_create(&workers[i].tid, NULL, Run, &workers[i]);
+    }
+
+    pthread_barrier_wait(&g_start);
+    int64_t start = NowUs();
+    pthread_barrier_wait(&g_start);
+    int64_t elapsed = NowUs() - start;
+
+    int failed = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i].tid, NULL);
+        failed += workers[i].failed;
+    }
+
+    pthread_barrier_destroy(&g_start);
+
+    double ops = (double)threads * FLAGS_ops;
+    printf("%2d threads  %8.2f Mops/s  %6.1f ns/op per thread  "
+        "%d failed  %d free of %ld\n", threads,
+        elapsed > 0 ? ops / elapsed : 0.0,
+        FLAGS_ops > 0 ? elapsed * 1000.0 / FLAGS_ops : 0.0,
+        failed, mem_mblks_free_count(pool), (long)blocks);
+
+    mem_mblks_destroy(pool);
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    google::SetUsageMessage("shs_magazine_bench [--threads n] [--ops n]");
+    google::ParseCommandLineFlags(&argc, &argv, true);
+
+    if (FLAGS_threads < 0 || FLAGS_threads > kMaxThreads || FLAGS_ops < 0
+        || FLAGS_batch < 1 || FLAGS_block_size < 1)
+    {
+        fprintf(stderr, "Threads must be 0 to %d, batch and block size "
+            "at least 1!\n", kMaxThreads);
+
+        return 1;
+    }
+
+    if (FLAGS_threads > 0)
+    {
+        return Bench(FLAGS_threads) ? 0 : 1;
+    }
+
+    for (int threads = 1; threads <= kMaxThreads; threads *= 2)
+    {
+        if (!Bench(threads))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
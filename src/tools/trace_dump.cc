@@ -0,0 +1,51 @@
+// Prints the traces kept in the ring file of a running, or stopped, shs.
+//
+//   shs_trace_dump --trace_ring_file=/dev/shm/shs_trace --dump_count=50
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <gflags/gflags.h>
+
+#include "trace.h"
+
+DEFINE_int32(dump_count, 0, "Dump at most this many traces, 0 for all");
+DEFINE_bool(dump_slow_only, false, "Only dump traces that were slow");
+
+namespace shs
+{
+DECLARE_string(trace_ring_file);
+}
+
+int main(int argc, char **argv)
+{
+    google::SetUsageMessage("shs_trace_dump [--trace_ring_file=path]");
+    google::ParseCommandLineFlags(&argc, &argv, true);
+
+    if (!shs::TraceRing::Open(shs::FLAGS_trace_ring_file))
+    {
+        fprintf(stderr, "Open trace ring %s failed!\n",
+            shs::FLAGS_trace_ring_file.c_str());
+
+        return 1;
+    }
+
+    std::vector<shs::TraceRecord> records;
+    shs::TraceRing::Read(FLAGS_dump_count > 0 
+        ? FLAGS_dump_count : (size_t)-1, &records);
+
+    std::string out;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        if (FLAGS_dump_slow_only && !(records[i].flags & shs::Trace::kSlow))
+        {
+            continue;
+        }
+
+        out.clear();
+        shs::TraceRing::Format(records[i], &out);
+        fputs(out.c_str(), stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,413 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <gflags/gflags.h>
+
+#include "comm/timestamp.h"
+
+namespace shs
+{
+
+DEFINE_int32(trace_sample_rate, 0,
+    "Trace one in every N requests, 0 to disable");
+DEFINE_int32(trace_slow_ms, 0,
+    "Trace every request slower than this many ms, 0 to disable");
+DEFINE_int32(trace_ring_size, 4096, "Finished traces kept in the ring");
+DEFINE_string(trace_ring_file, "/dev/shm/shs_trace",
+    "File backing the trace ring, read by shs_trace_dump");
+DEFINE_string(trace_header, "X-Shs-Trace-Id",
+    "Header carrying the trace id to and from other services");
+
+namespace
+{
+
+const uint32_t kRingMagic = 0x53485452;   // "SHTR"
+const uint32_t kRingVersion = 1;
+
+struct RingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+    volatile uint64_t head;
+} __attribute__((aligned(sizeof(TraceRecord))));
+
+RingHeader* g_ring = NULL;
+
+__thread Trace* t_current = NULL;
+__thread uint32_t t_sequence = 0;
+
+const char* kPhaseNames[kTracePhaseMax] =
+{
+    "accept",
+    "header",
+    "body",
+    "enqueue",
+    "dequeue",
+    "invoked",
+    "downstream",
+    "downstream_done",
+    "reply",
+    "written"
+};
+
+TraceRecord* Records()
+{
+    return (TraceRecord *)(g_ring + 1);
+}
+
+bool SpanLess(const TraceRecord::Span& a, const TraceRecord::Span& b)
+{
+    return a.offset_us < b.offset_us;
+}
+
+} // namespace
+
+bool Trace::enabled_ = false;
+bool Trace::record_all_ = false;
+
+int64_t Trace::Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+Trace* Trace::Start(int64_t start_ns, const std::string& parent)
+{
+    if (!enabled_)
+    {
+        return NULL;
+    }
+
+    uint32_t seq = t_sequence++;
+    uint64_t id = 0;
+    bool sampled = false;
+
+    // without a ring there is nothing to sample for
+    if (g_ring && !parent.empty())
+    {
+        id = strtoull(parent.c_str(), NULL, 16);
+        sampled = true;
+    }
+    else if (g_ring && FLAGS_trace_sample_rate > 0)
+    {
+        sampled = (seq % FLAGS_trace_sample_rate) == 0;
+    }
+
+    if (!sampled && FLAGS_trace_slow_ms <= 0 && !record_all_)
+    {
+        return NULL;
+    }
+
+    if (0 == id)
+    {
+        id = ((uint64_t)getpid() << 48) ^ ((uint64_t)start_ns << 8) ^ seq;
+    }
+
+    return new Trace(id, start_ns, sampled);
+}
+
+void Trace::RecordAll()
+{
+    record_all_ = true;
+    enabled_ = true;
+}
+
+Trace* Trace::current()
+{
+    return t_current;
+}
+
+Trace::Scope::Scope(Trace* trace)
+    : saved_(t_current)
+{
+    t_current = trace;
+}
+
+Trace::Scope::~Scope()
+{
+    t_current = saved_;
+}
+
+Trace::Trace(uint64_t id, int64_t start_ns, bool sampled)
+    : refs_(1)
+    , num_spans_(0)
+    , start_ns_(start_ns)
+{
+    memset(&record_, 0, sizeof(record_));
+    record_.id = id;
+    record_.start_us = Timestamp::Now().MicroSecondsSinceEpoch()
+        - (Now() - start_ns) / 1000;
+    record_.pid = getpid();
+    record_.flags = sampled ? kSampled : 0;
+}
+
+void Trace::Ref()
+{
+    __sync_fetch_and_add(&refs_, 1);
+}
+
+void Trace::Unref()
+{
+    if (__sync_sub_and_fetch(&refs_, 1) > 0)
+    {
+        return;
+    }
+
+    int n = num_spans_;
+    if (n > TraceRecord::kMaxSpans)
+    {
+        n = TraceRecord::kMaxSpans;
+    }
+
+    std::sort(record_.spans, record_.spans + n, SpanLess);
+    record_.num_spans = n;
+
+    uint32_t total_us = n > 0 ? record_.spans[n - 1].offset_us : 0;
+    if (FLAGS_trace_slow_ms > 0
+        && total_us >= (uint32_t)FLAGS_trace_slow_ms * 1000)
+    {
+        record_.flags |= kSlow;
+    }
+
+    if (record_.flags)
+    {
+        TraceRing::Push(record_);
+    }
+
+    delete this;
+}
+
+void Trace::MarkAt(TracePhase phase, int64_t ns, int arg)
+{
+    int idx = __sync_fetch_and_add(&num_spans_, 1);
+    if (idx >= TraceRecord::kMaxSpans)
+    {
+        return;
+    }
+
+    int64_t offset = (ns - start_ns_) / 1000;
+
+    TraceRecord::Span* span = &record_.spans[idx];
+    span->phase = phase;
+    span->arg = arg;
+    span->offset_us = offset > 0 ? offset : 0;
+}
+
+void Trace::set_name(const std::string& name)
+{
+    strncpy(record_.name, name.c_str(), sizeof(record_.name) - 1);
+}
+
+std::string Trace::id_string() const
+{
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)record_.id);
+
+    return buf;
+}
+
+bool TraceRing::Init()
+{
+    static_assert(sizeof(TraceRecord) == 256, "TraceRecord is 256 bytes");
+
+    if (g_ring
+        || (FLAGS_trace_sample_rate <= 0 && FLAGS_trace_slow_ms <= 0))
+    {
+        return true;
+    }
+
+    uint32_t capacity = std::max(FLAGS_trace_ring_size, 1);
+    size_t size = sizeof(RingHeader) + capacity * sizeof(TraceRecord);
+
+    int fd = open(FLAGS_trace_ring_file.c_str(), O_RDWR | O_CREAT | O_TRUNC,
+        0644);
+    if (fd < 0 || ftruncate(fd, size) != 0)
+    {
+        fprintf(stderr, "trace_ring_init: create %s failed! err=%s\n",
+            FLAGS_trace_ring_file.c_str(), strerror(errno));
+
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        return false;
+    }
+
+    void* mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        fprintf(stderr, "trace_ring_init: mmap %s failed! err=%s\n",
+            FLAGS_trace_ring_file.c_str(), strerror(errno));
+
+        return false;
+    }
+
+    // a fresh file is all zeroes, so every slot starts out unwritten
+    g_ring = (RingHeader *)mem;
+    g_ring->record_size = sizeof(TraceRecord);
+    g_ring->capacity = capacity;
+    g_ring->version = kRingVersion;
+    g_ring->magic = kRingMagic;
+
+    Trace::enabled_ = true;
+
+    return true;
+}
+
+bool TraceRing::Open(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    void* mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(RingHeader))
+    {
+        mem = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (mem == MAP_FAILED)
+    {
+        return false;
+    }
+
+    RingHeader* ring = (RingHeader *)mem;
+    if (ring->magic != kRingMagic || ring->version != kRingVersion
+        || ring->record_size != sizeof(TraceRecord)
+        || sizeof(RingHeader) + (size_t)ring->capacity
+            * sizeof(TraceRecord) > (size_t)st.st_size)
+    {
+        munmap(mem, st.st_size);
+
+        return false;
+    }
+
+    g_ring = ring;
+
+    return true;
+}
+
+void TraceRing::Push(const TraceRecord& record)
+{
+    if (NULL == g_ring)
+    {
+        return;
+    }
+
+    uint64_t pos = __sync_fetch_and_add(&g_ring->head, 1);
+    TraceRecord* slot = &Records()[pos % g_ring->capacity];
+    size_t body = offsetof(TraceRecord, id);
+
+    slot->seq = pos * 2 + 1;
+    __sync_synchronize();
+    memcpy((char *)slot + body, (const char *)&record + body,
+        sizeof(TraceRecord) - body);
+    __sync_synchronize();
+    slot->seq = pos * 2 + 2;
+}
+
+void TraceRing::Read(size_t max, std::vector<TraceRecord>* records)
+{
+    if (NULL == g_ring)
+    {
+        return;
+    }
+
+    uint64_t head = g_ring->head;
+    uint64_t n = std::min((uint64_t)std::min(max, (size_t)g_ring->capacity),
+        head);
+
+    for (uint64_t pos = head - n; pos < head; pos++)
+    {
+        const TraceRecord* slot = &Records()[pos % g_ring->capacity];
+        uint64_t seq = slot->seq;
+        if (seq != pos * 2 + 2)
+        {
+            continue;
+        }
+
+        TraceRecord record;
+        __sync_synchronize();
+        memcpy(&record, (const void *)slot, sizeof(record));
+        __sync_synchronize();
+
+        if (slot->seq == seq)
+        {
+            records->push_back(record);
+        }
+    }
+}
+
+void TraceRing::Format(const TraceRecord& record, std::string* out)
+{
+    char buf[128];
+    time_t sec = record.start_us / 1000000;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+
+    size_t len = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    len += snprintf(buf + len, sizeof(buf) - len, ".%06d",
+        (int)(record.start_us % 1000000));
+    out->append(buf, len);
+
+    int n = record.num_spans;
+    if (n > TraceRecord::kMaxSpans)
+    {
+        n = TraceRecord::kMaxSpans;
+    }
+
+    uint32_t total_us = n > 0 ? record.spans[n - 1].offset_us : 0;
+
+    len = snprintf(buf, sizeof(buf),
+        " id=%016llx pid=%d code=%d total=%uus%s%s name=",
+        (unsigned long long)record.id, record.pid, record.code, total_us,
+        (record.flags & Trace::kSampled) ? " sampled" : "",
+        (record.flags & Trace::kSlow) ? " slow" : "");
+    out->append(buf, len);
+    out->append(record.name, strnlen(record.name, sizeof(record.name)));
+
+    for (int i = 0; i < n; i++)
+    {
+        const TraceRecord::Span& span = record.spans[i];
+        const char* phase = span.phase < kTracePhaseMax
+            ? kPhaseNames[span.phase] : "unknown";
+
+        if (span.phase == kTraceDownstream
+            || span.phase == kTraceDownstreamDone)
+        {
+            len = snprintf(buf, sizeof(buf), " %s#%d=%u", phase, span.arg,
+                span.offset_us);
+        }
+        else
+        {
+            len = snprintf(buf, sizeof(buf), " %s=%u", phase,
+                span.offset_us);
+        }
+
+        out->append(buf, len);
+    }
+
+    out->push_back('\n');
+}
+
+} // namespace shs
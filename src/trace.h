@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace shs
+{
+
+enum TracePhase
+{
+    kTraceAccept,           // connection accepted, first request only
+    kTraceHeader,           // request headers parsed
+    kTraceBody,             // request body read
+    kTraceEnqueue,          // handed to the module
+    kTraceDequeue,          // picked up by a module thread
+    kTraceInvoked,          // module reported its result
+    kTraceDownstream,       // downstream attempt sent, arg is the retry
+    kTraceDownstreamDone,   // downstream attempt answered
+    kTraceReply,            // reply queued on the connection
+    kTraceWritten,          // reply written out
+    kTracePhaseMax
+};
+
+// One request as stored in the ring, 256 bytes.
+struct TraceRecord
+{
+    static const int kMaxSpans = 22;
+
+    struct Span
+    {
+        uint8_t phase;
+        uint8_t arg;
+        uint16_t reserved;
+        uint32_t offset_us;     // since the first span
+    };
+
+    volatile uint64_t seq;      // see TraceRing
+    uint64_t id;
+    int64_t start_us;           // wall clock of the first span
+    int32_t pid;
+    uint16_t code;
+    uint8_t num_spans;
+    uint8_t flags;
+    char name[48];
+    Span spans[kMaxSpans];
+};
+
+// Phase timestamps of a single request. Start() only returns a trace
+// when the request is sampled (FLAGS_trace_sample_rate, or an incoming
+// FLAGS_trace_header), slow tracing is on (FLAGS_trace_slow_ms) or the
+// access log wants the timings of every request (RecordAll()), so with
+// all of them off every trace point is a NULL check.
+//
+// The event loop, the module thread and downstream contexts each hold a
+// reference; Mark() may race between them and claims its slot with an
+// atomic add. The last Unref() publishes the record to the TraceRing if
+// it was sampled or slow.
+class Trace : boost::noncopyable
+{
+public:
+    static const uint8_t kSampled = 0x01;
+    static const uint8_t kSlow = 0x02;
+
+    static bool enabled() { return enabled_; }
+    static int64_t Now();       // monotonic ns
+
+    static Trace* Start(int64_t start_ns, const std::string& parent);
+
+    // Traces every request of this process; those that are neither
+    // sampled nor slow never reach the ring.
+    static void RecordAll();
+
+    // The trace of the request the current thread works for, picked up
+    // by downstream::Request.
+    static Trace* current();
+
+    class Scope : boost::noncopyable
+    {
+    public:
+        explicit Scope(Trace* trace);
+        ~Scope();
+
+    private:
+        Trace* saved_;
+    };
+
+    void Ref();
+    void Unref();
+
+    void Mark(TracePhase phase, int arg = 0) { MarkAt(phase, Now(), arg); }
+    void MarkAt(TracePhase phase, int64_t ns, int arg = 0);
+    void set_name(const std::string& name);
+    void set_code(int code) { record_.code = code; }
+
+    uint64_t id() const { return record_.id; }
+    bool sampled() const { return record_.flags & kSampled; }
+    std::string id_string() const;
+
+private:
+    Trace(uint64_t id, int64_t start_ns, bool sampled);
+    ~Trace() {}
+
+    static bool enabled_;
+    static bool record_all_;
+    friend class TraceRing;
+    friend class AccessLog;
+
+    volatile int refs_;
+    volatile int num_spans_;
+    int64_t start_ns_;
+    TraceRecord record_;
+};
+
+// Lock-free ring of finished traces, shared by every process through
+// FLAGS_trace_ring_file so that tools/shs_trace_dump can read it after
+// the fact. Writers claim a slot with an atomic add on the head and
+// bracket the copy with the slot's seq; readers skip slots that are
+// being written or were overwritten while copying.
+class TraceRing
+{
+public:
+    // In the master, before the workers are forked; a no-op when
+    // tracing is off.
+    static bool Init();
+    static bool Open(const std::string& path);
+
+    static void Push(const TraceRecord& record);
+
+    // Up to max most recent records, oldest first.
+    static void Read(size_t max, std::vector<TraceRecord>* records);
+
+    static void Format(const TraceRecord& record, std::string* out);
+};
+
+} // namespace shs
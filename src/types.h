@@ -82,6 +82,10 @@ inline std::string ErrorCodeToString(ErrorCode::type ec)
     }
 }
 
+// Reference counted, immutable bytes shared between a downstream
+// response, an InvokeResult and the reply written back to the client.
+typedef boost::shared_ptr<const char> SharedBuffer;
+
 typedef struct invoke_result_s 
 {
     invoke_result_s() : ec(false), msg(false), results(false) {}
@@ -93,13 +97,17 @@ typedef struct invoke_result_s
 class InvokeResult 
 {
 public:
-    InvokeResult() : ec(0), msg("") {}
+    InvokeResult() : ec(0), msg(""), body_len(0) {}
     virtual ~InvokeResult() throw() {}
 
     int32_t ec;
     std::string msg;
     std::map<std::string, std::string> results;
 
+    // Reply body sent as is instead of results["result"] when set
+    SharedBuffer body;
+    size_t body_len;
+
     invoke_result_t irset;
 
     void set_ec(const int32_t val) 
@@ -120,6 +128,12 @@ public:
         irset.results = true;
     }
 
+    void set_body(const SharedBuffer& data, size_t len)
+    {
+        body = data;
+        body_len = len;
+    }
+
     bool operator == (const InvokeResult & rhs) const
     {
         if (irset.ec != rhs.irset.ec)